@@ -0,0 +1,40 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+// Headless benchmarks, run with `soft_smash --bench`. They print to stdout
+// and don't need a window.
+
+// Steps/sec and energy drift of every Integrator on the rect truss and circle presets
+void bench_integrators(void);
+// Frame cost of adaptive RK45 against RK4 on a small fixed step, for a calm
+// scene and a violent one
+void bench_adaptive(void);
+// Snapshot, restore and an 8 frame resimulation, against a 16 ms frame
+void bench_rollback(void);
+// Pairs found and time per step of each broadphase, against bounds checking
+// every pair, for a thousand small bodies spread out and bunched up in x
+void bench_broadphase(void);
+// Box and ray queries through the AABB tree, against checking every body
+void bench_queries(void);
+// checkCollision on two big blobs through their surface trees, against
+// scanning every surface, and what handleCollision leaves overlapping off
+// that one detection
+void bench_narrowphase(void);
+// What the contact solver's iteration count costs and buys on a squashed pile,
+// from scratch and warm started from the contacts cached last step
+void bench_contacts(void);
+// Balls fired at a thin platform faster and faster, with and without sweeping
+// the fast pairs, counting how many tunnel through
+void bench_ccd(void);
+// The narrowphase and contact solver on 1 to 8 threads, serial and colored,
+// checking the result doesn't depend on the thread count
+void bench_parallelContacts(void);
+// A hairpin's arms pushed into each other with and without self-collision,
+// counting the points that go through, and what it costs as it gets longer
+void bench_selfCollision(void);
+// Steps/sec of one big rect truss as rectSoftbody builds it vs after optimizeLayout_SoftBody
+void bench_layout(void);
+
+void runBenchmarks(void);
+
+#endif // BENCH_H_
@@ -0,0 +1,55 @@
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include "physics.h"
+
+#define AABBTREE_NULL -1
+
+typedef struct AABBNode {
+        BB box;     // Fattened, for leaves
+        int parent; // The next free node instead, while it's free
+        int child1;
+        int child2; // Both AABBTREE_NULL for a leaf
+        int height; // 0 for leaves, -1 while free
+        int id;     // Leaves only, whatever was handed to insert
+} AABBNode;
+
+// Dynamic bounding box tree. Every leaf holds a box a bit bigger than what
+// was inserted (`margin` all round, plus however far it moved last time, in
+// the direction it moved), so something that's only jiggling about stays
+// inside it and AABBTree_move can leave the tree alone. Inserts pick the
+// sibling that grows the tree's total perimeter least, and the way back up
+// does AVL style rotations, so it stays balanced however things move.
+// Nodes live in one pool, and link to each other by index
+typedef struct AABBTree {
+        AABBNode *nodes;
+        int numNodes; // In use
+        int maxNodes;
+        int freeList;
+        int root;
+        float margin;
+} AABBTree;
+
+// Room for maxLeaves leaves, it grows past that if it has to
+AABBTree createAABBTree(int maxLeaves, float margin);
+void freeAABBTree(AABBTree *tree);
+
+// Returns the leaf's node, for remove and move
+int AABBTree_insert(AABBTree *tree, BB box, int id);
+void AABBTree_remove(AABBTree *tree, int leaf);
+// Only touches the tree if box has left the leaf's fat box, and returns
+// whether it did. displacement is how far it moved since last time
+bool AABBTree_move(AABBTree *tree, int leaf, BB box, Vector2 displacement);
+int AABBTree_height(const AABBTree *tree);
+
+// Calls fn for every leaf whose fat box overlaps box, until it returns false
+typedef bool (*AABBQueryFn)(void *data, int id);
+void AABBTree_query(const AABBTree *tree, BB box, AABBQueryFn fn, void *data);
+
+// Calls fn for every leaf whose fat box the segment from + (to - from) * t,
+// 0 <= t <= maxFraction crosses. fn returns the new maxFraction: what it hit
+// to clip the ray there, maxFraction to carry on as it was, 0 to stop
+typedef float (*AABBRaycastFn)(void *data, int id, Vector2 from, Vector2 to, float maxFraction);
+void AABBTree_raycast(const AABBTree *tree, Vector2 from, Vector2 to, float maxFraction, AABBRaycastFn fn, void *data);
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include "aabbtree.h"
+#include "physics.h"
+
+// Two bodies whose bounds overlap, a < b
+typedef struct BodyPair {
+        int a;
+        int b;
+} BodyPair;
+
+typedef enum BroadphaseType {
+        // The default. Fine for most scenes, but bodies bunched up along x
+        // (a stack, a column of debris) all overlap in x and it slows right
+        // down towards checking all of them against each other
+        Broadphase_SweepAndPrune,
+        // For lots of similarly sized bodies. Doesn't care how they're
+        // arranged, but a body much bigger than the cells sits in a lot of
+        // them, and past HASH_MAX_CELLS gets checked against every body
+        Broadphase_SpatialHash,
+        // Doesn't care about arrangement or size, and the tree also answers
+        // PhysicsWorld_queryBox and PhysicsWorld_raycast. Bodies that stay
+        // inside their fat boxes cost next to nothing to update, so it suits
+        // scenes where most things are resting or drifting
+        Broadphase_AABBTree,
+} BroadphaseType;
+
+// Sweep and prune along x. The bodies stay sorted by bounds.min.x from one
+// update to the next, and since hardly anything changes places between two
+// frames, re-sorting with an insertion sort is close to linear. Then one sweep
+// down the sorted list finds every pair overlapping in x, and only those get
+// their y checked
+typedef struct SweepAndPrune {
+        int *order; // Body ids, by bounds.min.x as of the last update
+        BB *bounds; // bounds[i] is order[i]'s, copied in so the sweep doesn't chase pointers
+        int swaps;  // How far the last update's sort had to move things
+} SweepAndPrune;
+
+// One body in one cell
+typedef struct HashEntry {
+        int body;
+        int x, y; // The cell. Lots of cells share a bucket
+} HashEntry;
+
+// The cells a body's bounds touch, min to max inclusive
+typedef struct CellRange {
+        int x0, y0;
+        int x1, y1;
+} CellRange;
+
+// Most cells a body goes into the hash in. Anything bigger is cheaper to
+// check against every other body than to hash
+#define HASH_MAX_CELLS 256
+
+// A uniform grid of cellSize squares, hashed into numBuckets buckets so it
+// covers any amount of space. Rebuilt from scratch every update with a
+// counting sort into one flat array, so there's nothing per cell to allocate.
+// Bodies too big for it (or too far out to have a cell) go in `large`
+// instead, and bodies whose bounds aren't finite (blown up) go nowhere
+typedef struct SpatialHash {
+        float cellSize;
+        CellRange *cells; // Per body, empty if it's not in the grid
+        int numLarge;
+        int *large;       // Body ids, checked against everything
+        int numBuckets;   // A power of two
+        int *bucketStart; // Bucket i is entries[bucketStart[i], bucketStart[i + 1])
+        int numEntries;
+        int maxEntries;
+        HashEntry *entries;
+} SpatialHash;
+
+// Finds the pairs of bodies whose bounds overlap, for the narrowphase.
+// Overlap is inclusive, the same test checkCollision starts with, so every
+// pair it leaves out is one checkCollision would have rejected anyway
+typedef struct Broadphase {
+        BroadphaseType type;
+        int numBodies;
+        int maxBodies;
+        SweepAndPrune sap;
+        SpatialHash hash;
+        AABBTree tree;
+        int *leaf;    // Each body's leaf in the tree
+        bool *moved;  // Whether its leaf has moved since the last update
+        int numMoved; // Leaves the last update had to move in the tree
+        // Every pair whose fat boxes overlap, in the same order as pairs.
+        // Those only change when one of the two moves in the tree, so only
+        // the moved bodies need to query it for theirs again
+        int numFatPairs;
+        int maxFatPairs;
+        BodyPair *fatPairs;
+        BB *bounds; // Per body, copied in at the start of the update (for the hash and tree)
+        // Every overlapping pair from the last update, sorted by b then a.
+        // That's the same whichever type found them and whatever order they
+        // were found in, so handling them in this order gives the same results
+        // every time (and after a rollback)
+        int numPairs;
+        int maxPairs;
+        BodyPair *pairs;
+        int numTested; // Candidate pairs the last update checked the bounds of
+} Broadphase;
+
+// cellSize is only for Broadphase_SpatialHash. Around the size of a typical
+// body is about right. The tree's fat margin starts at BROADPHASE_TREE_MARGIN,
+// change tree.margin for another
+Broadphase createBroadphase(BroadphaseType type, int maxBodies, float cellSize);
+void freeBroadphase(Broadphase *bp);
+
+#define BROADPHASE_TREE_MARGIN 0.1f
+
+// Bodies have to be added in id order, 0 upwards
+void Broadphase_addBody(Broadphase *bp, int id, BB bounds);
+
+// Brings the tree's leaves up to date with the bodies' bounds without
+// finding any pairs, e.g. after restoring a snapshot. Does nothing for the
+// other types, they don't keep anything that can go stale
+void Broadphase_refit(Broadphase *bp, SoftBody **bodies);
+
+// Refills pairs from bodies[id]->bounds. Only allocates when there are more
+// pairs (or for the hash, body-cell overlaps) than ever before
+void update_Broadphase(Broadphase *bp, SoftBody **bodies);
+
+#endif
@@ -4,21 +4,53 @@
 #include "physics.h"
 
 typedef enum SoftBodyMaterial {
-        SoftBodyMaterial_DEFAULT
+        SoftBodyMaterial_DEFAULT,
+        SoftBodyMaterial_RUBBER, // Grippy, and bounces
+        SoftBodyMaterial_ICE,    // Hardly any friction
+        SoftBodyMaterial_METAL,
+        SoftBodyMaterial_COUNT,
 } SoftBodyMaterial;
 
+// How two materials behave against each other
+typedef struct MaterialPair {
+        float friction;    // Most the sliding impulse can be, over the pushing apart impulse
+        float restitution; // How much of the speed they hit at they bounce back with
+} MaterialPair;
+
+// Each material's friction and restitution get combined into a table of
+// every pair once, the first time any of these are called
+MaterialPair getMaterialPair(SoftBodyMaterial A, SoftBodyMaterial B);
+
 /* Collision */
-// TODO: Make this multipoint, single-point doesn't cut it
-typedef struct CollisionData {
-        bool collided;
+// One point of one body inside the other
+typedef struct Contact {
         // The struct assumes a point from A is inside B;
         // This inverts that assumption;
         bool invert;
         int point;
         int edge;
         float edge_t;
-        float distance;
-        Vector2 nearest;
+        float depth;     // From the point to the edge
+        Vector2 normal;  // The edge's, pointing out of the body it belongs to
+        Vector2 nearest; // On the edge
+        // The solver's. What it's applied so far along the normal and the
+        // edge, and the speed apart restitution's aiming for
+        float normalImpulse;
+        float tangentImpulse;
+        float bounce;
+} Contact;
+
+// Everything about one pair of bodies touching
+typedef struct CollisionData {
+        bool collided;
+        int numContacts;  // Found, even if there wasn't room for all of them
+        int firstContact; // Where the world keeps them, in its contacts
+        float depth;      // The deepest contact's
+        int numWarm;      // Contacts still on the same edge as last frame, keeping their impulses
+        // Where the world's kept this pair's contacts from last time, to
+        // recheckCollision from
+        int cachedContact;
+        int numCached;
 } CollisionData;
 
 // Note: Collision checking only works if the bodies
@@ -26,13 +58,112 @@ typedef struct CollisionData {
 // surfaces, e.t.c.
 // i.e. if the softbody doesn't have all its surfaces
 // closed and wound CCW it doesn't work
-CollisionData checkCollision(SoftBody A, SoftBody B);
+// Finds every point of either body inside the other: A's points first, then
+// B's, each in point order. Fills in up to maxContacts of them,
+// A.numPoints + B.numPoints is always enough. Both bodies need their surface
+// trees built (the builders and updateBounds_SoftBody do that)
+CollisionData checkCollision(SoftBody A, SoftBody B, Contact *contacts, int maxContacts);
+// The same, but picking up from the pair's contacts last time (as one of
+// these left them). A point that was touching looks for its edge starting
+// from last time's and walking to whichever neighbour's nearer, and only
+// searches the whole body if that doesn't pan out. If it's the same edge it
+// keeps its impulses, which solveContacts then starts from
+CollisionData recheckCollision(SoftBody A, SoftBody B, const Contact *cached, int numCached, Contact *contacts, int maxContacts);
 
 float getFriction(SoftBodyMaterial A, SoftBodyMaterial B);
 
+// One pair's contacts, as the solver sees them
+typedef struct ContactManifold {
+        SoftBody *A;
+        SoftBody *B;
+        Contact *contacts;
+        int numContacts;
+        MaterialPair material;
+} ContactManifold;
+
+// Solves every manifold's contacts together, in order. Contacts that come
+// in with impulses (from recheckCollision) get those applied up front, so
+// the iterations start from about where last frame's ended up instead of
+// from nothing. First the positions:
+// every point gets pushed back out past its edge, and since pushing one out
+// can push another back in, that goes round up to `iterations` times or
+// until nothing moves. Then the velocities, by sequential impulses:
+// `iterations` rounds of every contact stopping its point and edge moving
+// into each other (or bouncing them apart, by the restitution) and sliding
+// along each other (as far as the friction allows). More iterations is
+// firmer stacks and piles for more time
+void solveContacts(ContactManifold *manifolds, int numManifolds, int iterations);
+// The same in pieces, one manifold at a time, for solving manifolds that
+// don't share a body side by side. One round of pushing its points out
+// (returns whether any needed it), getting its contacts ready for the
+// velocity rounds, and one velocity round
+bool pushOutManifold(ContactManifold *man);
+void prepareManifold(ContactManifold *man);
+void solveManifoldVelocity(ContactManifold *man);
+
+typedef struct RaycastHit {
+        int body; // Only filled in by PhysicsWorld_raycast
+        int surface;
+        float fraction; // Of the way along the ray
+        Vector2 point;
+        Vector2 normal; // The surface's, facing back at the ray
+} RaycastHit;
+
+// Where the segment from + (to - from) * t, 0 <= t <= maxFraction first
+// crosses one of the body's surfaces. Only fills in hit if it does
+bool raycast_SoftBody(const SoftBody *sb, Vector2 from, Vector2 to, float maxFraction, RaycastHit *hit);
+
+// How far through the step (0 to 1) a point moving p0 -> p1 crosses into a
+// surface moving (a0, b0) -> (a1, b1), everything going in straight lines.
+// Only crossing in from outside counts, i.e. from the surface's right, since
+// they wind CCW. False if it doesn't this step
+bool sweepPoint(Vector2 p0, Vector2 p1, Vector2 a0, Vector2 a1, Vector2 b0, Vector2 b1, float *toi, float *edge_t);
+
+// A point's first hit in timeOfImpact
+typedef struct PointHit {
+        float toi; // INFINITY if it doesn't
+        int edge;
+        float edge_t;
+} PointHit;
+
+// Sweeps A's points against B's surfaces and B's against A's, from where
+// they were at the start of the step (fromA, fromB, per point) to where they
+// are now. Returns the earliest time (as sweepPoint's) a point crosses in
+// and ends up too deep for checkCollision to be trusted with it: further in
+// than depthA into A or depthB into B, or out the other side. Points that
+// only go in a little are left to checkCollision, so a fast body sliding
+// along another doesn't keep hitting it.
+// Contacts for that hit and the others just after it go in contacts, set up
+// for the two bodies as they'd be at that time. Returns 1 with none if
+// nothing does. hits is scratch, room for A.numPoints + B.numPoints
+float timeOfImpact(SoftBody A, const Vector2 *fromA, SoftBody B, const Vector2 *fromB, float depthA, float depthB, PointHit *hits,
+                   Contact *contacts, int maxContacts, int *numContacts);
+
 // char *debugString = ((void *)0);
 
+#define CONTACT_ITERATIONS 8
+// Most colors ContactOrder_Colored splits the manifolds into
+#define CONTACT_COLORS 64
+
+// What handleCollision moves one point by in a round
+typedef struct ContactPush {
+        Vector2 out;   // Out of the other body, if it's inside it
+        Vector2 edges; // Summed over the contacts on edges it's an end of
+        int numEdges;
+} ContactPush;
+
 // Handles collisions, applying forces to each, e.t.c.
-void handleCollision(SoftBody A, SoftBody B, CollisionData data, SoftBodyMaterial matA, SoftBodyMaterial matB, float dt);
+// Resolves one pair from the numContacts contacts one checkCollision found,
+// without checking again. solveContacts pushes the points out one after
+// another, and when both bodies are in each other every push shoves the
+// edge's ends (points that are in the other body themselves) further in for
+// the next push to undo. Here every push gets worked out from where the
+// points are, then they all go at once: a point inside goes out by its
+// share, and an edge's ends by the average of what the contacts on that
+// edge want. That goes round over the same contacts (up to CONTACT_ITERATIONS
+// times) until none are still in, then the velocities get solved the same as
+// solveContacts does. A and B's bounds are up to date afterwards.
+// pushes is scratch, room for A->numPoints + B->numPoints
+void handleCollision(SoftBody *A, SoftBody *B, Contact *contacts, int numContacts, SoftBodyMaterial matA, SoftBodyMaterial matB, ContactPush *pushes);
 
 #endif // COLLISION_H_
\ No newline at end of file
@@ -4,6 +4,12 @@
 #include <raylib.h>
 #include <raymath.h>
 
+// Letting the compiler reorder or fuse float math means two builds of the
+// same code can simulate differently, and lockstep can't survive that
+#ifdef __FAST_MATH__
+#error "Don't build with -ffast-math, it breaks PhysicsWorld's determinism"
+#endif
+
 typedef struct {
         Vector2 position;
         float rotation;
@@ -11,4 +17,22 @@ typedef struct {
 
 Vector2 applyTransform(Transform2D transform, Vector2 v);
 
-#endif
\ No newline at end of file
+// Portable math, for anything that feeds into the simulation. These are
+// built out of nothing but +, -, *, / and exact bit twiddling (frexp,
+// ldexp...), which IEEE 754 pins down to the last bit, so they give the same
+// answer on every compiler, libm and CPU. libm's are only promised to be
+// close, and really do differ between platforms.
+// (sqrtf is already exact everywhere, IEEE requires it be correctly rounded.)
+// They're also quite a bit cheaper than libm, since they skip all the care
+// it takes over huge arguments and errno
+
+// Error around 1e-7 for |x| up to a few thousand
+void detSinCos(float x, float *s, float *c);
+float detSin(float x);
+float detCos(float x);
+// Error around 2e-6 radians, same signs and zeros as atan2f
+float detAtan2(float y, float x);
+// x^y for x > 0, relative error around 1e-6
+float detPow(float x, float y);
+
+#endif
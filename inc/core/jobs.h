@@ -0,0 +1,61 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Runs items [begin, end) of a parallel for, on thread `worker`
+// (0 is whoever called JobSystem_parallelFor)
+typedef void (*JobRangeFunc)(void *data, int begin, int end, int worker);
+
+// Max jobs in flight at once, parallelFor bumps the grain to stay under it
+#define JOB_DEQUE_CAPACITY 4096
+
+// Chase-Lev work-stealing deque of job indices. The owning thread pops
+// from the bottom and everyone else steals from the top. parallelFor fills
+// them all up front, while no worker is in any of them
+typedef struct JobDeque {
+        atomic_long top;
+        atomic_long bottom;
+        atomic_int *jobs;
+} JobDeque;
+
+// A persistent pool of worker threads. The thread that calls
+// JobSystem_parallelFor is worker 0 and pitches in too, so numThreads
+// includes it. Workers sleep when there's nothing to do.
+typedef struct JobSystem {
+        int numThreads;
+        void *threads; // pthread_t[numThreads - 1]
+        JobDeque *deques;
+
+        // The parallel for currently running. Only one at a time, and
+        // parallelFor doesn't return until every job in it is done, which is
+        // what makes consecutive calls safe to use as dependent phases
+        JobRangeFunc fn;
+        void *data;
+        int count;
+        int grain;
+        atomic_int remaining;
+        atomic_int searching; // Workers in the deques right now
+
+        // Waking/stopping the workers
+        void *mutex;
+        void *cond;
+        atomic_int generation;
+        atomic_bool quit;
+} JobSystem;
+
+// numThreads of 1 (or less) doesn't start any threads and runs everything inline
+JobSystem *createJobSystem(int numThreads);
+void freeJobSystem(JobSystem *js);
+
+// Splits [0, count) into jobs of `grain` items and blocks until all of them
+// have run. The split only depends on count and grain, never on the thread
+// count, so per-job results can be made identical however many threads there
+// are. js can be NULL to just run on this thread
+void JobSystem_parallelFor(JobSystem *js, int count, int grain, JobRangeFunc fn, void *data);
+
+// How many workers a parallelFor on js can use, for sizing per-thread buffers
+int JobSystem_numWorkers(JobSystem *js);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "physics.h"
+
+// Renumbers sb's points so that points joined by a spring or surface end up
+// close together in memory (reverse Cuthill-McKee on the spring + surface
+// graph), then sorts the springs and surfaces by their first point. The force
+// loops then walk pointPos mostly forwards instead of jumping all over it,
+// which starts to matter once a body has a few thousand points.
+// If the points are already numbered tighter than RCM manages (rectSoftbody's
+// columns are), they're left alone and only the springs/surfaces get sorted.
+//
+// Call it once the body's built but before PhysicsWorld_addBody, since the
+// world keeps its own copy of the topology. If remap isn't NULL it gets the
+// new index of every old point (numPoints ints), for fixing up anything else
+// that was holding on to point indices (renderers, gameplay code...). The
+// body's own shape clusters get remapped already.
+// Springs may come out pointing the other way, which doesn't change anything
+// they do; surfaces keep their direction.
+void optimizeLayout_SoftBody(SoftBody *sb, int *remap);
+
+// The furthest apart any two points joined by a spring or surface are
+// numbered, which is what optimizeLayout_SoftBody tries to bring down
+int bandwidth_SoftBody(const SoftBody *sb);
+
+// indices[i] = remap[indices[i]], for applying an optimizeLayout_SoftBody remap
+void remapPointIndices(int *indices, int num, const int *remap);
+
+#endif
@@ -20,6 +20,29 @@ typedef enum SoftBodyType {
         SoftBodyType_Shape = 0b001,
         SoftBodyType_Pressure = 0b010,
 } SoftBodyType;
+// Where the rest shape best fits some points:
+// goal_i = rot * (shape_i - restCenter) + center
+typedef struct ShapeFrame {
+        Vector2 center;
+        Vector2 rot; // (cos, sin) of the rotation
+} ShapeFrame;
+
+// Nodes are depth first, so a node's first child is the one right after it
+// and both children come after it
+typedef struct SurfaceNode {
+        BB box;    // Around the surfaces under it, as of the last refit
+        int right; // The second child, or -1 for a leaf
+        int first; // Leaves only, surfaceOrder[first, first + count)
+        int count;
+} SurfaceNode;
+
+// Some of a body's points, shape matched on their own
+typedef struct ShapeCluster {
+        int begin; // Members are clusterPoints[begin, end)
+        int end;
+        Vector2 restCenter; // Centroid of the members' shape, worked out once up front
+} ShapeCluster;
+
 typedef struct SoftBody {
         SoftBodyType type;
         int numPoints;
@@ -45,9 +68,50 @@ typedef struct SoftBody {
         float shapeSpringStrength;
         float nRT;
         BB bounds;
+        // Optional. With none, shape matching fits the whole body at once.
+        // With some, every cluster gets fitted on its own and only pulls on
+        // its own members, so a big body can jiggle locally without needing
+        // extra springs. A point in more than one cluster gets pulled by each
+        int numClusters;
+        ShapeCluster *clusters;
+        int *clusterPoints;
+        // Bounding box tree over the surfaces, for collision. Built once the
+        // surfaces are in, refit by updateBounds_SoftBody
+        int numSurfaceNodes;
+        SurfaceNode *surfaceNodes;
+        int *surfaceOrder; // Surface indices, grouped by leaf
+        // The surfaces either side of each one (ending where it starts and
+        // starting where it ends), -1 if there isn't one. Built with the tree
+        int *surfacePrev;
+        int *surfaceNext;
 } SoftBody;
 
-void update_SoftBody(SoftBody *sb, WorldValues worldValues, float dt);
+// Grow-only scratch memory for the integrator. Reserve it once from the
+// largest body and after that stepping never touches the heap.
+// Memory handed out is zeroed, same as MemAlloc.
+typedef struct SimArena {
+        Vector2 *data;
+        int capacity; // In Vector2s
+        int used;
+        int numAllocs; // Times we've actually had to go to the heap
+} SimArena;
+void reserve_SimArena(SimArena *arena, int num);
+// Growing mid-frame moves the block, invalidating earlier pushes,
+// so reserve up front
+Vector2 *push_SimArena(SimArena *arena, int num);
+void reset_SimArena(SimArena *arena);
+void free_SimArena(SimArena *arena);
+
+void update_SoftBody(SoftBody *sb, SimArena *scratch, WorldValues worldValues, float dt);
+// Recalculates sb->bounds from the current point positions, and refits
+// the surface tree
+void updateBounds_SoftBody(SoftBody *sb);
+// (Re)builds the surface tree from scratch. The builders do this, only
+// needed after changing the surfaces by hand
+void buildSurfaceTree_SoftBody(SoftBody *sb);
+// Just the tree's boxes, for when some points moved but the surfaces didn't
+// change. Builds it if it hasn't been yet
+void refitSurfaceTree_SoftBody(SoftBody *sb);
 void SBPoint_addForce(SoftBody *sb, int i, Vector2 force, float dt);
 
 SoftBody createEmptySoftBody(
@@ -74,6 +138,7 @@ typedef struct SBPoints {
         Vector2 *pos;
         Vector2 *vel;
 } SBPoints;
+// All of the forces at once, through forceKernels
 void calcForces(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues);
 void calcForce_springs(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues);
 void calcForce_shape(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues);
@@ -81,6 +146,39 @@ void calcForce_pressure(Vector2 *forces, SoftBody sb, SBPoints points, WorldValu
 void calcForce_drag(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues);
 void projectSB(SBPoints *dest, SBPoints src, Vector2 *forces, float dt, float invMass);
 
+// One body's worth of what the force kernels need. The indices can point
+// anywhere into points/forces, so the world can hand over its packed arrays
+// as they are. shape is indexed the same as the points
+typedef struct ForceBody {
+        int firstPoint;
+        int numPoints;
+        const Vector2 *shape;
+        int numSprings;
+        const int *springA;
+        const int *springB;
+        const float *lengths;
+        int numSurfaces;
+        const int *surfaceA;
+        const int *surfaceB;
+        int numClusters;
+        const ShapeCluster *clusters;
+        const int *clusterPoints;
+        float mass;
+        float linearDrag;
+        float springStrength;
+        float springDamp;
+        float shapeSpringStrength;
+        float nRT;
+} ForceBody;
+// Adds every force on the body: springs, shape, gravity, then pressure and
+// drag together in one pass over the surfaces
+typedef void (*ForceKernel)(Vector2 *forces, const ForceBody *body, SBPoints points, WorldValues worldValues);
+// One kernel per combination of SoftBodyType flags, each compiled with its
+// flags baked in, so there's no type checks left inside the loops.
+// Index with the body's type
+extern const ForceKernel forceKernels[8];
+ForceBody forceBody_SoftBody(SoftBody *sb);
+
 typedef struct SBPos {
         Vector2 position;
         float rotation;
@@ -88,6 +186,22 @@ typedef struct SBPos {
 // Calculates and stores the position and rotation of the softbody (as for shape matching)
 SBPos calcShape(SoftBody sb, SBPoints points);
 
+// Closed form best fit of the shape onto the points: the centroid, then the
+// rotation straight from the summed dot and cross products of the shape
+// against the points, no trig at all. Uses points members[0, num), or
+// [0, num) if members is NULL. The whole body's restCenter is {0, 0}, since
+// the builders center the shape
+ShapeFrame matchShape(const Vector2 *shape, Vector2 restCenter, const Vector2 *pos, const int *members, int num);
+// forces += k * (goal - pos) for the same points matchShape took
+void pullToShape(Vector2 *forces, const Vector2 *shape, const Vector2 *pos, const int *members, int num, ShapeFrame frame, Vector2 restCenter, float k);
+
+// Adds a cluster of the given points
+void addCluster_SoftBody(SoftBody *sb, const int *members, int num);
+// Covers the rest shape with a cellsX by cellsY grid of clusters, each
+// grown by `overlap` cells on every side so neighbours share some points
+// (without overlap the clusters just slide past each other)
+void gridClusters_SoftBody(SoftBody *sb, int cellsX, int cellsY, float overlap);
+
 Vector2 *alloc_forces(int num);
 void sumForces(int num, Vector2 *forces, Vector2 *other, float multiplier);
 
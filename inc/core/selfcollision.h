@@ -0,0 +1,51 @@
+#ifndef SELFCOLLISION_H
+#define SELFCOLLISION_H
+
+#include "collision.h"
+#include "physics.h"
+
+// One surface point in one of the cells its path this step goes through
+typedef struct SelfEntry {
+        int point;
+        int x, y;
+} SelfEntry;
+
+// Most cells one point's path goes into the grid in, a point that went
+// further than that this step goes on the overflow list instead
+#define SELF_MAX_CELLS 9
+
+// A body's surface points in a uniform grid, hashed into buckets the same
+// way the broadphase's SpatialHash does bodies, each point in every cell it
+// went through this step. Rebuilt from scratch every time with a counting
+// sort. Sized by reserveSelfHash for the biggest body, so one of these does
+// for every body in a world and finding contacts never has to grow it
+typedef struct SelfHash {
+        float cellSize;   // Twice the body's average surface length, picked every rebuild
+        int numBuckets;   // A power of two
+        int *bucketStart; // Bucket i is entries[bucketStart[i], bucketStart[i + 1])
+        int maxEntries;
+        SelfEntry *entries;
+        int maxPoints;
+        int *pointContact; // Per point, which contact it has so far, -1 if none
+        int numOverflow;
+        int *overflow;     // Points that went too far to hash, every surface checks these
+} SelfHash;
+
+// Makes room for a body this big up front. findSelfContacts does this too,
+// but then it might be allocating mid-step
+void reserveSelfHash(SelfHash *hash, int numSurfaces, int numPoints);
+void freeSelfHash(SelfHash *hash);
+
+// Finds sb's surface points that went in through one of its own surfaces
+// since `from` (every point's position at the start of the step), i.e. the
+// body folded through itself. Each surface only checks the points that went
+// through the same cells as it, and never the ones it's joined to: its own
+// two ends and the far ends of the surfaces either side (from surfacePrev and
+// surfaceNext), which can't go through it without the outline turning itself
+// inside out. Only catches points that went in this step, and only from the
+// outside in. One contact per point, on the nearest surface it's in behind,
+// for solveContacts with sb as both A and B. Points and surfaces that aren't
+// finite any more are left out. Returns how many it found, up to maxContacts
+int findSelfContacts(SelfHash *hash, const SoftBody *sb, const Vector2 *from, Contact *contacts, int maxContacts);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include <stdbool.h>
+
+// Fixed timestep clock. Feed it however long the frame took and it says
+// how many fixed steps to take, so physics always sees the same dt no
+// matter the framerate (and a laggy frame can't turn into one giant step).
+typedef struct SimClock {
+        float fixedDt;
+        float accumulator;
+        // Most steps to take in one frame. Past that we just drop time,
+        // otherwise a slow frame causes more steps, which causes a slower
+        // frame, e.t.c. (spiral of death)
+        int maxSubsteps;
+        // How far between the previous and current step the leftover time is,
+        // for render interpolation
+        float alpha;
+        // From the last SimClock_advance
+        int lastSteps;
+        bool droppedTime;
+} SimClock;
+
+SimClock createSimClock(float stepsPerSecond, int maxSubsteps);
+// Returns how many fixed steps to run this frame
+int SimClock_advance(SimClock *clock, float frameTime);
+
+#endif
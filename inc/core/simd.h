@@ -0,0 +1,44 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Elementwise kernels for the integrator, picked at runtime based on what
+// the CPU supports.
+// These all treat a Vector2 array as a flat array of floats (count is in
+// floats, so 2 * numPoints). Every op here does the exact same thing to x
+// and y, so the interleaved layout is already a perfect fit for SIMD and
+// there's no need to shuffle into separate x[]/y[] arrays first.
+// All levels do the same ops in the same order, so they give bit-identical
+// results; the scalar one is the reference.
+typedef enum SimdLevel {
+        SimdLevel_Scalar,
+        SimdLevel_SSE,
+        SimdLevel_AVX2,
+} SimdLevel;
+
+typedef struct SimdKernels {
+        SimdLevel level;
+        // dstVel = srcVel + forces * velScale
+        // dstPos = srcPos + dstVel * dt
+        void (*project)(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, int count, float velScale, float dt);
+        // Same as project, but with a separate inverse mass for every float,
+        // for when the buffer spans bodies of different masses
+        // dstVel = srcVel + forces * (dt * invMass)
+        void (*projectMasses)(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, const float *invMass, int count, float dt);
+        // dst += src * multiplier
+        void (*sum)(float *dst, const float *src, int count, float multiplier);
+        // dst += k1 * a + k2 * b + k3 * b + k4 * a
+        // The RK4 weighted average in one pass instead of four
+        void (*rk4Combine)(float *dst, const float *k1, const float *k2, const float *k3, const float *k4, int count, float a, float b);
+        // The shape matching pull, forces += k * (R * shape + t - pos) with R
+        // the rotation by (cosA, sinA). Unlike the rest, x and y aren't
+        // treated the same here, so count has to be even
+        void (*shapePull)(float *forces, const float *pos, const float *shape, int count, float cosA, float sinA, float tx, float ty, float k);
+} SimdKernels;
+
+SimdLevel detectSimdLevel(void);
+// Clamped to whatever the CPU actually supports. Mostly useful for forcing
+// the scalar path to compare against
+void selectSimdKernels(SimdLevel level);
+const SimdKernels *getSimdKernels(void);
+
+#endif
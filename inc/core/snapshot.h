@@ -0,0 +1,85 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "world.h"
+
+// Everything about one body that changes while stepping, apart from its points
+typedef struct BodySnapshot {
+        Vector2 shapePosition;
+        float shapeRotation;
+        BB bounds;
+        bool asleep;
+        int stillFrames;
+        int island;
+        float step; // Integrator_Adaptive's
+} BodySnapshot;
+
+// One frame of a world's mutable state: the points, the per-body state and
+// the contacts, plus whatever the integrators carry from one step to the next
+// (Verlet's forces, the implicit warm start), so stepping on from a restore
+// comes out exactly the same as it did the first time.
+// The topology never changes once the bodies are in, so it isn't copied.
+// Points are packed in the world's order, same as bodyStart
+typedef struct WorldSnapshot {
+        int frame;
+        Vector2 *pos;
+        Vector2 *vel;
+        Vector2 *lastForces;
+        Vector2 *lastDv;
+        BodySnapshot *bodies;
+        // The broadphase's pairs come and go, so these have the ring's
+        // maxPairs of room rather than a fixed count
+        int numPairs;
+        int *pairA;
+        int *pairB;
+        CollisionData *pairCollisions;
+        // Likewise the contacts. The next collide rechecks from these and
+        // warm starts from their impulses, so they're part of the state too
+        int numContacts;
+        Contact *contacts;
+        bool lastForcesValid;
+        Integrator lastIntegrator;
+        int numIslands;
+} WorldSnapshot;
+
+// The last `capacity` snapshots, for rollback. Everything's allocated up
+// front, so saving and restoring are just memcpys and never touch the heap.
+// Sized for the world as it is when the ring's made, so add every body first.
+// The pairs and contacts are the exception, the world grows its own as more
+// bodies end up touching, so the ring can end up short of room for them. See
+// reserve_SnapshotRing
+typedef struct SnapshotRing {
+        int capacity;
+        int count;
+        int oldest; // Slot of the oldest snapshot, the rest follow it round
+        int numPoints;
+        int numBodies;
+        int maxPairs;    // Room in every frame
+        int maxContacts; // Likewise
+        WorldSnapshot *frames;
+        void *memory;
+} SnapshotRing;
+
+// Room for as many pairs and contacts as the world has room for right now
+SnapshotRing createSnapshotRing(PhysicsWorld *world, int capacity);
+void freeSnapshotRing(SnapshotRing *ring);
+// Makes room in every frame for this many pairs and contacts, keeping what's
+// saved. This is the only thing that allocates after creating the ring, so do
+// it up front with a worst case, or between frames when save_SnapshotRing says
+// it's short (world->maxPairs and world->maxContacts are always enough), but
+// not while rolling back
+void reserve_SnapshotRing(SnapshotRing *ring, int maxPairs, int maxContacts);
+
+// Saves the world's state as `frame`, dropping the oldest snapshot if the
+// ring's full. Frames are whatever the caller counts in, but should go up.
+// Never allocates. Returns false, saving nothing, if the world has more pairs
+// or contacts than the ring has room for
+bool save_SnapshotRing(SnapshotRing *ring, PhysicsWorld *world, int frame);
+// Puts the world back how it was at `frame`, and forgets every snapshot after
+// it, since resimulating is about to replace them. Returns false (and leaves
+// everything alone) if that frame's not in the ring.
+// Only the world's own state and the bodies' state gets restored; anything
+// gameplay keeps on the side needs rolling back separately
+bool restore_SnapshotRing(SnapshotRing *ring, PhysicsWorld *world, int frame);
+
+#endif
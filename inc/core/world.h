@@ -0,0 +1,434 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "broadphase.h"
+#include "collision.h"
+#include "jobs.h"
+#include "physics.h"
+#include "selfcollision.h"
+
+// Per-body parameters pulled out of the SoftBody so the batched kernels
+// can look them up by body id. Refreshed from the bodies every step, so
+// tweaking e.g. springStrength on the SoftBody still works
+typedef struct BodyParams {
+        SoftBodyType type;
+        float mass;
+        float invMass;
+        float linearDrag;
+        float springStrength;
+        float springDamp;
+        float shapeSpringStrength;
+        float nRT;
+        // forceKernels[type]
+        ForceKernel calcForces;
+} BodyParams;
+
+// How the world advances its points every step.
+// Every body in a world gets stepped together in one packed batch, so this is
+// per world; if a body needs a different integrator, give it its own world
+typedef enum Integrator {
+        // Classic RK4, 4 force evaluations per step. The reference
+        Integrator_RK4,
+        // Kick then drift, 1 force evaluation per step
+        Integrator_SymplecticEuler,
+        // Velocity Verlet (kick-drift-kick). Reuses the last step's forces for
+        // the first kick, so also 1 force evaluation per step
+        Integrator_Verlet,
+        // Extended position based dynamics, `substeps` substeps of one
+        // constraint pass each. Springs and shape matching become compliant
+        // constraints (compliance = 1 / strength), pressure, gravity and drag
+        // stay forces. Cheap enough per substep that you can crank the
+        // stiffness without it exploding
+        Integrator_XPBD,
+        // Linearized backward Euler (Baraff & Witkin style). Springs and shape
+        // matching are implicit, pressure/gravity/drag explicit. Solves for the
+        // velocity change with a Jacobi-preconditioned conjugate gradient that
+        // never builds the matrix, warm-started from last step's answer.
+        // Stable with one big step per frame even at silly stiffnesses
+        Integrator_Implicit,
+        // Dormand-Prince 5(4). Every body picks its own step size: the
+        // embedded 4th order solution gives an error estimate each step, and
+        // the step grows or shrinks to keep it under adaptiveTolerance. A calm
+        // body takes one step per frame, one getting smashed takes as many as
+        // it needs (up to adaptiveMaxSteps). 6 force evaluations per step
+        Integrator_Adaptive,
+} Integrator;
+
+// How collide_PhysicsWorld goes through the manifolds when solving contacts
+typedef enum ContactOrder {
+        // One after another in pair order, on the calling thread. The default
+        ContactOrder_Serial,
+        // Split into colors where no two manifolds share a body, each color
+        // spread over the job system. Still the same result however many
+        // threads there are, but not the same as Serial's, since the
+        // manifolds go in color order instead. Worth it once there are lots
+        // of pairs touching and threads to spare
+        ContactOrder_Colored,
+} ContactOrder;
+
+// Per-spring Jacobian, rebuilt every implicit step. With n the spring's
+// unit direction and u the difference of something at its two ends:
+//   stiffness: k (n.u) n + kPerp (u - (n.u) n)
+//   damping:   c (n.u) n
+typedef struct ImplicitSpring {
+        Vector2 n;
+        float k;
+        float kPerp;
+        float c;
+} ImplicitSpring;
+
+// Per-body data for the implicit shape matching. The goal moves with the
+// body, so its stiffness only acts on whatever isn't rigid motion
+typedef struct ImplicitBody {
+        Vector2 centroid;
+        float inertia; // Sum of |x - centroid|^2
+        // Filled per product: mean velocity and angular velocity
+        Vector2 meanV;
+        float spin;
+} ImplicitBody;
+
+// A run of consecutive bodies, and so also of consecutive packed points,
+// springs and surfaces. Bodies never interact while integrating, so
+// different ranges can be stepped on different threads
+typedef struct WorldRange {
+        int bodyBegin, bodyEnd;
+        int pointBegin, pointEnd;
+        int springBegin, springEnd;
+        int surfaceBegin, surfaceEnd;
+        // A single body with at least splitPoints points. Its spring and
+        // surface loops get spread over the job system by color instead
+        bool wide;
+} WorldRange;
+
+// One kind of edge (springs or surfaces) split into batches where no two
+// edges share a point, so a whole batch can add onto `forces` at once
+// without any two writers hitting the same point. Every point gets its
+// contributions in batch order, so the result doesn't depend on how a
+// batch gets split up or the thread count. Batch order isn't edge order
+// though, so it only matches the unsplit kernels up to rounding
+typedef struct EdgeColoring {
+        int *order; // Edge indices, batch after batch
+        int numBatches;
+        int *batchStart; // Batch i is order[batchStart[i], batchStart[i + 1])
+        int *bodyBatch;  // Body b's batches are [bodyBatch[b], bodyBatch[b + 1])
+} EdgeColoring;
+
+// How a body moved over the step, for picking out the pairs to sweep
+typedef struct SweptBody {
+        BB box;          // Covering where it started and where it is now
+        float moved;     // Furthest any of its points went
+        float thickness; // Its bounds' shorter side
+        bool fast;       // Moved enough it might need sweeping against something
+} SweptBody;
+
+// Owns everything that has to outlive a single step, so that stepping
+// itself doesn't need to allocate. Bodies are still owned by the caller,
+// the world just keeps pointers to them.
+//
+// Stepping doesn't go body by body. Every body's points get packed end to
+// end into one buffer and each integrator stage runs over all of them at once,
+// so the loops see the whole scene instead of 15 points at a time.
+// The topology is copied in at PhysicsWorld_addBody, so don't rebuild a
+// body's springs/surfaces after adding it.
+typedef struct PhysicsWorld {
+        WorldValues values;
+        int numBodies;
+        int maxBodies;
+        SoftBody **bodies;
+        BodyParams *params;
+        // The same again, plus where the body's topology sits in the packed
+        // arrays, for handing to params[b].calcForces
+        ForceBody *forceBodies;
+        // Body i owns packed points [bodyStart[i], bodyStart[i + 1]),
+        // and the same for springs and surfaces
+        int *bodyStart;
+        int *springStart;
+        int *surfaceStart;
+
+        // Packed per-point data
+        int numPoints;
+        int *pointBody;
+        Vector2 *shape;
+        float *pointInvMass; // Two per point (x and y), for the projection kernel
+
+        // Topology, re-indexed into the packed points.
+        // Springs are only kept for bodies that actually are SoftBodyType_Springs
+        int numSprings;
+        int *springA;
+        int *springB;
+        int *springBody;
+        float *lengths;
+        int numSurfaces;
+        int *surfaceA;
+        int *surfaceB;
+        int *surfaceBody;
+        // Built at PhysicsWorld_addBody for every body, used for wide ones
+        EdgeColoring springColors;
+        EdgeColoring surfaceColors;
+
+        // Shape clusters, re-indexed into the packed points. Body b's are
+        // clusters[bodyClusterStart[b], bodyClusterStart[b + 1]); bodies with
+        // none get matched as a whole into bodyFrame instead
+        int numClusters;
+        int *bodyClusterStart;
+        ShapeCluster *clusters;
+        int *clusterPoints;
+        ShapeFrame *clusterFrame;
+
+        // Per-body accumulators for the stages that need a whole-body sum first
+        float *bodyVolume;
+        ShapeFrame *bodyFrame;
+
+        Integrator integrator;
+        int substeps; // Only for Integrator_XPBD
+        // Verlet's forces from the end of the last step
+        Vector2 *lastForces;
+        bool lastForcesValid;
+        Integrator lastIntegrator;
+        // Integrator_Implicit's CG settings and state
+        int cgMaxIterations;
+        float cgTolerance; // Relative to the right hand side
+        int cgIterations;  // Most any chunk took in the last step
+        ImplicitSpring *implicitSprings;
+        ImplicitBody *implicitBodies;
+        Vector2 *lastDv; // Warm start
+        // Integrator_Adaptive's settings and state
+        float adaptiveTolerance; // Most error per step, in world units
+        int adaptiveMaxSteps;    // Per body per frame. It won't shrink the step below dt / this
+        float *bodyStep;         // Step size each body had settled on, where it starts next frame
+        int *bodySteps;          // Steps each body took in the last update, and how many it threw out
+        int *bodyRejected;
+        int adaptiveSteps; // bodySteps and bodyRejected summed over the awake bodies
+        int adaptiveRejected;
+
+        // Positions before the last step and the blend of them with the current
+        // ones, for drawing in between fixed steps
+        Vector2 *prevPos;
+        Vector2 *renderPos;
+
+        // Collision. The broadphase hands over the pairs of bodies whose
+        // bounds overlap, and only those go on to checkCollision.
+        // The pair arrays are those pairs as of the last collide_PhysicsWorld,
+        // in the broadphase's order (by pairB, then pairA, with pairA < pairB)
+        SoftBodyMaterial *bodyMaterial; // Defaults to SoftBodyMaterial_DEFAULT, set it straight after adding
+        Broadphase broadphase; // Sweep and prune unless PhysicsWorld_setBroadphase says otherwise
+        int numPairs;
+        int maxPairs; // Room in both sets of pair arrays
+        int *pairA;
+        int *pairB;
+        CollisionData *pairCollisions;
+        // The other set, the next collide fills these from the broadphase
+        // (carrying over the asleep pairs' results) and then swaps them in
+        int *sparePairA;
+        int *sparePairB;
+        CollisionData *sparePairCollisions;
+        // Every pair's contacts from the last collide, at its firstContact.
+        // Each pair gets room for all its points up front, so the pairs can
+        // be checked all at once without running into each other. Pairs
+        // carried over asleep have theirs copied across
+        int numContacts; // Room handed out, not contacts found
+        int maxContacts; // Room in both sets
+        Contact *contacts;
+        // The collide before's, which the next one swaps with contacts. A pair
+        // that was there last time rechecks from its old contacts in here
+        // (see recheckCollision) and the solver starts from their impulses.
+        // Turn warmStarting off to check every pair from scratch instead
+        Contact *spareContacts;
+        bool warmStarting;
+        int numWarmContacts; // Of the last collide's, how many kept their impulses
+        // All of them go through solveContacts together, this many rounds
+        // (CONTACT_ITERATIONS to start with). Fewer is cheaper, more lets
+        // piles and stacks push back on what's on top of them properly
+        int contactIterations;
+        ContactOrder contactOrder;
+        ContactManifold *manifolds; // Scratch for it, maxPairs of them
+        // Scratch for ContactOrder_Colored. Colors are greedy, each manifold
+        // in pair order taking the lowest color neither body has yet, and
+        // only the first CONTACT_COLORS of them go in parallel. A body in
+        // more manifolds than that (a floor under a big pile) has the rest
+        // solved one after another once the colors are done
+        int *manifoldColor;
+        ContactManifold *coloredManifolds; // By color, pair order inside each
+        unsigned long long *bodyColors;    // Per body, the colors it's been given
+        int colorStart[CONTACT_COLORS + 2]; // Color c is coloredManifolds[colorStart[c], colorStart[c + 1])
+        int numContactColors;              // In the last collide, not counting the leftovers
+        int numSolvedContacts;      // In the last collide's solve
+        double narrowphaseTime;     // Seconds the last collide spent checking the pairs
+        double solverTime;          // Seconds that solve took
+        double broadphaseTime; // Seconds the last collide spent in the broadphase
+        int *queryIds;         // Scratch for PhysicsWorld_queryBox
+
+        // Continuous collision. checkCollision only sees where things end up,
+        // so a body that moves more than about half as far as what it hits is
+        // thick in one step can get pushed out the far side, or go straight
+        // through. Pairs moving that fast relative to each other get swept
+        // with timeOfImpact from where their points were at the start of the
+        // step, and if they hit, both bodies go back to that moment (everything
+        // in between on straight lines) and their contacts get solved there.
+        // The rest of their step is lost, so it's only done for the pairs
+        // that need it: the two moving more than ccdFraction of the thinner
+        // one's bounds between them. 0 turns it off
+        float ccdFraction;
+        Vector2 *sweepFrom;      // Every point as the last update started
+        SweptBody *sweptBodies;  // Scratch, per body
+        int maxSweepPairs;       // Grows like the broadphase's pairs
+        BodyPair *sweepPairs;    // Scratch, in the broadphase's order
+        int maxBodyPoints;       // The most points of any body, sweep scratch is room for two
+        PointHit *sweepHits;
+        Contact *sweepContacts;
+        int numSweptPairs;       // In the last collide
+        int numImpacts;          // Of those, how many hit and went back
+        double sweepTime;        // Seconds the last collide spent sweeping
+
+        // Self-collision. Pairs never check a body against itself, so a long
+        // floppy one can fold straight through itself. Bodies with
+        // bodySelfCollide set (off to start with, set it straight after
+        // adding) go through findSelfContacts after the pairs are solved,
+        // one after another in body order, and what it finds gets solved the
+        // same way as a pair's. Only catches points going in this step, from
+        // sweepFrom, so it's there whatever ccdFraction is
+        bool *bodySelfCollide;
+        SelfHash selfHash;       // Shared by all of them, room for the biggest as it's added
+        int numSelfContacts;     // In the last collide
+        double selfTime;         // Seconds the last collide spent on it
+
+        // Sleeping. A body whose kinetic energy per point stays under
+        // sleepEnergy for sleepFrames steps in a row is still. Bodies touching
+        // each other form an island, and an island only goes to sleep once
+        // every body in it is still, and wakes up all at once as soon as one
+        // of them isn't (or something awake hits it). Asleep bodies have their
+        // velocities zeroed and skip integration, bounds and narrowphase
+        // against other asleep bodies entirely.
+        // Poking a body from outside (applyImpulse, moving it...) doesn't wake
+        // it, use PhysicsWorld_wakeBody for that
+        bool allowSleep;
+        float sleepEnergy;
+        int sleepFrames;
+        bool *bodyAsleep;
+        int *bodyStillFrames;
+        int *bodyIsland; // Root body of its island, as of the last step
+        int numIslands;
+        int *islandStill; // Scratch for updateSleep_PhysicsWorld
+        // Counted at the start of every update_PhysicsWorld, so it's what
+        // actually got stepped
+        int numAwakeBodies;
+        int numAwakePoints;
+
+        // Threading. With jobs NULL everything runs on the calling thread.
+        // Integration is split into chunks of whole bodies; in deterministic
+        // mode chunks are cut every chunkPoints points, so they (and so the
+        // results, since the implicit solve is per chunk) don't depend on the
+        // thread count. Otherwise it's a few chunks per thread.
+        // Deterministic mode is what lockstep and rollback need: every float
+        // op happens in the same order every run, whatever the thread count
+        // or SIMD level, and the trig goes through core.h's portable
+        // versions. Built with the Makefile's flags (no contraction into
+        // FMAs, no fast-math), the same inputs then give bit-identical
+        // results across runs, machines and builds. hash_PhysicsWorld is
+        // for checking that they did
+        JobSystem *jobs;
+        bool deterministic;
+        int chunkPoints;
+        // Bodies this big get a chunk of their own and are split up inside
+        // instead, see WorldRange.wide
+        int splitPoints;
+        int numChunks;
+        int numWideChunks; // The last numWideChunks of chunks
+        WorldRange *chunks;
+        int *chunkCgIterations;
+
+        // Scratch for the integrator stages, sized from the packed point count.
+        // stage is this step's WORLD_SCRATCH_BLOCKS * numPoints block of it
+        SimArena scratch;
+        Vector2 *stage;
+        float stageDt;
+        // Heap allocations made during the last update_PhysicsWorld,
+        // should be 0 once everything's been added
+        int stepAllocs;
+} PhysicsWorld;
+
+PhysicsWorld createPhysicsWorld(WorldValues values, int maxBodies);
+void freePhysicsWorld(PhysicsWorld *world);
+
+// Swaps the broadphase for a different type. Only before any bodies are added,
+// so straight after createPhysicsWorld. cellSize is for Broadphase_SpatialHash
+void PhysicsWorld_setBroadphase(PhysicsWorld *world, BroadphaseType type, float cellSize);
+
+// Returns the body's id in the world
+int PhysicsWorld_addBody(PhysicsWorld *world, SoftBody *sb);
+
+// Integrates every body
+void update_PhysicsWorld(PhysicsWorld *world, float dt);
+// Finds and handles collisions between every pair of bodies whose bounds
+// overlap, after sweeping the pairs that moved too fast for that (see
+// ccdFraction), then every bodySelfCollide body against itself. Detection
+// runs in parallel, handling runs in pair order on the calling thread
+void collide_PhysicsWorld(PhysicsWorld *world, float dt);
+// Groups the bodies into islands by the last collide_PhysicsWorld's contacts,
+// then puts still islands to sleep and wakes ones with anything moving in them
+void updateSleep_PhysicsWorld(PhysicsWorld *world);
+// Wakes the body and everything in its island
+void PhysicsWorld_wakeBody(PhysicsWorld *world, int id);
+// update, collide, then updateSleep, each phase finishing before the next starts
+void step_PhysicsWorld(PhysicsWorld *world, float dt);
+
+// Gameplay queries, against the bodies' bounds as of the last step (or as
+// restored). With Broadphase_AABBTree they go through the tree, otherwise
+// they check every body.
+// Finds every body whose bounds overlap box, writes the lowest maxIds ids of
+// them into ids in order, and returns how many there were in all
+int PhysicsWorld_queryBox(PhysicsWorld *world, BB box, int *ids, int maxIds);
+// The first surface of any body that the segment from -> to crosses, ties
+// going to the lowest body id. Returns false if it didn't hit anything
+bool PhysicsWorld_raycast(PhysicsWorld *world, Vector2 from, Vector2 to, RaycastHit *hit);
+
+// A hash of every body's positions and velocities, bit for bit. Compare it
+// between peers (or against a replay) every frame to catch a desync the
+// moment it happens
+unsigned long long hash_PhysicsWorld(PhysicsWorld *world);
+
+// Call right before each fixed step, so there's a previous state to interpolate from
+void PhysicsWorld_storePrevious(PhysicsWorld *world);
+// A copy of the body with pointPos swapped for positions blended alpha of
+// the way from the previous step to the current one, so it can go straight
+// into renderSoftbody. Only valid until the next call for the same body
+SoftBody PhysicsWorld_interpolate(PhysicsWorld *world, int id, float alpha);
+
+WorldRange PhysicsWorld_range(PhysicsWorld *world, int bodyBegin, int bodyEnd);
+
+// Most n-sized blocks any integrator carves out of the scratch arena (Adaptive)
+#define WORLD_SCRATCH_BLOCKS 18
+
+// Copies the range's bodies' state and parameters into/out of the packed arrays
+void gather_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points);
+void scatter_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points);
+
+// The batched counterparts to calcForces and projectSB, over the packed points.
+// points are the whole packed arrays, only the range's part gets touched.
+// calcForces_PhysicsWorld runs each body's own force kernel, except for wide
+// bodies, which go through the separate passes below so they can be split up
+void calcForces_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+// Only gravity, pressure and drag, the forces XPBD doesn't make into constraints
+void calcForce_external_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+void calcForce_springs_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+void calcForce_shape_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+// Pressure and drag in one pass over the surfaces, like the force kernels do
+void calcForce_surfaces_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+void calcForce_gravity_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points);
+void projectSB_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints *dest, SBPoints src, Vector2 *forces, float dt);
+// Fills bodyFrame (or clusterFrame) for every shape matched body in the range
+void calcShapes_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points);
+
+// The integrators themselves, see integrators.c
+// These gather, step and scatter their range, using world->stage for
+// scratch, but leave shape/bounds to update_PhysicsWorld
+void integrate_RK4(PhysicsWorld *world, WorldRange r, float dt);
+void integrate_SymplecticEuler(PhysicsWorld *world, WorldRange r, float dt);
+void integrate_Verlet(PhysicsWorld *world, WorldRange r, float dt);
+void integrate_XPBD(PhysicsWorld *world, WorldRange r, float dt);
+// Fills bodyStep, bodySteps and bodyRejected for the range's bodies
+void integrate_Adaptive(PhysicsWorld *world, WorldRange r, float dt);
+// Returns how many CG iterations it took
+int integrate_Implicit(PhysicsWorld *world, WorldRange r, float dt);
+
+#endif
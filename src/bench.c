@@ -0,0 +1,1018 @@
+#include "bench.h"
+#include <core/layout.h>
+#include <core/snapshot.h>
+#include <core/world.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_BODIES 64
+#define BENCH_STEPS 600
+#define BENCH_DT (1.f / 60.f)
+
+typedef enum BenchPreset {
+        BenchPreset_RectTruss,
+        BenchPreset_Circle,
+} BenchPreset;
+
+static const char *presetNames[] = {
+    [BenchPreset_RectTruss] = "rect truss",
+    [BenchPreset_Circle] = "circle",
+};
+
+static const char *integratorNames[] = {
+    [Integrator_RK4] = "RK4",
+    [Integrator_SymplecticEuler] = "symplectic Euler",
+    [Integrator_Verlet] = "Verlet",
+    [Integrator_XPBD] = "XPBD",
+    [Integrator_Implicit] = "implicit Euler",
+    [Integrator_Adaptive] = "adaptive RK45",
+};
+
+// No drag or damping, so any change in energy is the integrator's fault
+static SoftBody makeBenchBody(BenchPreset preset, Vector2 center, float squash) {
+        SoftBody sb = createEmptySoftBody(
+            (SoftBodyType_Springs) | (SoftBodyType_Pressure) | (SoftBodyType_Shape),
+            1.0f, 0.0f, 100.f, 0.f, 10.f, 25.f);
+        if (preset == BenchPreset_RectTruss)
+                rectSoftbody(&sb, center, (Vector2){5.0, 3.0}, 5, 3, true);
+        else
+                circleSoftbody(&sb, center, 2.f, 15);
+        // Squash it so there's something to oscillate
+        for (int i = 0; i < sb.numPoints; i++) {
+                sb.pointPos[i].x = center.x + (sb.pointPos[i].x - center.x) * squash;
+        }
+        return sb;
+}
+
+// Kinetic energy plus the potential of every force that has one
+static double bodyEnergy(SoftBody *sb) {
+        double E = 0.0;
+        for (int i = 0; i < sb->numPoints; i++) {
+                E += 0.5 * sb->mass * Vector2LengthSqr(sb->pointVel[i]);
+        }
+        if (sb->type & SoftBodyType_Springs) {
+                for (int i = 0; i < sb->numSprings; i++) {
+                        float x = Vector2Distance(sb->pointPos[sb->springA[i]], sb->pointPos[sb->springB[i]]) - sb->lengths[i];
+                        E += 0.5 * sb->springStrength * x * x;
+                }
+        }
+        if (sb->type & SoftBodyType_Shape) {
+                SBPos pos = calcShape(*sb, (SBPoints){.num = sb->numPoints, .pos = sb->pointPos, .vel = sb->pointVel});
+                for (int i = 0; i < sb->numPoints; i++) {
+                        Vector2 goal = Vector2Add(Vector2Rotate(sb->shape[i], pos.rotation), pos.position);
+                        E += 0.5 * sb->shapeSpringStrength * Vector2DistanceSqr(goal, sb->pointPos[i]);
+                }
+        }
+        if (sb->type & SoftBodyType_Pressure) {
+                // P = nRT / V, so the gas's potential is -nRT ln V
+                float V = 0.f;
+                for (int i = 0; i < sb->numSurfaces; i++) {
+                        Vector2 a = sb->pointPos[sb->surfaceA[i]];
+                        Vector2 b = sb->pointPos[sb->surfaceB[i]];
+                        V += a.x * b.y - a.y * b.x;
+                }
+                E -= sb->nRT * log(V * 0.5f);
+        }
+        return E;
+}
+
+void bench_integrators(void) {
+        printf("Integrators: %d bodies, %d steps of %.4fs\n", BENCH_BODIES, BENCH_STEPS, BENCH_DT);
+        // Drift is relative to the energy the squash put in, since the gas
+        // potential has no natural zero. Negative means it lost energy
+        printf("%-12s %-18s %12s %12s %12s\n", "preset", "integrator", "steps/sec", "final drift", "max |drift|");
+
+        static SoftBody bodies[BENCH_BODIES];
+        for (BenchPreset preset = BenchPreset_RectTruss; preset <= BenchPreset_Circle; preset++) {
+                for (Integrator integrator = Integrator_RK4; integrator <= Integrator_Adaptive; integrator++) {
+                        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+                        PhysicsWorld world = createPhysicsWorld(worldValues, BENCH_BODIES);
+                        world.integrator = integrator;
+                        for (int b = 0; b < BENCH_BODIES; b++) {
+                                bodies[b] = makeBenchBody(preset, (Vector2){(b % 8) * 10.f, (b / 8) * 10.f}, 1.3f);
+                                PhysicsWorld_addBody(&world, &bodies[b]);
+                        }
+
+                        SoftBody rest = makeBenchBody(preset, (Vector2){0, 0}, 1.f);
+                        double E_rest = bodyEnergy(&rest) * BENCH_BODIES;
+                        freeSoftbody(&rest);
+                        double E0 = 0.0;
+                        for (int b = 0; b < BENCH_BODIES; b++) {
+                                E0 += bodyEnergy(&bodies[b]);
+                        }
+
+                        double maxDrift = 0.0;
+                        double drift = 0.0;
+                        double simTime = 0.0;
+                        for (int step = 0; step < BENCH_STEPS; step++) {
+                                double start = GetTime();
+                                update_PhysicsWorld(&world, BENCH_DT);
+                                simTime += GetTime() - start;
+
+                                double E = 0.0;
+                                for (int b = 0; b < BENCH_BODIES; b++) {
+                                        E += bodyEnergy(&bodies[b]);
+                                }
+                                drift = (E - E0) / (E0 - E_rest);
+                                if (!(fabs(drift) <= maxDrift)) // Also catches NaN from a blown up body
+                                        maxDrift = fabs(drift);
+                        }
+
+                        printf("%-12s %-18s %12.0f %+11.1f%% %11.1f%%\n",
+                               presetNames[preset], integratorNames[integrator],
+                               BENCH_STEPS / simTime, drift * 100.0, maxDrift * 100.0);
+
+                        freePhysicsWorld(&world);
+                        for (int b = 0; b < BENCH_BODIES; b++) {
+                                freeSoftbody(&bodies[b]);
+                        }
+                }
+        }
+}
+
+#define ADAPTIVE_SUBSTEPS 8
+
+// Time per frame and steps per body per frame, for BENCH_STEPS frames
+static void adaptiveRun(Integrator integrator, float squash, double *frameMs, double *bodySteps) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, BENCH_BODIES);
+        world.integrator = integrator;
+        static SoftBody bodies[BENCH_BODIES];
+        for (int b = 0; b < BENCH_BODIES; b++) {
+                bodies[b] = makeBenchBody(BenchPreset_RectTruss, (Vector2){(b % 8) * 10.f, (b / 8) * 10.f}, squash);
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+
+        long steps = 0;
+        double start = GetTime();
+        for (int frame = 0; frame < BENCH_STEPS; frame++) {
+                if (integrator == Integrator_Adaptive) {
+                        update_PhysicsWorld(&world, BENCH_DT);
+                        steps += world.adaptiveSteps;
+                } else {
+                        for (int s = 0; s < ADAPTIVE_SUBSTEPS; s++) {
+                                update_PhysicsWorld(&world, BENCH_DT / ADAPTIVE_SUBSTEPS);
+                        }
+                        steps += ADAPTIVE_SUBSTEPS * BENCH_BODIES;
+                }
+        }
+        *frameMs = (GetTime() - start) * 1000.0 / BENCH_STEPS;
+        *bodySteps = (double)steps / BENCH_STEPS / BENCH_BODIES;
+
+        freePhysicsWorld(&world);
+        for (int b = 0; b < BENCH_BODIES; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+}
+
+void bench_adaptive(void) {
+        printf("Adaptive: %d rect trusses, RK4 at %d substeps a frame vs adaptive RK45\n", BENCH_BODIES, ADAPTIVE_SUBSTEPS);
+        printf("%-12s %-18s %12s %12s\n", "scene", "integrator", "ms/frame", "steps/body");
+        const char *scenes[] = {"calm", "violent"};
+        float squash[] = {1.02f, 4.f};
+        for (int scene = 0; scene < 2; scene++) {
+                double ms, steps;
+                adaptiveRun(Integrator_RK4, squash[scene], &ms, &steps);
+                printf("%-12s %-18s %12.3f %12.2f\n", scenes[scene], integratorNames[Integrator_RK4], ms, steps);
+                adaptiveRun(Integrator_Adaptive, squash[scene], &ms, &steps);
+                printf("%-12s %-18s %12.3f %12.2f\n", scenes[scene], integratorNames[Integrator_Adaptive], ms, steps);
+        }
+}
+
+#define ROLLBACK_FRAMES 8
+#define ROLLBACK_REPEATS 50
+#define FRAME_BUDGET_MS 16.0
+
+void bench_rollback(void) {
+        // Piled up close enough to be colliding, so the contacts are part of it
+        WorldValues worldValues = {.gravity = {0, 9.8f}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, BENCH_BODIES);
+        static SoftBody bodies[BENCH_BODIES];
+        for (int b = 0; b < BENCH_BODIES; b++) {
+                bodies[b] = makeBenchBody(BenchPreset_RectTruss, (Vector2){(b % 8) * 5.5f, (b / 8) * 3.5f}, 1.1f);
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+        SnapshotRing ring = createSnapshotRing(&world, ROLLBACK_FRAMES + 1);
+
+        // What every frame hashed to the first time round, for checking the
+        // resimulations come out the same
+        unsigned long long hashes[ROLLBACK_FRAMES + 2];
+        int frame = 0;
+        for (; frame <= ROLLBACK_FRAMES; frame++) {
+                hashes[frame] = hash_PhysicsWorld(&world);
+                // Growing the ring is fine here, it's not rolling back yet
+                if (!save_SnapshotRing(&ring, &world, frame)) {
+                        reserve_SnapshotRing(&ring, world.maxPairs, world.maxContacts);
+                        save_SnapshotRing(&ring, &world, frame);
+                }
+                step_PhysicsWorld(&world, BENCH_DT);
+        }
+        hashes[frame] = hash_PhysicsWorld(&world);
+        // The last step might have grown the world's
+        reserve_SnapshotRing(&ring, world.maxPairs, world.maxContacts);
+
+        // A late input for ROLLBACK_FRAMES ago: back up, then step (and save)
+        // every frame since again. Nothing changes in between, so every frame
+        // should hash the same as it did the first time. The hashing isn't timed
+        double saveTime = 0.0;
+        double restoreTime = 0.0;
+        double resimTime = 0.0;
+        int diverged = 0; // Frames that hashed differently
+        int failedSaves = 0;
+        for (int rep = 0; rep < ROLLBACK_REPEATS; rep++) {
+                double start = GetTime();
+                failedSaves += !save_SnapshotRing(&ring, &world, frame);
+                saveTime += GetTime() - start;
+
+                start = GetTime();
+                restore_SnapshotRing(&ring, &world, frame - ROLLBACK_FRAMES);
+                restoreTime += GetTime() - start;
+
+                for (int f = frame - ROLLBACK_FRAMES; f < frame; f++) {
+                        diverged += hash_PhysicsWorld(&world) != hashes[f];
+                        start = GetTime();
+                        if (f > frame - ROLLBACK_FRAMES)
+                                failedSaves += !save_SnapshotRing(&ring, &world, f);
+                        step_PhysicsWorld(&world, BENCH_DT);
+                        resimTime += GetTime() - start;
+                }
+                diverged += hash_PhysicsWorld(&world) != hashes[frame];
+        }
+
+        double saveUs = saveTime * 1e6 / ROLLBACK_REPEATS;
+        double restoreUs = restoreTime * 1e6 / ROLLBACK_REPEATS;
+        double resimMs = resimTime * 1e3 / ROLLBACK_REPEATS;
+        double totalMs = resimMs + (saveUs + restoreUs) * 1e-3;
+        printf("Rollback: %d bodies, %d points, %d frames back\n", world.numBodies, world.numPoints, ROLLBACK_FRAMES);
+        printf("%-12s %10.1f us\n", "snapshot", saveUs);
+        printf("%-12s %10.1f us\n", "restore", restoreUs);
+        printf("%-12s %10.3f ms\n", "resimulate", resimMs);
+        printf("%-12s %10.3f ms (%.0f%% of the %.0f ms frame)\n", "total", totalMs, totalMs / FRAME_BUDGET_MS * 100.0, FRAME_BUDGET_MS);
+        if (diverged)
+                printf("Resimulating diverged on %d of %d frames!\n", diverged, ROLLBACK_REPEATS * (ROLLBACK_FRAMES + 1));
+        else
+                printf("Every resimulated frame matched the original\n");
+        if (failedSaves)
+                printf("The ring ran out of room on %d saves!\n", failedSaves);
+
+        freeSnapshotRing(&ring);
+        freePhysicsWorld(&world);
+        for (int b = 0; b < BENCH_BODIES; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+}
+
+#define LAYOUT_DETAIL 250
+#define LAYOUT_STEPS 20
+#define LAYOUT_REPEATS 3
+
+// Numbers sb's points in a random (but fixed) order, like a mesh loaded from
+// a file might come in. rectSoftbody's own numbering is already about as
+// tight as it gets, so this gives the layout pass something to do
+static void shufflePoints(SoftBody *sb) {
+        int n = sb->numPoints;
+        int *remap = MemAlloc(sizeof(int) * n);
+        for (int i = 0; i < n; i++) {
+                remap[i] = i;
+        }
+        unsigned int seed = 12345u;
+        for (int i = n - 1; i > 0; i--) {
+                seed = seed * 1664525u + 1013904223u;
+                int j = (seed >> 8) % (i + 1);
+                int tmp = remap[i];
+                remap[i] = remap[j];
+                remap[j] = tmp;
+        }
+
+        Vector2 *tmp = MemAlloc(sizeof(Vector2) * n);
+        Vector2 *arrays[] = {sb->pointPos, sb->pointVel, sb->shape};
+        for (int k = 0; k < 3; k++) {
+                for (int i = 0; i < n; i++) {
+                        tmp[remap[i]] = arrays[k][i];
+                }
+                memcpy(arrays[k], tmp, sizeof(Vector2) * n);
+        }
+        MemFree(tmp);
+        remapPointIndices(sb->springA, sb->numSprings, remap);
+        remapPointIndices(sb->springB, sb->numSprings, remap);
+        remapPointIndices(sb->surfaceA, sb->numSurfaces, remap);
+        remapPointIndices(sb->surfaceB, sb->numSurfaces, remap);
+        if (sb->numClusters > 0)
+                remapPointIndices(sb->clusterPoints, sb->clusters[sb->numClusters - 1].end, remap);
+        buildSurfaceTree_SoftBody(sb);
+        MemFree(remap);
+}
+
+typedef struct LayoutRun {
+        int bandwidth;
+        double stepsPerSec; // Best of LAYOUT_REPEATS, it's a noisy number
+} LayoutRun;
+
+static LayoutRun runLayout(bool shuffle, bool optimize) {
+        LayoutRun run = {0};
+        for (int repeat = 0; repeat < LAYOUT_REPEATS; repeat++) {
+                SoftBody sb = createEmptySoftBody((SoftBodyType_Springs) | (SoftBodyType_Pressure) | (SoftBodyType_Shape), 1.0f, 0.0f, 100.f, 0.f, 10.f, 25.f);
+                rectSoftbody(&sb, (Vector2){0, 0}, (Vector2){50.0, 50.0}, LAYOUT_DETAIL, LAYOUT_DETAIL, true);
+                if (shuffle)
+                        shufflePoints(&sb);
+                if (optimize)
+                        optimizeLayout_SoftBody(&sb, NULL);
+                run.bandwidth = bandwidth_SoftBody(&sb);
+
+                WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+                PhysicsWorld world = createPhysicsWorld(worldValues, 1);
+                // Plain in-order loops, the colored ones go by batch instead
+                world.splitPoints = sb.numPoints + 1;
+                PhysicsWorld_addBody(&world, &sb);
+                applyImpulse(&sb, (Vector2){1.f, 0.f});
+
+                double start = GetTime();
+                for (int step = 0; step < LAYOUT_STEPS; step++) {
+                        update_PhysicsWorld(&world, BENCH_DT);
+                }
+                double stepsPerSec = LAYOUT_STEPS / (GetTime() - start);
+                if (stepsPerSec > run.stepsPerSec)
+                        run.stepsPerSec = stepsPerSec;
+
+                freePhysicsWorld(&world);
+                freeSoftbody(&sb);
+        }
+        return run;
+}
+
+// The same truss numbered three ways: as rectSoftbody builds it, shuffled,
+// and shuffled then put through the layout pass. The pass should get the
+// shuffled one's bandwidth back down near the built one's, and its speed
+// with it
+void bench_layout(void) {
+        int points = (LAYOUT_DETAIL + 1) * (LAYOUT_DETAIL + 1);
+        printf("Layout: one %d point rect truss, RK4, %d steps, best of %d\n", points, LAYOUT_STEPS, LAYOUT_REPEATS);
+        printf("%-20s %10s %16s\n", "numbering", "bandwidth", "steps/sec");
+        LayoutRun built = runLayout(false, false);
+        LayoutRun shuffled = runLayout(true, false);
+        LayoutRun optimized = runLayout(true, true);
+        printf("%-20s %10d %16.1f\n", "as built", built.bandwidth, built.stepsPerSec);
+        printf("%-20s %10d %16.1f\n", "shuffled", shuffled.bandwidth, shuffled.stepsPerSec);
+        printf("%-20s %10d %16.1f (%.2fx shuffled)\n", "shuffled, optimized", optimized.bandwidth, optimized.stepsPerSec, optimized.stepsPerSec / shuffled.stepsPerSec);
+}
+
+#define BROADPHASE_BODIES 1024
+#define BROADPHASE_STEPS 120
+#define BROADPHASE_CELL 2.5f
+
+static const char *broadphaseNames[] = {
+    [Broadphase_SweepAndPrune] = "sweep and prune",
+    [Broadphase_SpatialHash] = "spatial hash",
+    [Broadphase_AABBTree] = "AABB tree",
+};
+
+// What every collide used to do before the broadphase: the bounds check
+// checkCollision starts with, for every pair
+static int allPairsOverlapping(PhysicsWorld *world) {
+        int overlapping = 0;
+        for (int b = 0; b < world->numBodies; b++) {
+                BB B = world->bodies[b]->bounds;
+                for (int a = 0; a < b; a++) {
+                        BB A = world->bodies[a]->bounds;
+                        if (!(A.max.x < B.min.x || A.max.y < B.min.y || A.min.x > B.max.x || A.min.y > B.max.y))
+                                overlapping++;
+                }
+        }
+        return overlapping;
+}
+
+typedef struct BroadphaseRun {
+        double pairs; // Per step, like the rest
+        double tested;
+        double us;
+        double allPairsUs;
+        int mismatches; // Steps where the all pairs check found a different number of pairs
+        unsigned long long hash;
+} BroadphaseRun;
+
+// Small circles drifting about, some of them running into each other.
+// `columns` of them across, so few columns bunches them up in x
+static BroadphaseRun runBroadphase(BroadphaseType type, int columns) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, BROADPHASE_BODIES);
+        PhysicsWorld_setBroadphase(&world, type, BROADPHASE_CELL);
+        world.integrator = Integrator_SymplecticEuler;
+        world.allowSleep = false;
+        SoftBody *bodies = MemAlloc(sizeof(SoftBody) * BROADPHASE_BODIES);
+        for (int b = 0; b < BROADPHASE_BODIES; b++) {
+                bodies[b] = createEmptySoftBody(SoftBodyType_Shape, 1.0f, 0.0f, 100.f, 0.f, 100.f, 0.f);
+                circleSoftbody(&bodies[b], (Vector2){(b % columns) * 2.5f, (b / columns) * 2.5f}, 1.f, 8);
+                applyImpulse(&bodies[b], (Vector2){((b * 7 % 11) - 5.f) * 0.2f, ((b * 5 % 13) - 6.f) * 0.2f});
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+
+        BroadphaseRun run = {0};
+        for (int step = 0; step < BROADPHASE_STEPS; step++) {
+                step_PhysicsWorld(&world, BENCH_DT);
+                run.us += world.broadphaseTime * 1e6;
+                run.pairs += world.numPairs;
+                run.tested += world.broadphase.numTested;
+
+                double start = GetTime();
+                int overlapping = allPairsOverlapping(&world);
+                run.allPairsUs += (GetTime() - start) * 1e6;
+                // Bounds are from the same point in the step both times
+                if (overlapping != world.numPairs)
+                        run.mismatches++;
+        }
+        run.pairs /= BROADPHASE_STEPS;
+        run.tested /= BROADPHASE_STEPS;
+        run.us /= BROADPHASE_STEPS;
+        run.allPairsUs /= BROADPHASE_STEPS;
+        run.hash = hash_PhysicsWorld(&world);
+
+        freePhysicsWorld(&world);
+        for (int b = 0; b < BROADPHASE_BODIES; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+        MemFree(bodies);
+        return run;
+}
+
+void bench_broadphase(void) {
+        printf("Broadphase: %d small circles, %d steps, %.1f cells for the hash\n", BROADPHASE_BODIES, BROADPHASE_STEPS, BROADPHASE_CELL);
+        printf("%-10s %-16s %12s %12s %12s\n", "scene", "broadphase", "pairs/step", "tests/step", "us/step");
+        const char *scenes[] = {"grid", "column"};
+        const int sceneColumns[] = {32, 4};
+        for (int scene = 0; scene < 2; scene++) {
+                BroadphaseRun runs[3];
+                for (int type = Broadphase_SweepAndPrune; type <= Broadphase_AABBTree; type++) {
+                        runs[type] = runBroadphase(type, sceneColumns[scene]);
+                }
+                printf("%-10s %-16s %12.1f %12d %12.1f\n", scenes[scene], "all pairs", runs[0].pairs, BROADPHASE_BODIES * (BROADPHASE_BODIES - 1) / 2,
+                       runs[0].allPairsUs);
+                for (int type = Broadphase_SweepAndPrune; type <= Broadphase_AABBTree; type++) {
+                        BroadphaseRun run = runs[type];
+                        printf("%-10s %-16s %12.1f %12.1f %12.1f\n", scenes[scene], broadphaseNames[type], run.pairs, run.tested, run.us);
+                        if (run.mismatches)
+                                printf("Missed pairs on %d steps!\n", run.mismatches);
+                }
+                // Same pairs in the same order, so the same simulation
+                if (runs[0].hash != runs[1].hash || runs[0].hash != runs[2].hash)
+                        printf("The broadphases' simulations came out different!\n");
+        }
+}
+
+#define QUERY_COUNT 10000
+
+void bench_queries(void) {
+        // The grid from bench_broadphase, a second in
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld worlds[2];
+        SoftBody *bodies[2];
+        for (int w = 0; w < 2; w++) {
+                worlds[w] = createPhysicsWorld(worldValues, BROADPHASE_BODIES);
+                PhysicsWorld_setBroadphase(&worlds[w], w == 0 ? Broadphase_SweepAndPrune : Broadphase_AABBTree, 0.f);
+                worlds[w].integrator = Integrator_SymplecticEuler;
+                bodies[w] = MemAlloc(sizeof(SoftBody) * BROADPHASE_BODIES);
+                for (int b = 0; b < BROADPHASE_BODIES; b++) {
+                        bodies[w][b] = createEmptySoftBody(SoftBodyType_Shape, 1.0f, 0.0f, 100.f, 0.f, 100.f, 0.f);
+                        circleSoftbody(&bodies[w][b], (Vector2){(b % 32) * 2.5f, (b / 32) * 2.5f}, 1.f, 8);
+                        applyImpulse(&bodies[w][b], (Vector2){((b * 7 % 11) - 5.f) * 0.2f, ((b * 5 % 13) - 6.f) * 0.2f});
+                        PhysicsWorld_addBody(&worlds[w], &bodies[w][b]);
+                }
+                for (int step = 0; step < 60; step++) {
+                        step_PhysicsWorld(&worlds[w], BENCH_DT);
+                }
+        }
+
+        // Hitbox sized boxes and screen sized rays all over, the same for both
+        static int ids[BROADPHASE_BODIES];
+        double boxUs[2], rayUs[2];
+        long long found[2] = {0, 0};
+        int hits[2] = {0, 0};
+        for (int w = 0; w < 2; w++) {
+                double start = GetTime();
+                for (int q = 0; q < QUERY_COUNT; q++) {
+                        float x = (q * 37 % 800) * 0.1f;
+                        float y = (q * 53 % 800) * 0.1f;
+                        found[w] += PhysicsWorld_queryBox(&worlds[w], (BB){{x, y}, {x + 3.f, y + 3.f}}, ids, BROADPHASE_BODIES);
+                }
+                boxUs[w] = (GetTime() - start) * 1e6 / QUERY_COUNT;
+
+                start = GetTime();
+                for (int q = 0; q < QUERY_COUNT; q++) {
+                        float x = (q * 37 % 800) * 0.1f;
+                        float y = (q * 53 % 800) * 0.1f;
+                        Vector2 dir = {cosf(q * 0.1f), sinf(q * 0.1f)};
+                        RaycastHit hit;
+                        hits[w] += PhysicsWorld_raycast(&worlds[w], (Vector2){x, y}, Vector2Add((Vector2){x, y}, Vector2Scale(dir, 30.f)), &hit);
+                }
+                rayUs[w] = (GetTime() - start) * 1e6 / QUERY_COUNT;
+        }
+
+        printf("Queries: %d bodies, %d boxes and %d rays\n", BROADPHASE_BODIES, QUERY_COUNT, QUERY_COUNT);
+        printf("%-16s %12s %12s\n", "", "box us", "ray us");
+        printf("%-16s %12.2f %12.2f\n", "every body", boxUs[0], rayUs[0]);
+        printf("%-16s %12.2f %12.2f\n", "AABB tree", boxUs[1], rayUs[1]);
+        if (found[0] != found[1] || hits[0] != hits[1])
+                printf("The tree found different things!\n");
+
+        for (int w = 0; w < 2; w++) {
+                freePhysicsWorld(&worlds[w]);
+                for (int b = 0; b < BROADPHASE_BODIES; b++) {
+                        freeSoftbody(&bodies[w][b]);
+                }
+                MemFree(bodies[w]);
+        }
+}
+
+#define NARROW_POINTS 200
+#define NARROW_PAIRS 2000
+
+// What checkCollision would do without the surface trees: every point of A
+// against every surface of B, then every surface again for the nearest.
+// Adds A's points inside B to contacts from num on, returns the new count
+static int scanContacts(SoftBody *A, SoftBody *B, bool invert, Contact *contacts, int num) {
+        for (int i = 0; i < A->numPoints; i++) {
+                Vector2 point = A->pointPos[i];
+                // The same cull as checkCollision. It's cheap, and without it
+                // points off to the left at exactly one of B's points' y get
+                // counted as inside
+                BB box = B->bounds;
+                if (point.x < box.min.x || point.x > box.max.x || point.y < box.min.y || point.y > box.max.y)
+                        continue;
+                int intersects = 0;
+                for (int surf = 0; surf < B->numSurfaces; surf++) {
+                        Vector2 p1 = B->pointPos[B->surfaceA[surf]];
+                        Vector2 p2 = B->pointPos[B->surfaceB[surf]];
+                        if (point.y < fminf(p1.y, p2.y) || point.y > fmaxf(p1.y, p2.y))
+                                continue;
+                        float dy = p2.y - p1.y;
+                        if (((point.x - p1.x) * dy - (p2.x - p1.x) * (point.y - p1.y)) * dy > 0)
+                                continue;
+                        intersects++;
+                }
+                if (!(intersects % 2))
+                        continue;
+
+                Contact c = {.invert = invert, .point = i, .edge = -1, .depth = INFINITY};
+                for (int surf = 0; surf < B->numSurfaces; surf++) {
+                        Vector2 p1 = B->pointPos[B->surfaceA[surf]];
+                        Vector2 diff = Vector2Subtract(B->pointPos[B->surfaceB[surf]], p1);
+                        float l2 = Vector2LengthSqr(diff);
+                        if (l2 == 0.0)
+                                continue;
+                        float t = Vector2DotProduct(Vector2Subtract(point, p1), diff) / l2;
+                        if (t < 0.f || t > 1.f)
+                                continue;
+                        Vector2 projection = Vector2Add(p1, Vector2Scale(diff, t));
+                        float dist = Vector2Distance(point, projection);
+                        if (dist < c.depth) {
+                                c.edge = surf;
+                                c.depth = dist;
+                        }
+                }
+                if (c.edge >= 0)
+                        contacts[num++] = c;
+        }
+        return num;
+}
+
+void bench_narrowphase(void) {
+        // Two big blobs, one going round the other at about touching
+        // distance, some overlapping and some just missing
+        SoftBody A = createEmptySoftBody(SoftBodyType_Pressure, 1.0f, 0.0f, 100.f, 0.f, 0.f, 1.f);
+        SoftBody B = createEmptySoftBody(SoftBodyType_Pressure, 1.0f, 0.0f, 100.f, 0.f, 0.f, 1.f);
+        circleSoftbody(&A, (Vector2){0.f, 0.f}, 5.f, NARROW_POINTS);
+        circleSoftbody(&B, (Vector2){0.f, 0.f}, 5.f, NARROW_POINTS);
+        updateBounds_SoftBody(&A);
+        Vector2 *rest = MemAlloc(sizeof(Vector2) * NARROW_POINTS);
+        Vector2 *restA = MemAlloc(sizeof(Vector2) * NARROW_POINTS);
+        for (int i = 0; i < NARROW_POINTS; i++) {
+                rest[i] = B.pointPos[i];
+                restA[i] = A.pointPos[i];
+        }
+
+        Contact *treeContacts = MemAlloc(sizeof(Contact) * 2 * NARROW_POINTS);
+        Contact *scanned = MemAlloc(sizeof(Contact) * 2 * NARROW_POINTS);
+        ContactPush *pushes = MemAlloc(sizeof(ContactPush) * 2 * NARROW_POINTS);
+        double treeUs = 0.0, scanUs = 0.0, resolvedUs = 0.0;
+        int collided = 0, contacts = 0, mismatches = 0, leftOver = 0;
+        for (int p = 0; p < NARROW_PAIRS; p++) {
+                float angle = p * 0.37f;
+                float distance = 9.5f + (p % 7) * 0.1f;
+                Vector2 offset = {cosf(angle) * distance, sinf(angle) * distance};
+                for (int i = 0; i < NARROW_POINTS; i++) {
+                        B.pointPos[i] = Vector2Add(rest[i], offset);
+                        B.pointVel[i] = Vector2Zero();
+                }
+                updateBounds_SoftBody(&B);
+                for (int i = 0; i < NARROW_POINTS; i++) {
+                        A.pointPos[i] = restA[i];
+                        A.pointVel[i] = Vector2Zero();
+                }
+                updateBounds_SoftBody(&A);
+
+                double start = GetTime();
+                CollisionData tree = checkCollision(A, B, treeContacts, 2 * NARROW_POINTS);
+                treeUs += (GetTime() - start) * 1e6;
+                start = GetTime();
+                int numScan = scanContacts(&A, &B, false, scanned, 0);
+                numScan = scanContacts(&B, &A, true, scanned, numScan);
+                scanUs += (GetTime() - start) * 1e6;
+
+                collided += tree.collided;
+                contacts += tree.numContacts;
+                bool same = tree.numContacts == numScan;
+                for (int c = 0; same && c < numScan; c++) {
+                        same = treeContacts[c].point == scanned[c].point && treeContacts[c].edge == scanned[c].edge;
+                }
+                if (!same)
+                        mismatches++;
+
+                // Off the one detection above, should leave nothing inside
+                // anything. Checking again is just for the count
+                start = GetTime();
+                handleCollision(&A, &B, treeContacts, tree.numContacts, SoftBodyMaterial_DEFAULT, SoftBodyMaterial_DEFAULT, pushes);
+                resolvedUs += (GetTime() - start) * 1e6;
+                leftOver += checkCollision(A, B, treeContacts, 2 * NARROW_POINTS).numContacts;
+        }
+
+        printf("Narrowphase: two %d point blobs, %d placements, %d touching with %.1f contacts each\n", NARROW_POINTS, NARROW_PAIRS, collided,
+               collided ? (double)contacts / collided : 0.0);
+        printf("%-16s %12s\n", "", "us/pair");
+        printf("%-16s %12.2f\n", "every surface", scanUs / NARROW_PAIRS);
+        printf("%-16s %12.2f\n", "surface tree", treeUs / NARROW_PAIRS);
+        printf("%-16s %12.2f\n", "resolving", resolvedUs / NARROW_PAIRS);
+        printf("Contacts left after one detection and handleCollision: %.2f per pair\n", collided ? (double)leftOver / collided : 0.0);
+        if (mismatches)
+                printf("The tree found different contacts on %d placements!\n", mismatches);
+
+        MemFree(treeContacts);
+        MemFree(scanned);
+        MemFree(pushes);
+        MemFree(restA);
+        MemFree(rest);
+        freeSoftbody(&A);
+        freeSoftbody(&B);
+}
+
+#define PILE_BODIES 64
+#define PILE_STEPS 240
+
+typedef struct PileRun {
+        double narrowUs; // Per step, like the rest
+        double solverUs;
+        double contacts;
+        double warm; // Share of the contacts that kept last step's impulses
+        double depth;    // Deepest contact's, averaged over the touching pairs
+        double approach; // How fast contacts were still moving into each other after solving, on average
+} PileRun;
+
+// The speed the point's still heading into its edge at, 0 if it isn't
+static float approachSpeed(SoftBody *A, SoftBody *B, Contact c) {
+        if (c.invert) {
+                SoftBody *swap = A;
+                A = B;
+                B = swap;
+        }
+        Vector2 edgeVel = Vector2Lerp(B->pointVel[B->surfaceA[c.edge]], B->pointVel[B->surfaceB[c.edge]], c.edge_t);
+        float vn = Vector2DotProduct(Vector2Subtract(A->pointVel[c.point], edgeVel), c.normal);
+        return vn < 0.f ? -vn : 0.f;
+}
+
+// Blobs all pushed in towards the middle, so they end up in a squashed pile
+// with lots of contacts pushing back on each other
+static PileRun runPile(int iterations, bool warmStarting) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, PILE_BODIES);
+        world.integrator = Integrator_SymplecticEuler;
+        world.contactIterations = iterations;
+        world.warmStarting = warmStarting;
+        world.allowSleep = false;
+        SoftBody *bodies = MemAlloc(sizeof(SoftBody) * PILE_BODIES);
+        for (int b = 0; b < PILE_BODIES; b++) {
+                Vector2 center = {(b % 8) * 2.5f - 8.75f, (b / 8) * 2.5f - 8.75f};
+                bodies[b] = createEmptySoftBody(SoftBodyType_Shape | SoftBodyType_Springs, 1.0f, 0.0f, 100.f, 1.f, 100.f, 0.f);
+                circleSoftbody(&bodies[b], center, 1.f, 16);
+                applyImpulse(&bodies[b], Vector2Scale(center, -0.5f));
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+
+        PileRun run = {0};
+        int touching = 0;
+        long long contacts = 0;
+        for (int step = 0; step < PILE_STEPS; step++) {
+                step_PhysicsWorld(&world, BENCH_DT);
+                run.narrowUs += world.narrowphaseTime * 1e6;
+                run.solverUs += world.solverTime * 1e6;
+                run.contacts += world.numSolvedContacts;
+                run.warm += world.numWarmContacts;
+                for (int p = 0; p < world.numPairs; p++) {
+                        if (!world.pairCollisions[p].collided)
+                                continue;
+                        CollisionData data = world.pairCollisions[p];
+                        run.depth += data.depth;
+                        touching++;
+                        for (int c = 0; c < data.numContacts; c++) {
+                                run.approach += approachSpeed(world.bodies[world.pairA[p]], world.bodies[world.pairB[p]], world.contacts[data.firstContact + c]);
+                                contacts++;
+                        }
+                }
+        }
+        run.narrowUs /= PILE_STEPS;
+        run.solverUs /= PILE_STEPS;
+        run.warm = run.contacts > 0.0 ? run.warm / run.contacts : 0.0;
+        run.contacts /= PILE_STEPS;
+        run.depth = touching ? run.depth / touching : 0.0;
+        run.approach = contacts ? run.approach / contacts : 0.0;
+
+        freePhysicsWorld(&world);
+        for (int b = 0; b < PILE_BODIES; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+        MemFree(bodies);
+        return run;
+}
+
+// Each iteration count from scratch and then warm started. Warm started
+// should get about as close in fewer iterations, and the narrowphase should
+// be cheaper for rechecking from where the contacts were
+void bench_contacts(void) {
+        printf("Contact solver: %d blobs squashed into a pile, %d steps\n", PILE_BODIES, PILE_STEPS);
+        printf("%-12s %-6s %14s %8s %14s %14s %14s %14s\n", "iterations", "warm", "contacts/step", "kept", "depth", "approach", "narrow us/step", "solver us/step");
+        const int iterations[] = {1, 2, 4, 8, 16};
+        for (int i = 0; i < 5; i++) {
+                for (int warm = 0; warm < 2; warm++) {
+                        PileRun run = runPile(iterations[i], warm);
+                        printf("%-12d %-6s %14.1f %7.1f%% %14.4f %14.5f %14.1f %14.1f\n", iterations[i], warm ? "yes" : "no", run.contacts, 100.0 * run.warm, run.depth, run.approach, run.narrowUs, run.solverUs);
+                }
+        }
+}
+
+#define CROWD_BODIES 256
+#define CROWD_STEPS 120
+
+typedef struct CrowdRun {
+        double narrowUs; // Per step
+        double solverUs;
+        double colors;
+        unsigned long long hash;
+} CrowdRun;
+
+// The pile again, four times the size, on `threads` threads
+static CrowdRun runCrowd(int threads, ContactOrder order) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, CROWD_BODIES);
+        JobSystem *jobs = threads > 1 ? createJobSystem(threads) : NULL;
+        world.jobs = jobs;
+        world.integrator = Integrator_SymplecticEuler;
+        world.contactOrder = order;
+        world.allowSleep = false;
+        SoftBody *bodies = MemAlloc(sizeof(SoftBody) * CROWD_BODIES);
+        for (int b = 0; b < CROWD_BODIES; b++) {
+                Vector2 center = {(b % 16) * 2.5f - 18.75f, (b / 16) * 2.5f - 18.75f};
+                bodies[b] = createEmptySoftBody(SoftBodyType_Shape | SoftBodyType_Springs, 1.0f, 0.0f, 100.f, 1.f, 100.f, 0.f);
+                circleSoftbody(&bodies[b], center, 1.f, 16);
+                applyImpulse(&bodies[b], Vector2Scale(center, -0.5f));
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+
+        CrowdRun run = {0};
+        for (int step = 0; step < CROWD_STEPS; step++) {
+                step_PhysicsWorld(&world, BENCH_DT);
+                run.narrowUs += world.narrowphaseTime * 1e6;
+                run.solverUs += world.solverTime * 1e6;
+                run.colors += world.numContactColors;
+        }
+        run.narrowUs /= CROWD_STEPS;
+        run.solverUs /= CROWD_STEPS;
+        run.colors /= CROWD_STEPS;
+        run.hash = hash_PhysicsWorld(&world);
+
+        freePhysicsWorld(&world);
+        if (jobs)
+                freeJobSystem(jobs);
+        for (int b = 0; b < CROWD_BODIES; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+        MemFree(bodies);
+        return run;
+}
+
+// The narrowphase and both contact orders over more and more threads. Each
+// order's hash should stay the same however many threads there are
+void bench_parallelContacts(void) {
+        printf("Parallel contacts: %d blobs squashed into a pile, %d steps\n", CROWD_BODIES, CROWD_STEPS);
+        printf("%-8s %-8s %14s %14s %8s %18s\n", "threads", "order", "narrow us/step", "solver us/step", "colors", "hash");
+        const int threads[] = {1, 2, 4, 8};
+        const char *orders[] = {"serial", "colored"};
+        for (int order = 0; order < 2; order++) {
+                unsigned long long first = 0;
+                for (int t = 0; t < 4; t++) {
+                        CrowdRun run = runCrowd(threads[t], order);
+                        if (t == 0)
+                                first = run.hash;
+                        printf("%-8d %-8s %14.1f %14.1f %8.1f   %016llx%s\n", threads[t], orders[order], run.narrowUs, run.solverUs, run.colors, run.hash,
+                               run.hash == first ? "" : " DIFFERENT");
+                }
+        }
+}
+
+#define CCD_BALLS 16
+#define CCD_STEPS 60
+
+typedef struct CcdRun {
+        int through; // Balls that ended up under the platform
+        double sweptPairs; // Per step
+        double sweepUs;
+        double collideUs; // Sweeping, broadphase, narrowphase and solving together
+} CcdRun;
+
+// A row of small balls fired down at a thin platform, from just above it
+static CcdRun runCcd(float speed, float ccdFraction) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, CCD_BALLS + 1);
+        world.integrator = Integrator_SymplecticEuler;
+        world.ccdFraction = ccdFraction;
+        world.allowSleep = false;
+        SoftBody *bodies = MemAlloc(sizeof(SoftBody) * (CCD_BALLS + 1));
+        // Heavy enough it hardly moves. rectSoftbody goes from the corner
+        bodies[0] = createEmptySoftBody(SoftBodyType_Springs | SoftBodyType_Shape, 1000.0f, 0.0f, 1000.f, 1.f, 1000.f, 0.f);
+        rectSoftbody(&bodies[0], (Vector2){CCD_BALLS * -0.75f, -0.25f}, (Vector2){CCD_BALLS * 1.5f, 0.25f}, 2, 2, true);
+        PhysicsWorld_addBody(&world, &bodies[0]);
+        for (int b = 1; b <= CCD_BALLS; b++) {
+                bodies[b] = createEmptySoftBody(SoftBodyType_Springs | SoftBodyType_Shape, 1.0f, 0.0f, 1000.f, 1.f, 1000.f, 0.f);
+                // Staggered so they don't all get there the same step
+                circleSoftbody(&bodies[b], (Vector2){(b - 0.5f - CCD_BALLS / 2.f) * 1.5f, 1.f + b * 0.05f}, 0.4f, 12);
+                applyImpulse(&bodies[b], (Vector2){0, -speed});
+                PhysicsWorld_addBody(&world, &bodies[b]);
+        }
+
+        CcdRun run = {0};
+        for (int step = 0; step < CCD_STEPS; step++) {
+                update_PhysicsWorld(&world, BENCH_DT);
+                double start = GetTime();
+                collide_PhysicsWorld(&world, BENCH_DT);
+                run.collideUs += (GetTime() - start) * 1e6;
+                updateSleep_PhysicsWorld(&world);
+                run.sweepUs += world.sweepTime * 1e6;
+                run.sweptPairs += world.numSweptPairs;
+        }
+        for (int b = 1; b <= CCD_BALLS; b++) {
+                if (bodies[b].bounds.max.y < bodies[0].bounds.min.y)
+                        run.through++;
+        }
+        run.sweptPairs /= CCD_STEPS;
+        run.sweepUs /= CCD_STEPS;
+        run.collideUs /= CCD_STEPS;
+
+        freePhysicsWorld(&world);
+        for (int b = 0; b <= CCD_BALLS; b++) {
+                freeSoftbody(&bodies[b]);
+        }
+        MemFree(bodies);
+        return run;
+}
+
+// How fast something has to go to get through a thin platform at a 60Hz
+// step, with and without sweeping, and what the sweeping costs
+void bench_ccd(void) {
+        printf("Continuous collision: %d balls fired at a 0.25 thick platform, %d steps of %.4fs\n", CCD_BALLS, CCD_STEPS, BENCH_DT);
+        printf("%-8s %-6s %10s %14s %14s %16s\n", "speed", "ccd", "through", "swept/step", "sweep us/step", "collide us/step");
+        const float speeds[] = {5.f, 15.f, 30.f, 60.f, 120.f, 240.f};
+        for (int i = 0; i < 6; i++) {
+                for (int ccd = 0; ccd < 2; ccd++) {
+                        CcdRun run = runCcd(speeds[i], ccd ? 0.5f : 0.f);
+                        printf("%-8.0f %-6s %7d/%-2d %14.2f %14.1f %16.1f\n", speeds[i], ccd ? "on" : "off", run.through, CCD_BALLS, run.sweptPairs, run.sweepUs, run.collideUs);
+                }
+        }
+}
+
+#define HAIRPIN_STEPS 90
+#define HAIRPIN_WIDTH 0.5f
+#define HAIRPIN_SPEED 2.f
+
+typedef struct HairpinRun {
+        int inside; // Surface points that ended up inside the body
+        int surfacePoints;
+        double selfContacts; // Per step
+        double selfUs;
+        double collideUs;
+} HairpinRun;
+
+// Whether p is in the body anywhere but right where it is on the outline:
+// nudged out along its surfaces it should be outside, unless it's gone
+// through to the inside of some other part of the body
+static bool foldedInside(const SoftBody *sb, int p, int into, int outOf) {
+        Vector2 a = sb->pointPos[sb->surfaceA[into]];
+        Vector2 b = sb->pointPos[sb->surfaceB[outOf]];
+        Vector2 e = Vector2Subtract(b, a);
+        Vector2 out = Vector2Normalize((Vector2){e.y, -e.x});
+        Vector2 q = Vector2Add(sb->pointPos[p], Vector2Scale(out, 1e-3f));
+        // Crossings of a ray off to +x
+        bool inside = false;
+        for (int s = 0; s < sb->numSurfaces; s++) {
+                Vector2 s1 = sb->pointPos[sb->surfaceA[s]];
+                Vector2 s2 = sb->pointPos[sb->surfaceB[s]];
+                if ((s1.y > q.y) == (s2.y > q.y))
+                        continue;
+                float x = s1.x + (q.y - s1.y) / (s2.y - s1.y) * (s2.x - s1.x);
+                if (x > q.x)
+                        inside = !inside;
+        }
+        return inside;
+}
+
+// A long strip bent into a hairpin, two arms side by side joined round the
+// bottom, with the arms pushed into each other
+static HairpinRun runHairpin(int segments, bool selfCollide) {
+        WorldValues worldValues = {.gravity = {0, 0}, .airPressure = 1.0f};
+        PhysicsWorld world = createPhysicsWorld(worldValues, 1);
+        world.integrator = Integrator_SymplecticEuler;
+        world.allowSleep = false;
+        SoftBody sb = createEmptySoftBody(SoftBodyType_Springs, 1.0f, 0.0f, 1000.f, 1.f, 0.f, 0.f);
+        // rectSoftbody spaces the rows by scale.y / detailX, so this makes
+        // it HAIRPIN_WIDTH across
+        float length = segments * 0.25f;
+        rectSoftbody(&sb, (Vector2){-length / 2.f, -HAIRPIN_WIDTH / 2.f}, (Vector2){length, HAIRPIN_WIDTH * segments / 2.f}, segments, 2, true);
+
+        // Bend it round a half circle in the middle, the arms a body width
+        // apart, and make that its rest shape. x along the strip goes round
+        // the bend and y across it stays to the left of that
+        float radius = HAIRPIN_WIDTH;
+        float bend = PI * radius / 2.f;
+        for (int i = 0; i < sb.numPoints; i++) {
+                float along = sb.pointPos[i].x;
+                float across = sb.pointPos[i].y;
+                Vector2 center, left;
+                if (along > bend) {
+                        center = (Vector2){radius, along - bend};
+                        left = (Vector2){-1.f, 0.f};
+                } else if (along < -bend) {
+                        center = (Vector2){-radius, -along - bend};
+                        left = (Vector2){1.f, 0.f};
+                } else {
+                        float angle = along / radius;
+                        center = (Vector2){radius * sinf(angle), -radius * cosf(angle)};
+                        left = (Vector2){-sinf(angle), cosf(angle)};
+                }
+                sb.pointPos[i] = Vector2Add(center, Vector2Scale(left, across));
+                // Arms together, faster further from the bend
+                float arm = Clamp((fabsf(along) - bend) / (length / 2.f - bend), 0.f, 1.f);
+                sb.pointVel[i] = (Vector2){(along < 0.f ? 1.f : -1.f) * HAIRPIN_SPEED * arm, 0.f};
+        }
+        for (int i = 0; i < sb.numSprings; i++) {
+                sb.lengths[i] = Vector2Distance(sb.pointPos[sb.springA[i]], sb.pointPos[sb.springB[i]]);
+        }
+        refitSurfaceTree_SoftBody(&sb);
+        int id = PhysicsWorld_addBody(&world, &sb);
+        world.bodySelfCollide[id] = selfCollide;
+
+        HairpinRun run = {0};
+        for (int step = 0; step < HAIRPIN_STEPS; step++) {
+                update_PhysicsWorld(&world, BENCH_DT);
+                double start = GetTime();
+                collide_PhysicsWorld(&world, BENCH_DT);
+                run.collideUs += (GetTime() - start) * 1e6;
+                run.selfUs += world.selfTime * 1e6;
+                run.selfContacts += world.numSelfContacts;
+        }
+        for (int s = 0; s < sb.numSurfaces; s++) {
+                run.inside += foldedInside(&sb, sb.surfaceA[s], sb.surfacePrev[s], s);
+                run.surfacePoints++;
+        }
+        run.selfContacts /= HAIRPIN_STEPS;
+        run.selfUs /= HAIRPIN_STEPS;
+        run.collideUs /= HAIRPIN_STEPS;
+
+        freePhysicsWorld(&world);
+        freeSoftbody(&sb);
+        return run;
+}
+
+// A hairpin squeezed shut with and without self-collision, over longer and
+// longer ones, which should cost about the same per point
+void bench_selfCollision(void) {
+        printf("Self-collision: a hairpin's arms pushed into each other at %.0f/s, %d steps\n", HAIRPIN_SPEED, HAIRPIN_STEPS);
+        printf("%-10s %-6s %12s %14s %14s %14s %16s\n", "segments", "self", "inside", "contacts/step", "self us/step", "ns/point", "collide us/step");
+        const int segments[] = {32, 64, 128, 256, 512};
+        for (int i = 0; i < 5; i++) {
+                for (int self = 0; self < 2; self++) {
+                        HairpinRun run = runHairpin(segments[i], self);
+                        printf("%-10d %-6s %7d/%-4d %14.1f %14.1f %14.1f %16.1f\n", segments[i], self ? "on" : "off", run.inside, run.surfacePoints, run.selfContacts, run.selfUs,
+                               run.selfUs * 1e3 / run.surfacePoints, run.collideUs);
+                }
+        }
+}
+
+void runBenchmarks(void) {
+        bench_integrators();
+        bench_adaptive();
+        bench_rollback();
+        bench_broadphase();
+        bench_queries();
+        bench_narrowphase();
+        bench_contacts();
+        bench_ccd();
+        bench_parallelContacts();
+        bench_selfCollision();
+        bench_layout();
+}
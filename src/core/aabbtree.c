@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <core/aabbtree.h>
+#include <math.h>
+#include <stddef.h>
+
+// Traversals keep at most one pending node per level, and the balancing keeps
+// the height around 1.44 log2 of the leaf count, so this is plenty
+#define AABBTREE_STACK 256
+
+static BB unionBB(BB a, BB b) {
+        return (BB){
+            .min = {fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y)},
+            .max = {fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y)},
+        };
+}
+
+static float perimeter(BB b) {
+        return 2.f * ((b.max.x - b.min.x) + (b.max.y - b.min.y));
+}
+
+static bool containsBB(BB outer, BB inner) {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+static bool overlapsBB(BB a, BB b) {
+        return !(a.max.x < b.min.x || a.max.y < b.min.y || a.min.x > b.max.x || a.min.y > b.max.y);
+}
+
+static bool isLeaf(const AABBNode *node) {
+        return node->child1 == AABBTREE_NULL;
+}
+
+// Chains nodes [from, to) onto the free list
+static void freeNodes(AABBTree *tree, int from, int to) {
+        for (int i = from; i < to; i++) {
+                tree->nodes[i].parent = i + 1 < to ? i + 1 : tree->freeList;
+                tree->nodes[i].height = -1;
+        }
+        tree->freeList = from;
+}
+
+AABBTree createAABBTree(int maxLeaves, float margin) {
+        int maxNodes = maxLeaves > 0 ? 2 * maxLeaves : 2;
+        AABBTree tree = {
+            .nodes = MemAlloc(sizeof(AABBNode) * maxNodes),
+            .numNodes = 0,
+            .maxNodes = maxNodes,
+            .freeList = AABBTREE_NULL,
+            .root = AABBTREE_NULL,
+            .margin = margin,
+        };
+        freeNodes(&tree, 0, maxNodes);
+        return tree;
+}
+
+void freeAABBTree(AABBTree *tree) {
+        MemFree(tree->nodes);
+        tree->nodes = NULL;
+        tree->numNodes = 0;
+        tree->maxNodes = 0;
+        tree->root = AABBTREE_NULL;
+}
+
+static int allocNode(AABBTree *tree) {
+        if (tree->freeList == AABBTREE_NULL) {
+                int old = tree->maxNodes;
+                tree->maxNodes *= 2;
+                tree->nodes = MemRealloc(tree->nodes, sizeof(AABBNode) * tree->maxNodes);
+                freeNodes(tree, old, tree->maxNodes);
+        }
+        int n = tree->freeList;
+        tree->freeList = tree->nodes[n].parent;
+        tree->nodes[n] = (AABBNode){
+            .parent = AABBTREE_NULL,
+            .child1 = AABBTREE_NULL,
+            .child2 = AABBTREE_NULL,
+            .height = 0,
+            .id = -1,
+        };
+        tree->numNodes++;
+        return n;
+}
+
+static void releaseNode(AABBTree *tree, int n) {
+        tree->nodes[n].parent = tree->freeList;
+        tree->nodes[n].height = -1;
+        tree->freeList = n;
+        tree->numNodes--;
+}
+
+// Points whatever pointed at `from` (its parent, or the root) at `to` instead
+static void replaceChild(AABBTree *tree, int parent, int from, int to) {
+        if (parent == AABBTREE_NULL) {
+                tree->root = to;
+        } else if (tree->nodes[parent].child1 == from) {
+                tree->nodes[parent].child1 = to;
+        } else {
+                tree->nodes[parent].child2 = to;
+        }
+}
+
+static void refit(AABBTree *tree, int n) {
+        AABBNode *node = &tree->nodes[n];
+        AABBNode *c1 = &tree->nodes[node->child1];
+        AABBNode *c2 = &tree->nodes[node->child2];
+        node->box = unionBB(c1->box, c2->box);
+        node->height = 1 + (c1->height > c2->height ? c1->height : c2->height);
+}
+
+// If a's children's heights differ by more than one, rotates the taller one
+// up into a's place. Returns whatever's in a's place now
+static int balance(AABBTree *tree, int a) {
+        AABBNode *nodes = tree->nodes;
+        if (isLeaf(&nodes[a]) || nodes[a].height < 2)
+                return a;
+        int b = nodes[a].child1;
+        int c = nodes[a].child2;
+        int diff = nodes[c].height - nodes[b].height;
+        if (diff >= -1 && diff <= 1)
+                return a;
+
+        // Same both ways round: the taller child `up` takes a's place with a
+        // as its child, and up's shorter child moves across to a, into the
+        // slot up left
+        int up = diff > 1 ? c : b;
+        int f = nodes[up].child1;
+        int g = nodes[up].child2;
+        nodes[up].parent = nodes[a].parent;
+        replaceChild(tree, nodes[a].parent, a, up);
+        nodes[a].parent = up;
+        nodes[up].child1 = a;
+        int taller = nodes[f].height > nodes[g].height ? f : g;
+        int shorter = taller == f ? g : f;
+        nodes[up].child2 = taller;
+        if (up == c)
+                nodes[a].child2 = shorter;
+        else
+                nodes[a].child1 = shorter;
+        nodes[shorter].parent = a;
+        refit(tree, a);
+        refit(tree, up);
+        return up;
+}
+
+// Refits and balances everything from n up to the root
+static void fixUpwards(AABBTree *tree, int n) {
+        while (n != AABBTREE_NULL) {
+                n = balance(tree, n);
+                refit(tree, n);
+                n = tree->nodes[n].parent;
+        }
+}
+
+static void insertLeaf(AABBTree *tree, int leaf) {
+        AABBNode *nodes = tree->nodes;
+        if (tree->root == AABBTREE_NULL) {
+                tree->root = leaf;
+                nodes[leaf].parent = AABBTREE_NULL;
+                return;
+        }
+
+        // Head down towards whichever child it'd grow least, and stop when
+        // making a new parent right here is cheaper than either
+        BB box = nodes[leaf].box;
+        int n = tree->root;
+        while (!isLeaf(&nodes[n])) {
+                float area = perimeter(nodes[n].box);
+                float combined = perimeter(unionBB(nodes[n].box, box));
+                float cost = 2.f * combined;
+                // Everything below here grows by at least this much either way
+                float inherited = 2.f * (combined - area);
+                float childCost[2];
+                int children[2] = {nodes[n].child1, nodes[n].child2};
+                for (int k = 0; k < 2; k++) {
+                        AABBNode *child = &nodes[children[k]];
+                        float grown = perimeter(unionBB(child->box, box));
+                        childCost[k] = (isLeaf(child) ? grown : grown - perimeter(child->box)) + inherited;
+                }
+                if (cost < childCost[0] && cost < childCost[1])
+                        break;
+                n = childCost[0] < childCost[1] ? children[0] : children[1];
+        }
+
+        int sibling = n;
+        int oldParent = nodes[sibling].parent;
+        int parent = allocNode(tree);
+        nodes = tree->nodes;
+        nodes[parent].parent = oldParent;
+        nodes[parent].child1 = sibling;
+        nodes[parent].child2 = leaf;
+        replaceChild(tree, oldParent, sibling, parent);
+        nodes[sibling].parent = parent;
+        nodes[leaf].parent = parent;
+        fixUpwards(tree, parent);
+}
+
+static void removeLeaf(AABBTree *tree, int leaf) {
+        AABBNode *nodes = tree->nodes;
+        if (leaf == tree->root) {
+                tree->root = AABBTREE_NULL;
+                return;
+        }
+        // The leaf's sibling takes its parent's place
+        int parent = nodes[leaf].parent;
+        int grandparent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        replaceChild(tree, grandparent, parent, sibling);
+        nodes[sibling].parent = grandparent;
+        releaseNode(tree, parent);
+        fixUpwards(tree, grandparent);
+}
+
+static BB fatten(BB box, float margin, Vector2 displacement) {
+        box.min.x -= margin;
+        box.min.y -= margin;
+        box.max.x += margin;
+        box.max.y += margin;
+        // Whichever way it's heading, it'll probably keep heading
+        if (displacement.x < 0.f)
+                box.min.x += displacement.x;
+        else
+                box.max.x += displacement.x;
+        if (displacement.y < 0.f)
+                box.min.y += displacement.y;
+        else
+                box.max.y += displacement.y;
+        return box;
+}
+
+int AABBTree_insert(AABBTree *tree, BB box, int id) {
+        int leaf = allocNode(tree);
+        tree->nodes[leaf].box = fatten(box, tree->margin, (Vector2){0.f, 0.f});
+        tree->nodes[leaf].id = id;
+        insertLeaf(tree, leaf);
+        return leaf;
+}
+
+void AABBTree_remove(AABBTree *tree, int leaf) {
+        assert(isLeaf(&tree->nodes[leaf]) && tree->nodes[leaf].height == 0);
+        removeLeaf(tree, leaf);
+        releaseNode(tree, leaf);
+}
+
+bool AABBTree_move(AABBTree *tree, int leaf, BB box, Vector2 displacement) {
+        if (containsBB(tree->nodes[leaf].box, box))
+                return false;
+        removeLeaf(tree, leaf);
+        tree->nodes[leaf].box = fatten(box, tree->margin, displacement);
+        insertLeaf(tree, leaf);
+        return true;
+}
+
+int AABBTree_height(const AABBTree *tree) {
+        return tree->root == AABBTREE_NULL ? 0 : tree->nodes[tree->root].height;
+}
+
+void AABBTree_query(const AABBTree *tree, BB box, AABBQueryFn fn, void *data) {
+        if (tree->root == AABBTREE_NULL)
+                return;
+        int stack[AABBTREE_STACK];
+        int top = 0;
+        stack[top++] = tree->root;
+        while (top > 0) {
+                const AABBNode *node = &tree->nodes[stack[--top]];
+                if (!overlapsBB(node->box, box))
+                        continue;
+                if (isLeaf(node)) {
+                        if (!fn(data, node->id))
+                                return;
+                } else {
+                        assert(top + 2 <= AABBTREE_STACK);
+                        stack[top++] = node->child1;
+                        stack[top++] = node->child2;
+                }
+        }
+}
+
+void AABBTree_raycast(const AABBTree *tree, Vector2 from, Vector2 to, float maxFraction, AABBRaycastFn fn, void *data) {
+        if (tree->root == AABBTREE_NULL)
+                return;
+        Vector2 d = Vector2Subtract(to, from);
+        // The ray's normal. A box is off to one side of the ray's line if its
+        // center's further from it than the box reaches that way
+        Vector2 perp = {-d.y, d.x};
+        Vector2 absPerp = {fabsf(perp.x), fabsf(perp.y)};
+        Vector2 end = Vector2Add(from, Vector2Scale(d, maxFraction));
+        BB segment = {Vector2Min(from, end), Vector2Max(from, end)};
+
+        int stack[AABBTREE_STACK];
+        int top = 0;
+        stack[top++] = tree->root;
+        while (top > 0) {
+                const AABBNode *node = &tree->nodes[stack[--top]];
+                if (!overlapsBB(node->box, segment))
+                        continue;
+                Vector2 c = Vector2Scale(Vector2Add(node->box.min, node->box.max), 0.5f);
+                Vector2 h = Vector2Scale(Vector2Subtract(node->box.max, node->box.min), 0.5f);
+                float separation = fabsf(Vector2DotProduct(perp, Vector2Subtract(from, c))) - Vector2DotProduct(absPerp, h);
+                if (separation > 0.f)
+                        continue;
+                if (isLeaf(node)) {
+                        float clipped = fn(data, node->id, from, to, maxFraction);
+                        if (clipped == 0.f)
+                                return;
+                        if (clipped < maxFraction) {
+                                maxFraction = clipped;
+                                end = Vector2Add(from, Vector2Scale(d, maxFraction));
+                                segment = (BB){Vector2Min(from, end), Vector2Max(from, end)};
+                        }
+                } else {
+                        assert(top + 2 <= AABBTREE_STACK);
+                        stack[top++] = node->child1;
+                        stack[top++] = node->child2;
+                }
+        }
+}
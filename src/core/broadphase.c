@@ -0,0 +1,349 @@
+#include <assert.h>
+#include <core/broadphase.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+Broadphase createBroadphase(BroadphaseType type, int maxBodies, float cellSize) {
+        int maxPairs = maxBodies > 0 ? maxBodies : 1;
+        Broadphase bp = {
+            .type = type,
+            .maxBodies = maxBodies,
+            .maxPairs = maxPairs,
+            .pairs = MemAlloc(sizeof(BodyPair) * maxPairs),
+            .bounds = MemAlloc(sizeof(BB) * maxBodies),
+        };
+        if (type == Broadphase_SweepAndPrune) {
+                bp.sap = (SweepAndPrune){
+                    .order = MemAlloc(sizeof(int) * maxBodies),
+                    .bounds = MemAlloc(sizeof(BB) * maxBodies),
+                };
+        } else if (type == Broadphase_AABBTree) {
+                bp.tree = createAABBTree(maxBodies, BROADPHASE_TREE_MARGIN);
+                bp.leaf = MemAlloc(sizeof(int) * maxBodies);
+                bp.moved = MemAlloc(sizeof(bool) * maxBodies);
+                bp.maxFatPairs = maxPairs;
+                bp.fatPairs = MemAlloc(sizeof(BodyPair) * maxPairs);
+        } else {
+                assert(cellSize > 0.f);
+                // A body about the size of a cell usually straddles 4 of them,
+                // so this keeps it to a couple of cells per bucket
+                int numBuckets = 16;
+                while (numBuckets < 4 * maxBodies) {
+                        numBuckets *= 2;
+                }
+                bp.hash = (SpatialHash){
+                    .cellSize = cellSize,
+                    .cells = MemAlloc(sizeof(CellRange) * maxBodies),
+                    .large = MemAlloc(sizeof(int) * maxBodies),
+                    .numBuckets = numBuckets,
+                    .bucketStart = MemAlloc(sizeof(int) * (numBuckets + 1)),
+                    .maxEntries = numBuckets,
+                    .entries = MemAlloc(sizeof(HashEntry) * numBuckets),
+                };
+        }
+        return bp;
+}
+
+void freeBroadphase(Broadphase *bp) {
+        MemFree(bp->sap.order);
+        MemFree(bp->sap.bounds);
+        MemFree(bp->hash.cells);
+        MemFree(bp->hash.large);
+        MemFree(bp->hash.bucketStart);
+        MemFree(bp->hash.entries);
+        if (bp->type == Broadphase_AABBTree)
+                freeAABBTree(&bp->tree);
+        MemFree(bp->leaf);
+        MemFree(bp->moved);
+        MemFree(bp->fatPairs);
+        MemFree(bp->bounds);
+        MemFree(bp->pairs);
+        bp->numBodies = 0;
+        bp->numPairs = 0;
+}
+
+void Broadphase_addBody(Broadphase *bp, int id, BB bounds) {
+        assert(id == bp->numBodies && id < bp->maxBodies);
+        // Wherever it belongs, the next update's sort will move it there
+        if (bp->type == Broadphase_SweepAndPrune)
+                bp->sap.order[id] = id;
+        // In now, so queries find it before the first update
+        if (bp->type == Broadphase_AABBTree) {
+                bp->leaf[id] = AABBTree_insert(&bp->tree, bounds, id);
+                bp->moved[id] = true;
+        }
+        bp->bounds[id] = bounds;
+        bp->numBodies++;
+}
+
+static int comparePairs(const void *l, const void *r) {
+        const BodyPair *a = l;
+        const BodyPair *b = r;
+        if (a->b != b->b)
+                return a->b < b->b ? -1 : 1;
+        return a->a < b->a ? -1 : a->a > b->a;
+}
+
+static void pushPair(BodyPair **pairs, int *num, int *max, int a, int b) {
+        if (*num == *max) {
+                *max *= 2;
+                *pairs = MemRealloc(*pairs, sizeof(BodyPair) * *max);
+        }
+        (*pairs)[(*num)++] = a < b ? (BodyPair){a, b} : (BodyPair){b, a};
+}
+
+static void addPair(Broadphase *bp, int a, int b) {
+        pushPair(&bp->pairs, &bp->numPairs, &bp->maxPairs, a, b);
+}
+
+static bool overlaps(BB a, BB b) {
+        return !(a.max.x < b.min.x || a.max.y < b.min.y || a.min.x > b.max.x || a.min.y > b.max.y);
+}
+
+// A body that's blown up can't overlap anything sensibly, and NaNs compare
+// false with everything, which breaks sorting and sweeping on them
+static bool finiteBB(BB bb) {
+        return isfinite(bb.min.x) && isfinite(bb.min.y) && isfinite(bb.max.x) && isfinite(bb.max.y);
+}
+
+/* Sweep and prune */
+
+static void update_SweepAndPrune(Broadphase *bp, SoftBody **bodies) {
+        SweepAndPrune *sap = &bp->sap;
+        int n = bp->numBodies;
+        int *order = sap->order;
+        BB *bounds = sap->bounds;
+        // Non-finite bounds get an empty box out past everything instead, so
+        // they sort to the end, and the sweep stops before ever reaching them
+        for (int i = 0; i < n; i++) {
+                bounds[i] = bodies[order[i]]->bounds;
+                if (!finiteBB(bounds[i]))
+                        bounds[i] = (BB){{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+        }
+
+        // Insertion sort from last update's order, so it's one compare per
+        // body plus one per place something actually moved
+        sap->swaps = 0;
+        for (int i = 1; i < n; i++) {
+                int id = order[i];
+                BB bb = bounds[i];
+                int j = i;
+                while (j > 0 && bounds[j - 1].min.x > bb.min.x) {
+                        order[j] = order[j - 1];
+                        bounds[j] = bounds[j - 1];
+                        j--;
+                }
+                order[j] = id;
+                bounds[j] = bb;
+                sap->swaps += i - j;
+        }
+
+        // Everything after i that starts before i ends overlaps it in x
+        for (int i = 0; i < n; i++) {
+                BB a = bounds[i];
+                for (int j = i + 1; j < n && bounds[j].min.x <= a.max.x; j++) {
+                        bp->numTested++;
+                        BB b = bounds[j];
+                        if (a.max.y < b.min.y || a.min.y > b.max.y)
+                                continue;
+                        addPair(bp, order[i], order[j]);
+                }
+        }
+        qsort(bp->pairs, bp->numPairs, sizeof(BodyPair), comparePairs);
+}
+
+/* Spatial hash */
+
+static int cellOf(float x, float cellSize) {
+        // floorf, without the libm call it is on plain x86-64
+        float c = x / cellSize;
+        int i = (int)c;
+        return i - (c < (float)i);
+}
+
+// Past this many cells out cellOf's int isn't safe any more
+#define HASH_MAX_COORD 1073741824.f
+
+// The cells bb touches, or false if it's too big or too far out for the grid
+static bool cellRange(BB bb, float cell, CellRange *r) {
+        float x0 = bb.min.x / cell, y0 = bb.min.y / cell;
+        float x1 = bb.max.x / cell, y1 = bb.max.y / cell;
+        if (!(x0 >= -HASH_MAX_COORD && y0 >= -HASH_MAX_COORD && x1 <= HASH_MAX_COORD && y1 <= HASH_MAX_COORD))
+                return false;
+        *r = (CellRange){cellOf(bb.min.x, cell), cellOf(bb.min.y, cell), cellOf(bb.max.x, cell), cellOf(bb.max.y, cell)};
+        return (long long)(r->x1 - r->x0 + 1) * (r->y1 - r->y0 + 1) <= HASH_MAX_CELLS;
+}
+
+static int bucketOf(const SpatialHash *hash, int x, int y) {
+        unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u);
+        return h & (hash->numBuckets - 1);
+}
+
+static void update_SpatialHash(Broadphase *bp, SoftBody **bodies) {
+        SpatialHash *hash = &bp->hash;
+        float cell = hash->cellSize;
+        int *start = hash->bucketStart;
+
+        // Counting sort of every (body, cell it touches) by bucket. Counts go
+        // one bucket up, so the running total turns them into starts
+        memset(start, 0, sizeof(int) * (hash->numBuckets + 1));
+        hash->numEntries = 0;
+        BB *bounds = bp->bounds;
+        CellRange *cells = hash->cells;
+        hash->numLarge = 0;
+        for (int b = 0; b < bp->numBodies; b++) {
+                BB bb = bounds[b] = bodies[b]->bounds;
+                CellRange r;
+                if (!finiteBB(bb) || !cellRange(bb, cell, &r)) {
+                        if (finiteBB(bb))
+                                hash->large[hash->numLarge++] = b;
+                        r = (CellRange){0, 0, -1, -1};
+                }
+                cells[b] = r;
+                for (int y = r.y0; y <= r.y1; y++) {
+                        for (int x = r.x0; x <= r.x1; x++) {
+                                start[bucketOf(hash, x, y) + 1]++;
+                                hash->numEntries++;
+                        }
+                }
+        }
+        if (hash->numEntries > hash->maxEntries) {
+                while (hash->maxEntries < hash->numEntries) {
+                        hash->maxEntries *= 2;
+                }
+                hash->entries = MemRealloc(hash->entries, sizeof(HashEntry) * hash->maxEntries);
+        }
+        for (int k = 0; k < hash->numBuckets; k++) {
+                start[k + 1] += start[k];
+        }
+        // Filling moves every start up to the next bucket's, so shift them back after
+        HashEntry *entries = hash->entries;
+        for (int b = 0; b < bp->numBodies; b++) {
+                CellRange r = cells[b];
+                for (int y = r.y0; y <= r.y1; y++) {
+                        for (int x = r.x0; x <= r.x1; x++) {
+                                entries[start[bucketOf(hash, x, y)]++] = (HashEntry){b, x, y};
+                        }
+                }
+        }
+        memmove(start + 1, start, sizeof(int) * hash->numBuckets);
+        start[0] = 0;
+
+        for (int k = 0; k < hash->numBuckets; k++) {
+                for (int i = start[k]; i < start[k + 1]; i++) {
+                        HashEntry e = entries[i];
+                        BB a = bounds[e.body];
+                        for (int j = i + 1; j < start[k + 1]; j++) {
+                                HashEntry f = entries[j];
+                                // Just sharing the bucket
+                                if (f.x != e.x || f.y != e.y)
+                                        continue;
+                                bp->numTested++;
+                                BB b = bounds[f.body];
+                                if (!overlaps(a, b))
+                                        continue;
+                                // The pair shares every cell their overlap touches. Only
+                                // take it in the one with the overlap's min corner
+                                if (cellOf(fmaxf(a.min.x, b.min.x), cell) != e.x || cellOf(fmaxf(a.min.y, b.min.y), cell) != e.y)
+                                        continue;
+                                addPair(bp, e.body, f.body);
+                        }
+                }
+        }
+
+        // The big ones against everything in the grid, and each other
+        for (int i = 0; i < hash->numLarge; i++) {
+                int l = hash->large[i];
+                for (int b = 0; b < bp->numBodies; b++) {
+                        if (cells[b].x0 > cells[b].x1)
+                                continue;
+                        bp->numTested++;
+                        if (overlaps(bounds[l], bounds[b]))
+                                addPair(bp, l, b);
+                }
+                for (int j = i + 1; j < hash->numLarge; j++) {
+                        bp->numTested++;
+                        if (overlaps(bounds[l], bounds[hash->large[j]]))
+                                addPair(bp, l, hash->large[j]);
+                }
+        }
+        qsort(bp->pairs, bp->numPairs, sizeof(BodyPair), comparePairs);
+}
+
+/* AABB tree */
+
+typedef struct TreePairQuery {
+        Broadphase *bp;
+        int body;
+} TreePairQuery;
+
+static bool treePair(void *data, int id) {
+        TreePairQuery *q = data;
+        Broadphase *bp = q->bp;
+        // If both moved they both find each other, only the lower one takes it
+        if (id == q->body || (bp->moved[id] && id < q->body))
+                return true;
+        pushPair(&bp->fatPairs, &bp->numFatPairs, &bp->maxFatPairs, q->body, id);
+        return true;
+}
+
+void Broadphase_refit(Broadphase *bp, SoftBody **bodies) {
+        if (bp->type != Broadphase_AABBTree)
+                return;
+        BB *bounds = bp->bounds;
+        bp->numMoved = 0;
+        for (int b = 0; b < bp->numBodies; b++) {
+                BB bb = bodies[b]->bounds;
+                Vector2 moved = Vector2Subtract(bb.min, bounds[b].min);
+                if (AABBTree_move(&bp->tree, bp->leaf[b], bb, moved)) {
+                        bp->moved[b] = true;
+                        bp->numMoved++;
+                }
+                bounds[b] = bb;
+        }
+}
+
+static void update_Tree(Broadphase *bp, SoftBody **bodies) {
+        BB *bounds = bp->bounds;
+        Broadphase_refit(bp, bodies);
+
+        // Fat pairs where neither moved still stand, the moved ones find theirs again
+        int kept = 0;
+        for (int p = 0; p < bp->numFatPairs; p++) {
+                BodyPair pair = bp->fatPairs[p];
+                if (!bp->moved[pair.a] && !bp->moved[pair.b])
+                        bp->fatPairs[kept++] = pair;
+        }
+        bp->numFatPairs = kept;
+        for (int b = 0; b < bp->numBodies; b++) {
+                if (!bp->moved[b])
+                        continue;
+                TreePairQuery q = {bp, b};
+                AABBTree_query(&bp->tree, bp->tree.nodes[bp->leaf[b]].box, treePair, &q);
+        }
+        for (int b = 0; b < bp->numBodies; b++) {
+                bp->moved[b] = false;
+        }
+        qsort(bp->fatPairs, bp->numFatPairs, sizeof(BodyPair), comparePairs);
+
+        // Tight bounds overlapping means fat boxes overlapping, so the pairs
+        // are all in there, and already in order
+        for (int p = 0; p < bp->numFatPairs; p++) {
+                BodyPair pair = bp->fatPairs[p];
+                bp->numTested++;
+                if (overlaps(bounds[pair.a], bounds[pair.b]))
+                        addPair(bp, pair.a, pair.b);
+        }
+}
+
+void update_Broadphase(Broadphase *bp, SoftBody **bodies) {
+        bp->numPairs = 0;
+        bp->numTested = 0;
+        if (bp->type == Broadphase_SweepAndPrune)
+                update_SweepAndPrune(bp, bodies);
+        else if (bp->type == Broadphase_AABBTree)
+                update_Tree(bp, bodies);
+        else
+                update_SpatialHash(bp, bodies);
+}
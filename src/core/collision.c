@@ -1,19 +1,43 @@
+#include <assert.h>
 #include <core/collision.h>
 #include <math.h>
 #include <raylib.h>
 #include <stdio.h>
-
-int anypoints(SoftBody A, SoftBody B) {
-        // ? Idea: optimize this through vertical decomposition
-        //! Doesn't match with the *first* surface it sees, just any surface at all
-        //* Might thus be easier to actually do the counting thing
-        for (int i = 0; i < A.numPoints; i++) {
-                Vector2 point = A.pointPos[i];
-                int intersects = 0;
-
-                for (int surf = 0; surf < B.numSurfaces; surf++) {
-                        Vector2 p1 = B.pointPos[B.surfaceA[surf]];
-                        Vector2 p2 = B.pointPos[B.surfaceB[surf]];
+#include <string.h>
+
+// How far past its edge a contact's point gets pushed
+#define CONTACT_SKIN 1e-3f
+// Most surfaces recheckCollision walks from last time's edge
+#define CONTACT_WALK 4
+// Hits this soon after the first one (as a fraction of the step) go in with
+// it, so a flat side landing all at once doesn't land on one corner
+#define CCD_SLOP 0.05f
+// Deep enough for the surface tree of any body that fits in memory, the
+// builder halves it every level
+#define SURFACE_TREE_STACK 64
+
+// The surfaces of B a ray from point heading +x crosses, mod 2
+static int crossingParity(const SoftBody *B, Vector2 point) {
+        int crossings = 0;
+        int stack[SURFACE_TREE_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+                const SurfaceNode *node = &B->surfaceNodes[stack[--top]];
+                // Only the y test prunes, a surface off to the left can still
+                // count if it's flat (same as it always has)
+                if (point.y < node->box.min.y || point.y > node->box.max.y)
+                        continue;
+                if (node->right >= 0) {
+                        assert(top + 2 <= SURFACE_TREE_STACK);
+                        stack[top++] = node->right;
+                        stack[top++] = node - B->surfaceNodes + 1;
+                        continue;
+                }
+                for (int i = node->first; i < node->first + node->count; i++) {
+                        int surf = B->surfaceOrder[i];
+                        Vector2 p1 = B->pointPos[B->surfaceA[surf]];
+                        Vector2 p2 = B->pointPos[B->surfaceB[surf]];
 
                         float min = fminf(p1.y, p2.y);
                         float max = fmaxf(p1.y, p2.y);
@@ -28,67 +52,193 @@ int anypoints(SoftBody A, SoftBody B) {
                         if (cross * dy > 0)
                                 continue;
 
-                        intersects++;
+                        crossings++;
                 }
-                if (intersects % 2)
-                        return i;
         }
-        return -1;
+        return crossings % 2;
+}
+
+// How far point is from the box, squared. 0 inside
+static float distanceSqrBB(BB box, Vector2 point) {
+        float dx = fmaxf(fmaxf(box.min.x - point.x, point.x - box.max.x), 0.f);
+        float dy = fmaxf(fmaxf(box.min.y - point.y, point.y - box.max.y), 0.f);
+        return dx * dx + dy * dy;
 }
 
 void nearestSurface(SoftBody A, int a_i, SoftBody B, int *nearestSurf, float *nearestDist, float *edge_t, Vector2 *nearestPoint) {
         Vector2 point = A.pointPos[a_i];
 
-        *nearestDist = FP_INFINITE;
-        for (int surf = 0; surf < B.numSurfaces; surf++) {
-                Vector2 p1 = B.pointPos[B.surfaceA[surf]];
-                Vector2 p2 = B.pointPos[B.surfaceB[surf]];
+        *nearestSurf = -1;
+        *nearestDist = INFINITY;
+        int best = -1;
+        int stack[SURFACE_TREE_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+                const SurfaceNode *node = &B.surfaceNodes[stack[--top]];
+                // Nothing in there can be nearer than the box. The bit extra is
+                // for the rounding in the projection, so a tie isn't skipped
+                if (distanceSqrBB(node->box, point) > *nearestDist * *nearestDist * 1.0001f)
+                        continue;
+                if (node->right >= 0) {
+                        // Nearer one first, so the further one's more likely to get skipped
+                        int first = node - B.surfaceNodes + 1;
+                        int second = node->right;
+                        if (distanceSqrBB(B.surfaceNodes[second].box, point) < distanceSqrBB(B.surfaceNodes[first].box, point)) {
+                                second = first;
+                                first = node->right;
+                        }
+                        assert(top + 2 <= SURFACE_TREE_STACK);
+                        stack[top++] = second;
+                        stack[top++] = first;
+                        continue;
+                }
 
-                Vector2 diff = Vector2Subtract(p2, p1);
+                for (int i = node->first; i < node->first + node->count; i++) {
+                        int surf = B.surfaceOrder[i];
+                        Vector2 p1 = B.pointPos[B.surfaceA[surf]];
+                        Vector2 p2 = B.pointPos[B.surfaceB[surf]];
 
-                float l2 = Vector2LengthSqr(diff);
-                Vector2 projection;
-                // Since we're assuming a closed polygon, we can actually
-                // make some assumptions. We don't ever need to clamp,
-                // we can just continue, because since it's inside a polygon,
-                // we know that it always is closest to an actual point on the segments
-                if (l2 == 0.0)
-                        continue;
+                        Vector2 diff = Vector2Subtract(p2, p1);
 
-                float t = Vector2DotProduct(Vector2Subtract(point, p1), diff) / l2;
+                        float l2 = Vector2LengthSqr(diff);
+                        Vector2 projection;
+                        // Since we're assuming a closed polygon, we can actually
+                        // make some assumptions. We don't ever need to clamp,
+                        // we can just continue, because since it's inside a polygon,
+                        // we know that it always is closest to an actual point on the segments
+                        if (l2 == 0.0)
+                                continue;
 
-                if (t < 0.f || t > 1.f)
-                        continue;
+                        float t = Vector2DotProduct(Vector2Subtract(point, p1), diff) / l2;
 
-                projection = Vector2Add(p1, Vector2Scale(diff, t)); // Projection falls on the segment
+                        if (t < 0.f || t > 1.f)
+                                continue;
 
-                float dist = Vector2Distance(point, projection);
-                if (dist < *nearestDist) {
-                        *nearestSurf = surf;
-                        *nearestPoint = projection;
-                        *nearestDist = dist;
-                        *edge_t = t;
+                        projection = Vector2Add(p1, Vector2Scale(diff, t)); // Projection falls on the segment
+
+                        float dist = Vector2Distance(point, projection);
+                        // The tree doesn't go in surface order, so ties go to
+                        // the lower surface the way a scan through them would
+                        if (dist < *nearestDist || (dist == *nearestDist && best >= 0 && surf < best)) {
+                                best = surf;
+                                *nearestSurf = surf;
+                                *nearestPoint = projection;
+                                *nearestDist = dist;
+                                *edge_t = t;
+                        }
                 }
         }
 }
 
-CollisionData _internalCheckCollision(SoftBody A, SoftBody B) {
-        int p = anypoints(A, B);
-        if (p == -1) {
-                return (CollisionData){.collided = false};
+// How far point is from the surface, squared, and where along it it's nearest
+static float surfaceDistanceSqr(const SoftBody *B, int surf, Vector2 point, float *edge_t) {
+        Vector2 p1 = B->pointPos[B->surfaceA[surf]];
+        Vector2 diff = Vector2Subtract(B->pointPos[B->surfaceB[surf]], p1);
+        float l2 = Vector2LengthSqr(diff);
+        float t = l2 == 0.f ? 0.f : Vector2DotProduct(Vector2Subtract(point, p1), diff) / l2;
+        *edge_t = t;
+        t = Clamp(t, 0.f, 1.f);
+        return Vector2LengthSqr(Vector2Subtract(Vector2Add(p1, Vector2Scale(diff, t)), point));
+}
+
+// The same as nearestSurface, but from last time's edge, stepping to
+// whichever neighbour's nearer until neither is. It moves a surface or two
+// a frame at most, so this gives up after a few. -1 if it doesn't end up
+// somewhere the point's square on to
+static int walkNearestSurface(const SoftBody *B, Vector2 point, int surf, float *nearestDist, float *edge_t, Vector2 *nearestPoint) {
+        float t;
+        float dist = surfaceDistanceSqr(B, surf, point, &t);
+        for (int step = 0; step < CONTACT_WALK; step++) {
+                int next = surf;
+                int neighbours[2] = {B->surfacePrev[surf], B->surfaceNext[surf]};
+                for (int k = 0; k < 2; k++) {
+                        float nt;
+                        if (neighbours[k] < 0)
+                                continue;
+                        float d = surfaceDistanceSqr(B, neighbours[k], point, &nt);
+                        if (d < dist) {
+                                dist = d;
+                                t = nt;
+                                next = neighbours[k];
+                        }
+                }
+                if (next == surf)
+                        break;
+                surf = next;
         }
+        if (t < 0.f || t > 1.f)
+                return -1;
+        Vector2 p1 = B->pointPos[B->surfaceA[surf]];
+        Vector2 p2 = B->pointPos[B->surfaceB[surf]];
+        *nearestPoint = Vector2Add(p1, Vector2Scale(Vector2Subtract(p2, p1), t));
+        *nearestDist = Vector2Distance(point, *nearestPoint);
+        *edge_t = t;
+        return surf;
+}
+
+// Every point of A inside B, as contacts from contacts[num] on. Returns the
+// new count, which goes on counting past maxContacts. cached is last time's
+// contacts for A's points, in point order
+static int _internalCheckCollision(SoftBody A, SoftBody B, bool invert, const Contact *cached, int numCached, Contact *contacts, int num, int maxContacts, CollisionData *data) {
+        // A's points are all in A's box already, so the overlap of the two
+        // boxes comes down to B's. B's tree's is fresher than B.bounds, that
+        // only gets updated once a step and handling collisions moves points
+        BB box = B.surfaceNodes[0].box;
+        for (int i = 0; i < A.numPoints; i++) {
+                Vector2 point = A.pointPos[i];
+                if (point.x < box.min.x || point.x > box.max.x || point.y < box.min.y || point.y > box.max.y)
+                        continue;
+                if (!crossingParity(&B, point))
+                        continue;
 
-        CollisionData data = (CollisionData){.invert = false, .collided = true, .point = p};
-        nearestSurface(A, p, B, &data.edge, &data.distance, &data.edge_t, &data.nearest);
+                Contact c = {.invert = invert, .point = i, .edge = -1};
+                while (numCached > 0 && cached->point < i) {
+                        cached++;
+                        numCached--;
+                }
+                const Contact *was = numCached > 0 && cached->point == i ? cached : NULL;
+                if (was)
+                        c.edge = walkNearestSurface(&B, point, was->edge, &c.depth, &c.edge_t, &c.nearest);
+                if (c.edge < 0)
+                        nearestSurface(A, i, B, &c.edge, &c.depth, &c.edge_t, &c.nearest);
+                // Inside, but not square on to any surface (tucked into a dent
+                // between two). There's no edge to push it back out onto
+                if (c.edge < 0)
+                        continue;
+                Vector2 p1 = B.pointPos[B.surfaceA[c.edge]];
+                Vector2 p2 = B.pointPos[B.surfaceB[c.edge]];
+                // Surfaces wind CCW, so outwards is to their right
+                c.normal = Vector2Normalize((Vector2){p2.y - p1.y, p1.x - p2.x});
+                if (was && was->edge == c.edge) {
+                        c.normalImpulse = was->normalImpulse;
+                        c.tangentImpulse = was->tangentImpulse;
+                        data->numWarm++;
+                }
+                if (num < maxContacts)
+                        contacts[num] = c;
+                num++;
+                if (c.depth > data->depth)
+                        data->depth = c.depth;
+        }
+        return num;
+}
 
-        return data;
+CollisionData checkCollision(SoftBody A, SoftBody B, Contact *contacts, int maxContacts) {
+        return recheckCollision(A, B, NULL, 0, contacts, maxContacts);
 }
 
-CollisionData checkCollision(SoftBody A, SoftBody B) {
+CollisionData recheckCollision(SoftBody A, SoftBody B, const Contact *cached, int numCached, Contact *contacts, int maxContacts) {
         // Top-down refinement
         // First we devise an algorithm for detecing collision
         // and effeciently finding the colliding points
 
+        // Both searches go through the other body's surface tree. The bodies
+        // are copies here, so there's no building one for them now: the
+        // builders make it, bodies put together by hand need
+        // buildSurfaceTree_SoftBody (or updateBounds_SoftBody) first
+        assert(A.surfaceNodes != NULL && B.surfaceNodes != NULL);
+
         // Check bounding boxes
         if (
             A.bounds.max.x < B.bounds.min.x ||
@@ -98,23 +248,56 @@ CollisionData checkCollision(SoftBody A, SoftBody B) {
                 return (CollisionData){.collided = false};
         }
 
-        CollisionData a = _internalCheckCollision(A, B);
-        if (!a.collided) {
-                a = _internalCheckCollision(B, A);
-                a.invert = true;
+        // A's points come first in the cache too
+        int numCachedA = 0;
+        while (numCachedA < numCached && !cached[numCachedA].invert)
+                numCachedA++;
+        CollisionData data = {.depth = 0.f};
+        data.numContacts = _internalCheckCollision(A, B, false, cached, numCachedA, contacts, 0, maxContacts, &data);
+        data.numContacts = _internalCheckCollision(B, A, true, cached + numCachedA, numCached - numCachedA, contacts, data.numContacts, maxContacts, &data);
+        data.collided = data.numContacts > 0;
+        return data;
+}
+
+// Each material on its own. A pair gets the geometric mean of the two
+// frictions (so ice is slippery against anything) and the bigger of the
+// two restitutions (so rubber bounces off anything)
+static const MaterialPair materials[SoftBodyMaterial_COUNT] = {
+    [SoftBodyMaterial_DEFAULT] = {.friction = 0.5f, .restitution = 0.f},
+    [SoftBodyMaterial_RUBBER] = {.friction = 1.0f, .restitution = 0.6f},
+    [SoftBodyMaterial_ICE] = {.friction = 0.02f, .restitution = 0.f},
+    [SoftBodyMaterial_METAL] = {.friction = 0.3f, .restitution = 0.2f},
+};
+
+static MaterialPair materialPairs[SoftBodyMaterial_COUNT][SoftBodyMaterial_COUNT];
+static bool materialPairsBuilt = false;
+
+static void buildMaterialPairs(void) {
+        for (int a = 0; a < SoftBodyMaterial_COUNT; a++) {
+                for (int b = 0; b < SoftBodyMaterial_COUNT; b++) {
+                        materialPairs[a][b] = (MaterialPair){
+                            .friction = sqrtf(materials[a].friction * materials[b].friction),
+                            .restitution = fmaxf(materials[a].restitution, materials[b].restitution),
+                        };
+                }
         }
+        materialPairsBuilt = true;
+}
 
-        return a;
+MaterialPair getMaterialPair(SoftBodyMaterial A, SoftBodyMaterial B) {
+        if (!materialPairsBuilt)
+                buildMaterialPairs();
+        return materialPairs[A][B];
 }
 
-// TODO: Actually populate these, maybe make it some compile-time autogenerated thing from a config file
-// TODO: Implement friction
 float getFriction(SoftBodyMaterial A, SoftBodyMaterial B) {
-        return 1.0;
+        return getMaterialPair(A, B).friction;
 }
 
-// Assumes the collision is actually collided and already un-inverted
-void _handleCollision_internal(SoftBody A, SoftBody B, CollisionData data, SoftBodyMaterial matA, SoftBodyMaterial matB, float dt) {
+// The push for an un-inverted contact, without doing it: the point goes
+// along o by p, the edge's ends back along it by a and b. Returns false, and
+// there's no push, if the point's already out past its edge
+static bool contactPush(SoftBody A, SoftBody B, Contact data, Vector2 *o, float *a, float *b, float *p) {
         // Based on the ideas from JellyCar Worlds collision
 
         // First, shift the positions so the shapes are no longer intersecting
@@ -151,75 +334,385 @@ void _handleCollision_internal(SoftBody A, SoftBody B, CollisionData data, SoftB
         Vector2 p1 = B.pointPos[bsa],
                 p2 = B.pointPos[bsb],
                 v = A.pointPos[data.point];
-        float u = data.edge_t, m1 = B.mass, m2 = A.mass;
+        // u/(1-u) below needs u short of 1, right at the end is as good as
+        // just short of it
+        float u = fminf(data.edge_t, 0.999f), m1 = B.mass, m2 = A.mass;
 
         // o = p1 + (p2 - p1)*u - v;
-        Vector2 o = Vector2Subtract(Vector2Add(p1, Vector2Scale(Vector2Subtract(p2, p1), u)), v);
+        *o = Vector2Subtract(Vector2Add(p1, Vector2Scale(Vector2Subtract(p2, p1), u)), v);
+        // Right onto the edge is still touching it, so a bit past. And if it's
+        // already out past that (the other contacts pushed it) leave it be,
+        // pulling it back onto the edge would just stick them together
+        Vector2 normal = Vector2Normalize((Vector2){p2.y - p1.y, p1.x - p2.x});
+        *o = Vector2Add(*o, Vector2Scale(normal, CONTACT_SKIN));
+        if (Vector2DotProduct(*o, normal) <= 0.f)
+                return false;
 
         // Now for a very hacked-together Cramer's rule
         float ud1mu = u / (1 - u);
         float det = -m1 - (m1 * ud1mu) - m2 * (ud1mu * u + 1.f - u);
 
-        float a = -m2 / det;                // det(M_1) very nicely simplifies
-        float b = ud1mu * a;                // We find this directly from the second
-        float p = (a + b) * m1 * A.invMass; // And this directly from the first
+        *a = -m2 / det;                  // det(M_1) very nicely simplifies
+        *b = ud1mu * *a;                 // We find this directly from the second
+        *p = (*a + *b) * m1 * A.invMass; // And this directly from the first
+        return true;
+}
+
+// Assumes the contact is already un-inverted. Returns whether the point
+// was still inside
+bool _pushOut_internal(SoftBody A, SoftBody B, Contact data) {
+        Vector2 o;
+        float a, b, p;
+        if (!contactPush(A, B, data, &o, &a, &b, &p))
+                return false;
 
+        int bsa = B.surfaceA[data.edge];
+        int bsb = B.surfaceB[data.edge];
         // And our solutions are:
-        Vector2 A1 = Vector2Subtract(p1, Vector2Scale(o, a));
-        Vector2 B1 = Vector2Subtract(p2, Vector2Scale(o, b));
-        Vector2 v1 = Vector2Add(v, Vector2Scale(o, p));
-
-        B.pointPos[bsa] = A1;
-        B.pointPos[bsb] = B1;
-        A.pointPos[data.point] = v1;
-
-        // printf("We got here...\n");
-        // debugString = "Ok now this is weird";
-        // debugStr = TextFormat("%i   %f, %f", bsa, o.x, o.y);
-
-        // Since we are literally simulating the elasticity of objects,
-        // we don't have to worry about coeffs of restitution or anything
-        // We just have to choose between making collisions either
-        // completely elastic or inelasitic
-        // * We're trying the inelastic first
-
-        // Again, we have some linear equations as constraints
-        // Conservation of momentum:
-        // 2 * m1 * v_b.x + m2 * v_a.x = (2 * m1 + m2) * v_f.x
-        // 2 * m1 * v_b.y + m2 * v_a.y = (2 * m1 + m2) * v_f.y
-        //
-        // Thus we get:
-        // v_f.x = (2 * m1 * v_b.x + m2 * v_a.x) / (2 * m1 + m2)
-        // v_f.y = (2 * m1 * v_b.y + m2 * v_a.y) / (2 * m1 + m2)
-        //
-        // And we can properly re-distribute v_b by assuming that frame of reference
-        // So now we basically have v_b = 0, so (rearranged)
-        // v_f.x = v_rel.x * m2 / (2 * m1 + m2)
-        // v_f.y = v_rel.y * m2 / (2 * m1 + m2)
-
-        Vector2 b_avg_vel = Vector2Add(
-            Vector2Scale(B.pointVel[bsa], 1 - u),
-            Vector2Scale(B.pointVel[bsb], u));
-
-        Vector2 relative_vel = Vector2Subtract(b_avg_vel, A.pointVel[data.point]);
-
-        // Most importantly check if they're already moving apart to skip
-        Vector2 normal = (Vector2){A1.y - B1.y, B1.x - A1.x};
-        if (Vector2DotProduct(relative_vel, normal) > 0)
-                return;
-
-        Vector2 final_vel = Vector2Scale(relative_vel, m2 / (2 * m1 + m2));
-
-        A.pointVel[data.point] = Vector2Add(final_vel, b_avg_vel);
-
-        // Redistribute B velocities
-        B.pointVel[bsa] = Vector2Subtract(b_avg_vel, Vector2Scale(final_vel, 1 - u));
-        B.pointVel[bsb] = Vector2Subtract(b_avg_vel, Vector2Scale(final_vel, u));
-}
-
-void handleCollision(SoftBody A, SoftBody B, CollisionData data, SoftBodyMaterial matA, SoftBodyMaterial matB, float dt) {
-        if (data.invert)
-                _handleCollision_internal(B, A, data, matA, matB, dt);
-        else
-                _handleCollision_internal(A, B, data, matA, matB, dt);
+        B.pointPos[bsa] = Vector2Subtract(B.pointPos[bsa], Vector2Scale(o, a));
+        B.pointPos[bsb] = Vector2Subtract(B.pointPos[bsb], Vector2Scale(o, b));
+        A.pointPos[data.point] = Vector2Add(A.pointPos[data.point], Vector2Scale(o, p));
+        return true;
+}
+
+// Slower than this coming together and they don't bounce, so resting
+// contacts settle instead of jittering
+#define BOUNCE_THRESHOLD 0.5f
+
+// Un-inverted, the point's body first
+static void applyContactImpulse(SoftBody A, SoftBody B, const Contact *c, Vector2 impulse) {
+        float u = c->edge_t;
+        int bsa = B.surfaceA[c->edge];
+        int bsb = B.surfaceB[c->edge];
+        A.pointVel[c->point] = Vector2Add(A.pointVel[c->point], Vector2Scale(impulse, A.invMass));
+        B.pointVel[bsa] = Vector2Subtract(B.pointVel[bsa], Vector2Scale(impulse, B.invMass * (1.f - u)));
+        B.pointVel[bsb] = Vector2Subtract(B.pointVel[bsb], Vector2Scale(impulse, B.invMass * u));
+}
+
+// The point's velocity relative to where it is on the edge
+static Vector2 contactVelocity(SoftBody A, SoftBody B, const Contact *c) {
+        float u = c->edge_t;
+        Vector2 edgeVel = Vector2Add(
+            Vector2Scale(B.pointVel[B.surfaceA[c->edge]], 1.f - u),
+            Vector2Scale(B.pointVel[B.surfaceB[c->edge]], u));
+        return Vector2Subtract(A.pointVel[c->point], edgeVel);
+}
+
+// With the points where they've been pushed to. Works out what bounce
+// restitution wants, and applies whatever impulses it came in with
+static void prepareContact(SoftBody A, SoftBody B, Contact *c, MaterialPair material) {
+        Vector2 p1 = B.pointPos[B.surfaceA[c->edge]];
+        Vector2 p2 = B.pointPos[B.surfaceB[c->edge]];
+        c->normal = Vector2Normalize((Vector2){p2.y - p1.y, p1.x - p2.x});
+        float approach = Vector2DotProduct(contactVelocity(A, B, c), c->normal);
+        c->bounce = approach < -BOUNCE_THRESHOLD ? -material.restitution * approach : 0.f;
+        // Warm start. The normal's moved a little since these were worked
+        // out, but they only need to be close
+        Vector2 t = {-c->normal.y, c->normal.x};
+        applyContactImpulse(A, B, c, Vector2Add(Vector2Scale(c->normal, c->normalImpulse), Vector2Scale(t, c->tangentImpulse)));
+}
+
+static void solveContactVelocity(SoftBody A, SoftBody B, Contact *c, MaterialPair material) {
+        // The point moves with its own mass, the edge with B's split between
+        // its ends, so this is how much one unit of impulse changes how fast
+        // they move relative to each other
+        float u = c->edge_t;
+        float k = A.invMass + B.invMass * ((1.f - u) * (1.f - u) + u * u);
+        Vector2 n = c->normal;
+        Vector2 t = {-n.y, n.x};
+
+        // Friction first, limited by how hard they're pushing on each other
+        // so far. Then the normal, which can only ever have pushed them apart
+        float vt = Vector2DotProduct(contactVelocity(A, B, c), t);
+        float maxFriction = material.friction * c->normalImpulse;
+        float tangentImpulse = Clamp(c->tangentImpulse - vt / k, -maxFriction, maxFriction);
+        applyContactImpulse(A, B, c, Vector2Scale(t, tangentImpulse - c->tangentImpulse));
+        c->tangentImpulse = tangentImpulse;
+
+        float vn = Vector2DotProduct(contactVelocity(A, B, c), n);
+        float normalImpulse = fmaxf(c->normalImpulse + (c->bounce - vn) / k, 0.f);
+        applyContactImpulse(A, B, c, Vector2Scale(n, normalImpulse - c->normalImpulse));
+        c->normalImpulse = normalImpulse;
+}
+
+bool pushOutManifold(ContactManifold *man) {
+        bool moved = false;
+        for (int c = 0; c < man->numContacts; c++) {
+                if (man->contacts[c].invert)
+                        moved |= _pushOut_internal(*man->B, *man->A, man->contacts[c]);
+                else
+                        moved |= _pushOut_internal(*man->A, *man->B, man->contacts[c]);
+        }
+        return moved;
+}
+
+void prepareManifold(ContactManifold *man) {
+        for (int c = 0; c < man->numContacts; c++) {
+                Contact *contact = &man->contacts[c];
+                if (contact->invert)
+                        prepareContact(*man->B, *man->A, contact, man->material);
+                else
+                        prepareContact(*man->A, *man->B, contact, man->material);
+        }
+}
+
+void solveManifoldVelocity(ContactManifold *man) {
+        for (int c = 0; c < man->numContacts; c++) {
+                Contact *contact = &man->contacts[c];
+                if (contact->invert)
+                        solveContactVelocity(*man->B, *man->A, contact, man->material);
+                else
+                        solveContactVelocity(*man->A, *man->B, contact, man->material);
+        }
+}
+
+void solveContacts(ContactManifold *manifolds, int numManifolds, int iterations) {
+        // Each push works from the points as they are now, not as they were
+        // when its contact was found, so it's pushed out onto wherever its
+        // edge got to. Pushing B's points out of A moves A's surfaces though,
+        // which can push A's points that were already out back into B, so
+        // round again until nothing needed moving
+        for (int it = 0; it < iterations; it++) {
+                bool moved = false;
+                for (int m = 0; m < numManifolds; m++) {
+                        moved |= pushOutManifold(&manifolds[m]);
+                }
+                if (!moved)
+                        break;
+        }
+
+        for (int m = 0; m < numManifolds; m++) {
+                prepareManifold(&manifolds[m]);
+        }
+        // Every contact's impulse adds up over the rounds, each one correcting
+        // for what the others did to its points since
+        for (int it = 0; it < iterations; it++) {
+                for (int m = 0; m < numManifolds; m++) {
+                        solveManifoldVelocity(&manifolds[m]);
+                }
+        }
+}
+
+// One round of handleCollision's pushes, all worked out from where the points
+// are now and then applied together. Returns whether any were needed
+static bool pushOutTogether(ContactManifold *man, ContactPush *pushes) {
+        SoftBody *bodies[2] = {man->A, man->B};
+        ContactPush *bodyPushes[2] = {pushes, pushes + man->A->numPoints};
+        memset(pushes, 0, sizeof(ContactPush) * (man->A->numPoints + man->B->numPoints));
+        bool moved = false;
+        for (int c = 0; c < man->numContacts; c++) {
+                const Contact *contact = &man->contacts[c];
+                // The point's body, and the edge's
+                int pb = contact->invert ? 1 : 0;
+                int eb = 1 - pb;
+                Vector2 o;
+                float a, b, p;
+                if (!contactPush(*bodies[pb], *bodies[eb], *contact, &o, &a, &b, &p))
+                        continue;
+                moved = true;
+                // checkCollision gives every point one contact at most
+                bodyPushes[pb][contact->point].out = Vector2Scale(o, p);
+                ContactPush *ends[2] = {&bodyPushes[eb][bodies[eb]->surfaceA[contact->edge]], &bodyPushes[eb][bodies[eb]->surfaceB[contact->edge]]};
+                ends[0]->edges = Vector2Subtract(ends[0]->edges, Vector2Scale(o, a));
+                ends[0]->numEdges++;
+                ends[1]->edges = Vector2Subtract(ends[1]->edges, Vector2Scale(o, b));
+                ends[1]->numEdges++;
+        }
+        for (int k = 0; k < 2; k++) {
+                for (int i = 0; i < bodies[k]->numPoints; i++) {
+                        ContactPush push = bodyPushes[k][i];
+                        Vector2 move = push.out;
+                        if (push.numEdges > 0)
+                                move = Vector2Add(move, Vector2Scale(push.edges, 1.f / push.numEdges));
+                        bodies[k]->pointPos[i] = Vector2Add(bodies[k]->pointPos[i], move);
+                }
+        }
+        return moved;
+}
+
+void handleCollision(SoftBody *A, SoftBody *B, Contact *contacts, int numContacts, SoftBodyMaterial matA, SoftBodyMaterial matB, ContactPush *pushes) {
+        ContactManifold manifold = {A, B, contacts, numContacts, getMaterialPair(matA, matB)};
+        // Same contacts every round, it's only ever the one checkCollision
+        for (int it = 0; it < CONTACT_ITERATIONS; it++) {
+                if (!pushOutTogether(&manifold, pushes))
+                        break;
+        }
+        prepareManifold(&manifold);
+        for (int it = 0; it < CONTACT_ITERATIONS; it++) {
+                solveManifoldVelocity(&manifold);
+        }
+        updateBounds_SoftBody(A);
+        updateBounds_SoftBody(B);
+}
+
+bool raycast_SoftBody(const SoftBody *sb, Vector2 from, Vector2 to, float maxFraction, RaycastHit *hit) {
+        Vector2 d = Vector2Subtract(to, from);
+        int best = -1;
+        float bestT = maxFraction;
+        for (int surf = 0; surf < sb->numSurfaces; surf++) {
+                Vector2 p1 = sb->pointPos[sb->surfaceA[surf]];
+                Vector2 p2 = sb->pointPos[sb->surfaceB[surf]];
+                Vector2 e = Vector2Subtract(p2, p1);
+                // from + d t = p1 + e s, crossed with e and d to get t and s
+                float denom = d.x * e.y - d.y * e.x;
+                if (denom == 0.f)
+                        continue; // Parallel, a ray along a surface doesn't hit it
+                Vector2 w = Vector2Subtract(p1, from);
+                float t = (w.x * e.y - w.y * e.x) / denom;
+                float s = (w.x * d.y - w.y * d.x) / denom;
+                if (t < 0.f || t > bestT || s < 0.f || s > 1.f)
+                        continue;
+                // Ties go to the first surface, so it's the same one every time
+                if (t == bestT && best >= 0)
+                        continue;
+                best = surf;
+                bestT = t;
+        }
+        if (best < 0)
+                return false;
+
+        Vector2 p1 = sb->pointPos[sb->surfaceA[best]];
+        Vector2 p2 = sb->pointPos[sb->surfaceB[best]];
+        Vector2 normal = Vector2Normalize((Vector2){p2.y - p1.y, p1.x - p2.x});
+        if (Vector2DotProduct(normal, d) > 0.f)
+                normal = Vector2Negate(normal);
+        hit->surface = best;
+        hit->fraction = bestT;
+        hit->point = Vector2Add(from, Vector2Scale(d, bestT));
+        hit->normal = normal;
+        return true;
+}
+
+static float cross(Vector2 a, Vector2 b) {
+        return a.x * b.y - a.y * b.x;
+}
+
+bool sweepPoint(Vector2 p0, Vector2 p1, Vector2 a0, Vector2 a1, Vector2 b0, Vector2 b1, float *toi, float *edge_t) {
+        // The point's on the surface's line when cross(e, q) is 0, with
+        // e = b - a and q = p - a. Both of those move in straight lines too,
+        // so that's a quadratic in t. It's positive on the inside
+        Vector2 e0 = Vector2Subtract(b0, a0);
+        Vector2 de = Vector2Subtract(Vector2Subtract(b1, a1), e0);
+        Vector2 q0 = Vector2Subtract(p0, a0);
+        Vector2 dq = Vector2Subtract(Vector2Subtract(p1, a1), q0);
+        float a = cross(de, dq);
+        float b = cross(e0, dq) + cross(de, q0);
+        float c = cross(e0, q0);
+
+        float roots[2];
+        int numRoots = 0;
+        if (fabsf(a) < 1e-9f) {
+                if (b != 0.f)
+                        roots[numRoots++] = -c / b;
+        } else {
+                float disc = b * b - 4.f * a * c;
+                if (disc < 0.f)
+                        return false;
+                // The form that doesn't cancel out when b is about sqrt(disc)
+                float q = -0.5f * (b + copysignf(sqrtf(disc), b));
+                roots[numRoots++] = q / a;
+                if (q != 0.f)
+                        roots[numRoots++] = c / q;
+                if (numRoots == 2 && roots[1] < roots[0]) {
+                        float swap = roots[0];
+                        roots[0] = roots[1];
+                        roots[1] = swap;
+                }
+        }
+
+        for (int r = 0; r < numRoots; r++) {
+                float t = roots[r];
+                // Heading inwards, and somewhere along the surface rather than its line
+                if (t < 0.f || t > 1.f || b + 2.f * a * t <= 0.f)
+                        continue;
+                Vector2 e = Vector2Add(e0, Vector2Scale(de, t));
+                Vector2 q = Vector2Add(q0, Vector2Scale(dq, t));
+                float l2 = Vector2LengthSqr(e);
+                if (l2 == 0.f)
+                        continue;
+                float u = Vector2DotProduct(q, e) / l2;
+                if (u < 0.f || u > 1.f)
+                        continue;
+                *toi = t;
+                *edge_t = u;
+                return true;
+        }
+        return false;
+}
+
+static BB sweptBB(Vector2 a0, Vector2 a1, Vector2 b0, Vector2 b1) {
+        return (BB){Vector2Min(Vector2Min(a0, a1), Vector2Min(b0, b1)), Vector2Max(Vector2Max(a0, a1), Vector2Max(b0, b1))};
+}
+
+// Every point of A against every surface of B, keeping each point's
+// earliest hit that counts. That's nA * nB sweeps, but it's only for the
+// few pairs moving fast enough to need it
+static void sweepPoints(SoftBody A, const Vector2 *fromA, SoftBody B, const Vector2 *fromB, float depth, PointHit *hits) {
+        for (int i = 0; i < A.numPoints; i++) {
+                hits[i] = (PointHit){.toi = INFINITY, .edge = -1};
+                Vector2 p0 = fromA[i];
+                Vector2 p1 = A.pointPos[i];
+                BB path = sweptBB(p0, p1, p0, p1);
+                for (int surf = 0; surf < B.numSurfaces; surf++) {
+                        int sa = B.surfaceA[surf];
+                        int sb = B.surfaceB[surf];
+                        Vector2 a1 = B.pointPos[sa];
+                        Vector2 b1 = B.pointPos[sb];
+                        BB swept = sweptBB(fromB[sa], a1, fromB[sb], b1);
+                        if (path.max.x < swept.min.x || path.max.y < swept.min.y || path.min.x > swept.max.x || path.min.y > swept.max.y)
+                                continue;
+                        float toi, t;
+                        if (!sweepPoint(p0, p1, fromB[sa], a1, fromB[sb], b1, &toi, &t) || toi >= hits[i].toi)
+                                continue;
+                        // How far in behind this surface it ends up. Not far
+                        // and checkCollision can push it back out this side
+                        Vector2 e = Vector2Subtract(b1, a1);
+                        float l = Vector2Length(e);
+                        if (l == 0.f || cross(e, Vector2Subtract(p1, a1)) / l <= depth)
+                                continue;
+                        hits[i] = (PointHit){toi, surf, t};
+                }
+        }
+}
+
+// Turns every point of A that hits within CCD_SLOP of toi into a contact,
+// with B as it'll be at toi
+static int impactContacts(SoftBody A, SoftBody B, const Vector2 *fromB, bool invert, float toi, const PointHit *hits, Contact *contacts,
+                          int num, int maxContacts) {
+        for (int i = 0; i < A.numPoints; i++) {
+                if (hits[i].edge < 0 || hits[i].toi > toi + CCD_SLOP)
+                        continue;
+                int surf = hits[i].edge;
+                Vector2 p1 = Vector2Lerp(fromB[B.surfaceA[surf]], B.pointPos[B.surfaceA[surf]], toi);
+                Vector2 p2 = Vector2Lerp(fromB[B.surfaceB[surf]], B.pointPos[B.surfaceB[surf]], toi);
+                Contact c = {
+                    .invert = invert,
+                    .point = i,
+                    .edge = surf,
+                    .edge_t = hits[i].edge_t,
+                    .normal = Vector2Normalize((Vector2){p2.y - p1.y, p1.x - p2.x}),
+                    .nearest = Vector2Lerp(p1, p2, hits[i].edge_t),
+                };
+                if (num < maxContacts)
+                        contacts[num++] = c;
+        }
+        return num;
+}
+
+float timeOfImpact(SoftBody A, const Vector2 *fromA, SoftBody B, const Vector2 *fromB, float depthA, float depthB, PointHit *hits,
+                   Contact *contacts, int maxContacts, int *numContacts) {
+        sweepPoints(A, fromA, B, fromB, depthB, hits);
+        sweepPoints(B, fromB, A, fromA, depthA, hits + A.numPoints);
+
+        float toi = 1.f;
+        for (int i = 0; i < A.numPoints + B.numPoints; i++) {
+                if (hits[i].toi < toi)
+                        toi = hits[i].toi;
+        }
+        *numContacts = 0;
+        if (toi < 1.f) {
+                *numContacts = impactContacts(A, B, fromB, false, toi, hits, contacts, 0, maxContacts);
+                *numContacts = impactContacts(B, A, fromA, true, toi, hits + A.numPoints, contacts, *numContacts, maxContacts);
+        }
+        return toi;
 }
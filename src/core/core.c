@@ -4,10 +4,96 @@
 #include <raymath.h>
 
 Vector2 applyTransform(Transform2D transform, Vector2 v) {
-        float sinA = sin(transform.rotation);
-        float cosA = cos(transform.rotation);
+        float sinA, cosA;
+        detSinCos(transform.rotation, &sinA, &cosA);
         return (Vector2){
             transform.position.x + (v.x * cosA - v.y * sinA),
             transform.position.y + (v.x * sinA + v.y * cosA),
         };
 }
+
+void detSinCos(float x, float *s, float *c) {
+        // Down to [-pi/4, pi/4] by whole quarter turns. The quarter turn is
+        // split in two, with few enough bits in the first part that k times
+        // it is exact, so the reduction doesn't lose x's low bits
+        float q = x * 0.636619772f; // 2 / pi
+        int k = (int)(q >= 0.f ? q + 0.5f : q - 0.5f);
+        float r = (x - k * 1.5703125f) - k * 4.83826795e-4f;
+
+        // Taylor, the first term left out is under 1e-8 out here
+        float r2 = r * r;
+        float sr = r + r * r2 * (-1.f / 6.f + r2 * (1.f / 120.f + r2 * (-1.f / 5040.f + r2 * (1.f / 362880.f))));
+        float cr = 1.f + r2 * (-0.5f + r2 * (1.f / 24.f + r2 * (-1.f / 720.f + r2 * (1.f / 40320.f))));
+
+        switch (k & 3) {
+        case 0:
+                *s = sr;
+                *c = cr;
+                break;
+        case 1:
+                *s = cr;
+                *c = -sr;
+                break;
+        case 2:
+                *s = -sr;
+                *c = -cr;
+                break;
+        default:
+                *s = -cr;
+                *c = sr;
+                break;
+        }
+}
+
+float detSin(float x) {
+        float s, c;
+        detSinCos(x, &s, &c);
+        return s;
+}
+
+float detCos(float x) {
+        float s, c;
+        detSinCos(x, &s, &c);
+        return c;
+}
+
+float detAtan2(float y, float x) {
+        float ax = fabsf(x);
+        float ay = fabsf(y);
+        float hi = ax > ay ? ax : ay;
+        float lo = ax > ay ? ay : ax;
+
+        // atan on [0, 1], minimax odd polynomial
+        float a = hi > 0.f ? lo / hi : 0.f;
+        float s = a * a;
+        float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+
+        // Then back out to the right octant
+        if (ay > ax)
+                r = 1.57079637f - r;
+        // Going by the sign bits, so the zeros come out like libm's too
+        if (signbit(x))
+                r = 3.14159274f - r;
+        return signbit(y) ? -r : r;
+}
+
+float detPow(float x, float y) {
+        // log2(x): frexp splits off the exponent exactly, then the mantissa
+        // m in [sqrt(1/2), sqrt(2)) goes through ln m = 2 atanh((m - 1) / (m + 1))
+        int e;
+        float m = frexpf(x, &e);
+        if (m < 0.70710678f) {
+                m *= 2.f;
+                e--;
+        }
+        float t = (m - 1.f) / (m + 1.f);
+        float t2 = t * t;
+        float lnm = 2.f * t * (1.f + t2 * (1.f / 3.f + t2 * (1.f / 5.f + t2 * (1.f / 7.f + t2 * (1.f / 9.f)))));
+        float z = y * (e + lnm * 1.44269504f);
+
+        // 2^z: ldexp for the whole part, Taylor of e^(f ln 2) for the rest
+        float n = floorf(z);
+        float g = (z - n) * 0.693147181f;
+        float p = 1.f + g * (1.f + g * (0.5f + g * (1.f / 6.f + g * (1.f / 24.f + g * (1.f / 120.f + g * (1.f / 720.f + g * (1.f / 5040.f)))))));
+        return ldexpf(p, (int)n);
+}
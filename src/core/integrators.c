@@ -0,0 +1,584 @@
+#include <core/core.h>
+#include <core/simd.h>
+#include <core/world.h>
+#include <math.h>
+#include <string.h>
+
+// Every integrator works on the whole packed arrays, but only ever touches
+// its range of them, and world->stage is laid out the same way. So ranges
+// on different threads never write to the same memory
+
+void integrate_RK4(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        int p0 = r.pointBegin;
+
+        // Same as update_SoftBody, just over every body in the range at once
+        Vector2 *arenaAlloc = world->stage;
+
+        Vector2 *k1, *k2, *k3, *k4, *final;
+        SBPoints ogpoints, newpoints;
+
+        ogpoints = (SBPoints){
+            .num = n,
+            .pos = arenaAlloc + 0 * n,
+            .vel = arenaAlloc + 1 * n,
+        };
+        gather_PhysicsWorld(world, r, ogpoints);
+        k1 = arenaAlloc + 2 * n;
+        calcForces_PhysicsWorld(k1, world, r, ogpoints);
+
+        newpoints = (SBPoints){
+            .num = n,
+            .pos = arenaAlloc + 3 * n,
+            .vel = arenaAlloc + 4 * n,
+        };
+
+        projectSB_PhysicsWorld(world, r, &newpoints, ogpoints, k1, dt * 0.5);
+        k2 = arenaAlloc + 5 * n;
+        calcForces_PhysicsWorld(k2, world, r, newpoints);
+
+        projectSB_PhysicsWorld(world, r, &newpoints, ogpoints, k2, dt * 0.5);
+        k3 = arenaAlloc + 6 * n;
+        calcForces_PhysicsWorld(k3, world, r, newpoints);
+
+        projectSB_PhysicsWorld(world, r, &newpoints, ogpoints, k3, dt);
+        k4 = arenaAlloc + 7 * n;
+        calcForces_PhysicsWorld(k4, world, r, newpoints);
+        final = arenaAlloc + 8 * n;
+        getSimdKernels()->rk4Combine((float *)(final + p0), (float *)(k1 + p0), (float *)(k2 + p0), (float *)(k3 + p0), (float *)(k4 + p0),
+                                     2 * (r.pointEnd - p0), 0.16666f, 0.33333f);
+
+        projectSB_PhysicsWorld(world, r, &newpoints, ogpoints, final, dt);
+        scatter_PhysicsWorld(world, r, newpoints);
+}
+
+void integrate_SymplecticEuler(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        Vector2 *arenaAlloc = world->stage;
+
+        SBPoints ogpoints = {.num = n, .pos = arenaAlloc + 0 * n, .vel = arenaAlloc + 1 * n};
+        SBPoints newpoints = {.num = n, .pos = arenaAlloc + 3 * n, .vel = arenaAlloc + 4 * n};
+        Vector2 *forces = arenaAlloc + 2 * n;
+
+        gather_PhysicsWorld(world, r, ogpoints);
+        calcForces_PhysicsWorld(forces, world, r, ogpoints);
+        // projectSB already does velocity first, then position with the new velocity,
+        // which is exactly semi-implicit Euler
+        projectSB_PhysicsWorld(world, r, &newpoints, ogpoints, forces, dt);
+        scatter_PhysicsWorld(world, r, newpoints);
+}
+
+void integrate_Verlet(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        int p0 = r.pointBegin;
+        Vector2 *arenaAlloc = world->stage;
+
+        SBPoints points = {.num = n, .pos = arenaAlloc + 0 * n, .vel = arenaAlloc + 1 * n};
+        Vector2 *forces = arenaAlloc + 2 * n;
+        gather_PhysicsWorld(world, r, points);
+
+        // The cached forces are stale if we weren't the ones stepping last time
+        if (!world->lastForcesValid || world->lastIntegrator != Integrator_Verlet) {
+                memset(world->lastForces + p0, 0, sizeof(Vector2) * (r.pointEnd - p0));
+                calcForces_PhysicsWorld(world->lastForces, world, r, points);
+        }
+
+        float halfDt = dt * 0.5f;
+        // Kick, drift
+        for (int i = p0; i < r.pointEnd; i++) {
+                float s = halfDt * world->pointInvMass[2 * i];
+                points.vel[i] = Vector2Add(points.vel[i], Vector2Scale(world->lastForces[i], s));
+                points.pos[i] = Vector2Add(points.pos[i], Vector2Scale(points.vel[i], dt));
+        }
+        // Forces are velocity dependent (damping, drag), so they only get
+        // the half-step velocity here. Close enough, and it's the usual trade-off
+        calcForces_PhysicsWorld(forces, world, r, points);
+        // Kick
+        for (int i = p0; i < r.pointEnd; i++) {
+                float s = halfDt * world->pointInvMass[2 * i];
+                points.vel[i] = Vector2Add(points.vel[i], Vector2Scale(forces[i], s));
+        }
+        // update_PhysicsWorld marks these valid once every range is done
+        memcpy(world->lastForces + p0, forces + p0, sizeof(Vector2) * (r.pointEnd - p0));
+
+        scatter_PhysicsWorld(world, r, points);
+}
+
+/* XPBD */
+// Small-steps flavour: lots of substeps with a single constraint iteration
+// each, so the lagrange multipliers never need to be carried between
+// iterations and just start at 0 every substep.
+
+static void solveSprings_XPBD(PhysicsWorld *world, WorldRange r, SBPoints points, float h) {
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                BodyParams *p = &world->params[world->springBody[i]];
+                if (p->springStrength <= 0.f)
+                        continue;
+                int a_idx = world->springA[i];
+                int b_idx = world->springB[i];
+                float wa = world->pointInvMass[2 * a_idx];
+                float wb = world->pointInvMass[2 * b_idx];
+
+                Vector2 diff = Vector2Subtract(points.pos[a_idx], points.pos[b_idx]);
+                float length = Vector2Length(diff);
+                if (length == 0.f)
+                        continue;
+                Vector2 n = Vector2Scale(diff, 1.f / length);
+                float C = length - world->lengths[i];
+
+                float alpha = 1.f / (p->springStrength * h * h);
+                float dLambda = -C / (wa + wb + alpha);
+
+                points.pos[a_idx] = Vector2Add(points.pos[a_idx], Vector2Scale(n, wa * dLambda));
+                points.pos[b_idx] = Vector2Subtract(points.pos[b_idx], Vector2Scale(n, wb * dLambda));
+        }
+}
+
+static void solveShape_XPBD(PhysicsWorld *world, WorldRange r, SBPoints points, float h) {
+        calcShapes_PhysicsWorld(world, r, points);
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                BodyParams *p = &world->params[b];
+                if (!(p->type & SoftBodyType_Shape) || p->shapeSpringStrength <= 0.f)
+                        continue;
+                // Each point has a zero-length spring to its goal, and the goal
+                // is treated as infinitely heavy. So each point moves
+                // w / (w + alpha) of the way there, which is pullToShape with
+                // the positions standing in for the forces
+                float w = p->invMass;
+                float alpha = 1.f / (p->shapeSpringStrength * h * h);
+                float k = w / (w + alpha);
+                int start = world->bodyStart[b];
+                int num = world->bodyStart[b + 1] - start;
+                if (world->bodyClusterStart[b] == world->bodyClusterStart[b + 1]) {
+                        pullToShape(points.pos + start, world->shape + start, points.pos + start, NULL, num, world->bodyFrame[b], (Vector2){0, 0}, k);
+                        continue;
+                }
+                for (int c = world->bodyClusterStart[b]; c < world->bodyClusterStart[b + 1]; c++) {
+                        ShapeCluster cluster = world->clusters[c];
+                        pullToShape(points.pos, world->shape, points.pos, world->clusterPoints + cluster.begin, cluster.end - cluster.begin,
+                                    world->clusterFrame[c], cluster.restCenter, k);
+                }
+        }
+}
+
+// Spring damping done implicitly on the relative velocity along each spring,
+// so it can't overshoot no matter how big springDamp is
+static void dampSprings_XPBD(PhysicsWorld *world, WorldRange r, SBPoints points, float h) {
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                BodyParams *p = &world->params[world->springBody[i]];
+                int a_idx = world->springA[i];
+                int b_idx = world->springB[i];
+                float wa = world->pointInvMass[2 * a_idx];
+                float wb = world->pointInvMass[2 * b_idx];
+
+                Vector2 diff = Vector2Subtract(points.pos[a_idx], points.pos[b_idx]);
+                float length = Vector2Length(diff);
+                if (length == 0.f)
+                        continue;
+                Vector2 n = Vector2Scale(diff, 1.f / length);
+                float relVel = Vector2DotProduct(Vector2Subtract(points.vel[b_idx], points.vel[a_idx]), n);
+                float ch = p->springDamp * h;
+                float j = ch * relVel / (1.f + ch * (wa + wb));
+
+                points.vel[a_idx] = Vector2Add(points.vel[a_idx], Vector2Scale(n, wa * j));
+                points.vel[b_idx] = Vector2Subtract(points.vel[b_idx], Vector2Scale(n, wb * j));
+        }
+}
+
+void integrate_XPBD(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        int p0 = r.pointBegin;
+        int substeps = world->substeps > 0 ? world->substeps : 1;
+        float h = dt / substeps;
+
+        Vector2 *arenaAlloc = world->stage;
+
+        SBPoints points = {.num = n, .pos = arenaAlloc + 0 * n, .vel = arenaAlloc + 1 * n};
+        Vector2 *prev = arenaAlloc + 2 * n;
+        Vector2 *forces = arenaAlloc + 3 * n;
+        gather_PhysicsWorld(world, r, points);
+
+        for (int s = 0; s < substeps; s++) {
+                // Whatever isn't a constraint is still a force
+                memset(forces + p0, 0, sizeof(Vector2) * (r.pointEnd - p0));
+                calcForce_external_PhysicsWorld(forces, world, r, points);
+
+                // Predict
+                for (int i = p0; i < r.pointEnd; i++) {
+                        prev[i] = points.pos[i];
+                        float sc = h * world->pointInvMass[2 * i];
+                        points.vel[i] = Vector2Add(points.vel[i], Vector2Scale(forces[i], sc));
+                        points.pos[i] = Vector2Add(points.pos[i], Vector2Scale(points.vel[i], h));
+                }
+
+                solveSprings_XPBD(world, r, points, h);
+                solveShape_XPBD(world, r, points, h);
+
+                // Velocities from however far the constraints ended up moving things
+                float invH = 1.f / h;
+                for (int i = p0; i < r.pointEnd; i++) {
+                        points.vel[i] = Vector2Scale(Vector2Subtract(points.pos[i], prev[i]), invH);
+                }
+                dampSprings_XPBD(world, r, points, h);
+        }
+
+        scatter_PhysicsWorld(world, r, points);
+}
+
+/* Implicit */
+// Linearizing f around the current state, with K = -df/dx and C = -df/dv
+// (both made positive semi-definite), backward Euler comes down to
+//   (M + hC + h^2 K) dv = h (f - h K v)
+// which is symmetric positive definite, so CG works on it.
+
+// Fills the ImplicitSpring and ImplicitBody tables
+static void assemble_Implicit(PhysicsWorld *world, WorldRange r, SBPoints points) {
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                world->implicitBodies[b] = (ImplicitBody){0};
+        }
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                ImplicitBody *ib = &world->implicitBodies[world->pointBody[i]];
+                ib->centroid = Vector2Add(ib->centroid, points.pos[i]);
+        }
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                int num = world->bodyStart[b + 1] - world->bodyStart[b];
+                world->implicitBodies[b].centroid = Vector2Scale(world->implicitBodies[b].centroid, 1.f / num);
+        }
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                ImplicitBody *ib = &world->implicitBodies[world->pointBody[i]];
+                ib->inertia += Vector2DistanceSqr(points.pos[i], ib->centroid);
+        }
+
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                BodyParams *p = &world->params[world->springBody[i]];
+                Vector2 diff = Vector2Subtract(points.pos[world->springA[i]], points.pos[world->springB[i]]);
+                float length = Vector2Length(diff);
+                ImplicitSpring *s = &world->implicitSprings[i];
+                s->n = length > 0.f ? Vector2Scale(diff, 1.f / length) : (Vector2){1.f, 0.f};
+                s->k = p->springStrength;
+                // The sideways stiffness of a compressed spring is negative,
+                // which would make the system indefinite, so just drop it
+                float perp = length > 0.f ? 1.f - world->lengths[i] / length : 0.f;
+                s->kPerp = perp > 0.f ? p->springStrength * perp : 0.f;
+                s->c = p->springDamp;
+        }
+}
+
+// out += K v (kScale) + C v (cScale)
+static void springProduct_Implicit(PhysicsWorld *world, WorldRange r, SBPoints points, Vector2 *out, const Vector2 *v, float kScale, float cScale) {
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                ImplicitSpring *s = &world->implicitSprings[i];
+                int a_idx = world->springA[i];
+                int b_idx = world->springB[i];
+                Vector2 u = Vector2Subtract(v[a_idx], v[b_idx]);
+                float un = Vector2DotProduct(s->n, u);
+                Vector2 along = Vector2Scale(s->n, un);
+                Vector2 stiff = Vector2Add(Vector2Scale(along, s->k), Vector2Scale(Vector2Subtract(u, along), s->kPerp));
+                Vector2 f = Vector2Add(Vector2Scale(stiff, kScale), Vector2Scale(along, s->c * cScale));
+                out[a_idx] = Vector2Add(out[a_idx], f);
+                out[b_idx] = Vector2Subtract(out[b_idx], f);
+        }
+
+        // Shape matching. If the goal stayed put this would just be ks on the
+        // diagonal, but it follows the body around, so moving or spinning the
+        // whole thing doesn't stretch anything. Take those out first.
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                world->implicitBodies[b].meanV = (Vector2){0, 0};
+                world->implicitBodies[b].spin = 0.f;
+        }
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                ImplicitBody *ib = &world->implicitBodies[world->pointBody[i]];
+                Vector2 rel = Vector2Subtract(points.pos[i], ib->centroid);
+                ib->meanV = Vector2Add(ib->meanV, v[i]);
+                ib->spin += rel.x * v[i].y - rel.y * v[i].x;
+        }
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                int num = world->bodyStart[b + 1] - world->bodyStart[b];
+                ImplicitBody *ib = &world->implicitBodies[b];
+                ib->meanV = Vector2Scale(ib->meanV, 1.f / num);
+                ib->spin = ib->inertia > 0.f ? ib->spin / ib->inertia : 0.f;
+        }
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                int b = world->pointBody[i];
+                BodyParams *p = &world->params[b];
+                if (!(p->type & SoftBodyType_Shape))
+                        continue;
+                ImplicitBody *ib = &world->implicitBodies[b];
+                Vector2 rel = Vector2Subtract(points.pos[i], ib->centroid);
+                Vector2 rigid = {ib->meanV.x - ib->spin * rel.y, ib->meanV.y + ib->spin * rel.x};
+                out[i] = Vector2Add(out[i], Vector2Scale(Vector2Subtract(v[i], rigid), p->shapeSpringStrength * kScale));
+        }
+}
+
+// out = (M + hC + h^2 K) v
+static void systemProduct_Implicit(PhysicsWorld *world, WorldRange r, SBPoints points, Vector2 *out, const Vector2 *v, float h) {
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                out[i] = Vector2Scale(v[i], world->params[world->pointBody[i]].mass);
+        }
+        springProduct_Implicit(world, r, points, out, v, h * h, h);
+}
+
+static float dot_Implicit(const Vector2 *a, const Vector2 *b, WorldRange r) {
+        float sum = 0.f;
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                sum += a[i].x * b[i].x + a[i].y * b[i].y;
+        }
+        return sum;
+}
+
+// Bodies don't couple while integrating, so each range gets its own solve.
+// A range only converges as slowly as its worst body, not the whole world's
+int integrate_Implicit(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        int p0 = r.pointBegin;
+        int p1 = r.pointEnd;
+        float h = dt;
+        Vector2 *arenaAlloc = world->stage;
+
+        SBPoints points = {.num = n, .pos = arenaAlloc + 0 * n, .vel = arenaAlloc + 1 * n};
+        Vector2 *rhs = arenaAlloc + 2 * n;
+        Vector2 *res = arenaAlloc + 3 * n;
+        Vector2 *z = arenaAlloc + 4 * n;
+        Vector2 *p = arenaAlloc + 5 * n;
+        Vector2 *Ap = arenaAlloc + 6 * n;
+        Vector2 *invDiag = arenaAlloc + 7 * n;
+        Vector2 *dv = world->lastDv;
+
+        gather_PhysicsWorld(world, r, points);
+        assemble_Implicit(world, r, points);
+
+        // rhs = h (f - h K v)
+        calcForces_PhysicsWorld(rhs, world, r, points);
+        memset(Ap + p0, 0, sizeof(Vector2) * (p1 - p0));
+        springProduct_Implicit(world, r, points, Ap, points.vel, 1.f, 0.f);
+        for (int i = p0; i < p1; i++) {
+                rhs[i] = Vector2Scale(Vector2Subtract(rhs[i], Vector2Scale(Ap[i], h)), h);
+        }
+
+        // Jacobi preconditioner, the diagonal of the system
+        for (int i = p0; i < p1; i++) {
+                int b = world->pointBody[i];
+                BodyParams *bp = &world->params[b];
+                Vector2 d = {bp->mass, bp->mass};
+                if (bp->type & SoftBodyType_Shape) {
+                        ImplicitBody *ib = &world->implicitBodies[b];
+                        int num = world->bodyStart[b + 1] - world->bodyStart[b];
+                        Vector2 rel = Vector2Subtract(points.pos[i], ib->centroid);
+                        float invI = ib->inertia > 0.f ? 1.f / ib->inertia : 0.f;
+                        float ks = h * h * bp->shapeSpringStrength;
+                        d.x += ks * (1.f - 1.f / num - rel.y * rel.y * invI);
+                        d.y += ks * (1.f - 1.f / num - rel.x * rel.x * invI);
+                }
+                invDiag[i] = d;
+        }
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                ImplicitSpring *s = &world->implicitSprings[i];
+                float nx2 = s->n.x * s->n.x;
+                float ny2 = s->n.y * s->n.y;
+                Vector2 d = {
+                    h * h * (s->k * nx2 + s->kPerp * (1.f - nx2)) + h * s->c * nx2,
+                    h * h * (s->k * ny2 + s->kPerp * (1.f - ny2)) + h * s->c * ny2,
+                };
+                invDiag[world->springA[i]] = Vector2Add(invDiag[world->springA[i]], d);
+                invDiag[world->springB[i]] = Vector2Add(invDiag[world->springB[i]], d);
+        }
+        for (int i = p0; i < p1; i++) {
+                invDiag[i] = (Vector2){1.f / invDiag[i].x, 1.f / invDiag[i].y};
+        }
+
+        // Last step's answer is usually a good guess, unless it's from someone else
+        if (world->lastIntegrator != Integrator_Implicit)
+                memset(dv + p0, 0, sizeof(Vector2) * (p1 - p0));
+
+        // res = rhs - A dv
+        systemProduct_Implicit(world, r, points, Ap, dv, h);
+        for (int i = p0; i < p1; i++) {
+                res[i] = Vector2Subtract(rhs[i], Ap[i]);
+                z[i] = (Vector2){res[i].x * invDiag[i].x, res[i].y * invDiag[i].y};
+                p[i] = z[i];
+        }
+        float rz = dot_Implicit(res, z, r);
+        float threshold = world->cgTolerance * world->cgTolerance * dot_Implicit(rhs, rhs, r);
+
+        int iter = 0;
+        while (iter < world->cgMaxIterations && dot_Implicit(res, res, r) > threshold) {
+                systemProduct_Implicit(world, r, points, Ap, p, h);
+                float pAp = dot_Implicit(p, Ap, r);
+                if (pAp <= 0.f)
+                        break;
+                float alpha = rz / pAp;
+                for (int i = p0; i < p1; i++) {
+                        dv[i] = Vector2Add(dv[i], Vector2Scale(p[i], alpha));
+                        res[i] = Vector2Subtract(res[i], Vector2Scale(Ap[i], alpha));
+                        z[i] = (Vector2){res[i].x * invDiag[i].x, res[i].y * invDiag[i].y};
+                }
+                float rzNew = dot_Implicit(res, z, r);
+                float beta = rzNew / rz;
+                rz = rzNew;
+                for (int i = p0; i < p1; i++) {
+                        p[i] = Vector2Add(z[i], Vector2Scale(p[i], beta));
+                }
+                iter++;
+        }
+
+        for (int i = p0; i < p1; i++) {
+                points.vel[i] = Vector2Add(points.vel[i], dv[i]);
+                points.pos[i] = Vector2Add(points.pos[i], Vector2Scale(points.vel[i], h));
+        }
+        scatter_PhysicsWorld(world, r, points);
+        return iter;
+}
+
+/* Adaptive */
+// Dormand-Prince 5(4). The forces don't depend on time, so the c column of
+// the tableau isn't needed. The last stage is evaluated at the 5th order
+// answer itself (a's last row is b), so an accepted step's last forces are
+// the next step's first ones for free
+#define DP_STAGES 7
+
+static const float dpA[DP_STAGES][DP_STAGES - 1] = {
+    {0},
+    {1.f / 5.f},
+    {3.f / 40.f, 9.f / 40.f},
+    {44.f / 45.f, -56.f / 15.f, 32.f / 9.f},
+    {19372.f / 6561.f, -25360.f / 2187.f, 64448.f / 6561.f, -212.f / 729.f},
+    {9017.f / 3168.f, -355.f / 33.f, 46732.f / 5247.f, 49.f / 176.f, -5103.f / 18656.f},
+    {35.f / 384.f, 0.f, 500.f / 1113.f, 125.f / 192.f, -2187.f / 6784.f, 11.f / 84.f},
+};
+// 5th order weights minus the embedded 4th order ones
+static const float dpE[DP_STAGES] = {
+    71.f / 57600.f, 0.f, -71.f / 16695.f, 71.f / 1920.f, -17253.f / 339200.f, 22.f / 525.f, -1.f / 40.f,
+};
+
+static bool finitePoints(SBPoints points, int p0, int p1) {
+        for (int i = p0; i < p1; i++) {
+                if (!isfinite(points.pos[i].x) || !isfinite(points.pos[i].y) || !isfinite(points.vel[i].x) || !isfinite(points.vel[i].y))
+                        return false;
+        }
+        return true;
+}
+
+void integrate_Adaptive(PhysicsWorld *world, WorldRange r, float dt) {
+        int n = world->numPoints;
+        Vector2 *arenaAlloc = world->stage;
+
+        SBPoints points = {.num = n, .pos = arenaAlloc + 0 * n, .vel = arenaAlloc + 1 * n};
+        SBPoints stage = {.num = n, .pos = arenaAlloc + 2 * n, .vel = arenaAlloc + 3 * n};
+        // Stage s's derivatives: velocities (dx/dt) and forces (m dv/dt)
+        Vector2 *kx[DP_STAGES];
+        Vector2 *kv[DP_STAGES];
+        for (int s = 0; s < DP_STAGES; s++) {
+                kx[s] = arenaAlloc + (4 + s) * n;
+                kv[s] = arenaAlloc + (4 + DP_STAGES + s) * n;
+        }
+        gather_PhysicsWorld(world, r, points);
+
+        float minStep = dt / (world->adaptiveMaxSteps > 0 ? world->adaptiveMaxSteps : 1);
+        // Velocity errors get weighed by how far they'd move a point over
+        // the frame, so one tolerance covers both
+        float invTol = 1.f / world->adaptiveTolerance;
+
+        // Every body is stepped on its own so it can go at its own pace
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                WorldRange body = PhysicsWorld_range(world, b, b + 1);
+                int p0 = body.pointBegin;
+                int p1 = body.pointEnd;
+                float invMass = world->params[b].invMass;
+
+                float want = world->bodyStep[b] > 0.f ? world->bodyStep[b] : dt;
+                float t = 0.f;
+                int steps = 0;
+                int rejected = 0;
+                bool haveFirst = false;
+                while (t < dt) {
+                        // Stretch to the end of the frame rather than leave a tiny step for later
+                        bool last = dt - t <= want * 1.01f;
+                        float h = last ? dt - t : want;
+
+                        if (!haveFirst) {
+                                memset(kv[0] + p0, 0, sizeof(Vector2) * (p1 - p0));
+                                calcForces_PhysicsWorld(kv[0], world, body, points);
+                                memcpy(kx[0] + p0, points.vel + p0, sizeof(Vector2) * (p1 - p0));
+                                haveFirst = true;
+                        }
+                        for (int s = 1; s < DP_STAGES; s++) {
+                                for (int i = p0; i < p1; i++) {
+                                        Vector2 dx = {0.f, 0.f};
+                                        Vector2 dv = {0.f, 0.f};
+                                        for (int j = 0; j < s; j++) {
+                                                dx = Vector2Add(dx, Vector2Scale(kx[j][i], dpA[s][j]));
+                                                dv = Vector2Add(dv, Vector2Scale(kv[j][i], dpA[s][j]));
+                                        }
+                                        stage.pos[i] = Vector2Add(points.pos[i], Vector2Scale(dx, h));
+                                        stage.vel[i] = Vector2Add(points.vel[i], Vector2Scale(dv, h * invMass));
+                                }
+                                memset(kv[s] + p0, 0, sizeof(Vector2) * (p1 - p0));
+                                calcForces_PhysicsWorld(kv[s], world, body, stage);
+                                memcpy(kx[s] + p0, stage.vel + p0, sizeof(Vector2) * (p1 - p0));
+                        }
+
+                        // The last stage is the 5th order answer, compare it to the 4th
+                        float err = 0.f;
+                        for (int i = p0; i < p1; i++) {
+                                Vector2 ex = {0.f, 0.f};
+                                Vector2 ev = {0.f, 0.f};
+                                for (int j = 0; j < DP_STAGES; j++) {
+                                        ex = Vector2Add(ex, Vector2Scale(kx[j][i], dpE[j]));
+                                        ev = Vector2Add(ev, Vector2Scale(kv[j][i], dpE[j]));
+                                }
+                                float e = fmaxf(Vector2Length(ex) * h, Vector2Length(ev) * (h * invMass * dt));
+                                // fmaxf would just drop a NaN and keep going
+                                if (isnan(e)) {
+                                        err = INFINITY;
+                                        break;
+                                }
+                                err = fmaxf(err, e * invTol);
+                        }
+
+                        // Usual controller, kept from swinging too far either way
+                        float factor = err > 0.f ? 0.9f * detPow(err, -0.2f) : 5.f;
+                        factor = isfinite(err) ? fminf(5.f, fmaxf(0.2f, factor)) : 0.2f;
+                        // A blown up step fails this, so it just gets tried
+                        // smaller. The smallest step has nothing smaller to
+                        // try, so it goes ahead anyway. The last step of the
+                        // frame gets stretched by up to 1% and can round just
+                        // past minStep, hence the slack
+                        bool accept = err <= 1.f || h <= minStep * 1.01f;
+                        // Unless it came out non-finite, then the body stays
+                        // put for this bit of the frame rather than take that on
+                        if (accept && !(err <= 1.f) && !finitePoints(stage, p0, p1)) {
+                                rejected++;
+                                t = last ? dt : t + h;
+                        } else if (accept) {
+                                memcpy(points.pos + p0, stage.pos + p0, sizeof(Vector2) * (p1 - p0));
+                                memcpy(points.vel + p0, stage.vel + p0, sizeof(Vector2) * (p1 - p0));
+                                // First same as last
+                                Vector2 *swap = kx[0];
+                                kx[0] = kx[DP_STAGES - 1];
+                                kx[DP_STAGES - 1] = swap;
+                                swap = kv[0];
+                                kv[0] = kv[DP_STAGES - 1];
+                                kv[DP_STAGES - 1] = swap;
+                                // Straight to dt, so rounding can't leave a sliver behind
+                                t = last ? dt : t + h;
+                                steps++;
+                                // A step cut short by the end of the frame says
+                                // nothing about whether a longer one would've done
+                                if (h < want)
+                                        want = fmaxf(want, h * factor);
+                                else
+                                        want = h * factor;
+                        } else {
+                                rejected++;
+                                want = h * factor;
+                        }
+                        want = fmaxf(minStep, fminf(want, dt));
+                }
+
+                world->bodyStep[b] = want;
+                world->bodySteps[b] = steps;
+                world->bodyRejected[b] = rejected;
+        }
+
+        scatter_PhysicsWorld(world, r, points);
+}
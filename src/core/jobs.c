@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <core/jobs.h>
+#include <pthread.h>
+#include <raylib.h>
+#include <sched.h>
+
+/* Deque */
+// Straight out of "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Le et al.), minus the resizing since we cap jobs in flight.
+// Everything's seq_cst because it's simpler and this is nowhere near hot
+// enough for the fences to matter
+
+static void initDeque(JobDeque *d) {
+        atomic_init(&d->top, 0);
+        atomic_init(&d->bottom, 0);
+        d->jobs = MemAlloc(sizeof(atomic_int) * JOB_DEQUE_CAPACITY);
+}
+
+// Only while nobody else is in this deque, see JobSystem_parallelFor
+static void pushDeque(JobDeque *d, int job) {
+        long b = atomic_load(&d->bottom);
+        assert(b - atomic_load(&d->top) < JOB_DEQUE_CAPACITY);
+        atomic_store(&d->jobs[b % JOB_DEQUE_CAPACITY], job);
+        atomic_store(&d->bottom, b + 1);
+}
+
+// Owner only. Returns -1 if empty
+static int popDeque(JobDeque *d) {
+        long b = atomic_load(&d->bottom) - 1;
+        atomic_store(&d->bottom, b);
+        long t = atomic_load(&d->top);
+        if (t > b) {
+                atomic_store(&d->bottom, b + 1);
+                return -1;
+        }
+        int job = atomic_load(&d->jobs[b % JOB_DEQUE_CAPACITY]);
+        if (t == b) {
+                // Last one, race the thieves for it
+                if (!atomic_compare_exchange_strong(&d->top, &t, t + 1))
+                        job = -1;
+                atomic_store(&d->bottom, b + 1);
+        }
+        return job;
+}
+
+// Anyone. Returns -1 if empty or we lost a race
+static int stealDeque(JobDeque *d) {
+        long t = atomic_load(&d->top);
+        long b = atomic_load(&d->bottom);
+        if (t >= b)
+                return -1;
+        int job = atomic_load(&d->jobs[t % JOB_DEQUE_CAPACITY]);
+        if (!atomic_compare_exchange_strong(&d->top, &t, t + 1))
+                return -1;
+        return job;
+}
+
+/* Workers */
+
+static void runJob(JobSystem *js, int job, int worker) {
+        int begin = job * js->grain;
+        int end = begin + js->grain < js->count ? begin + js->grain : js->count;
+        js->fn(js->data, begin, end, worker);
+        atomic_fetch_sub(&js->remaining, 1);
+}
+
+// Own deque first, then go looking through everyone else's. Only while a
+// parallelFor has jobs out, and saying so in `searching`, so the next one
+// can't start filling the deques while we're still in them
+static bool tryRunOne(JobSystem *js, int worker) {
+        atomic_fetch_add(&js->searching, 1);
+        int job = -1;
+        if (atomic_load(&js->remaining) > 0) {
+                job = popDeque(&js->deques[worker]);
+                for (int i = 1; job == -1 && i < js->numThreads; i++) {
+                        job = stealDeque(&js->deques[(worker + i) % js->numThreads]);
+                }
+        }
+        atomic_fetch_sub(&js->searching, 1);
+        if (job == -1)
+                return false;
+        runJob(js, job, worker);
+        return true;
+}
+
+typedef struct WorkerArgs {
+        JobSystem *js;
+        int worker;
+} WorkerArgs;
+
+static void *workerMain(void *arg) {
+        WorkerArgs args = *(WorkerArgs *)arg;
+        MemFree(arg);
+        JobSystem *js = args.js;
+        pthread_mutex_t *mutex = js->mutex;
+        pthread_cond_t *cond = js->cond;
+
+        int seen = atomic_load(&js->generation);
+        while (!atomic_load(&js->quit)) {
+                if (tryRunOne(js, args.worker))
+                        continue;
+                // Nothing to do. Spin a little in case more's coming right away,
+                // then go to sleep until the next parallelFor
+                bool found = false;
+                for (int spin = 0; spin < 64 && !found; spin++) {
+                        sched_yield();
+                        found = atomic_load(&js->remaining) > 0 && tryRunOne(js, args.worker);
+                }
+                if (found)
+                        continue;
+                pthread_mutex_lock(mutex);
+                while (atomic_load(&js->generation) == seen && !atomic_load(&js->quit)) {
+                        pthread_cond_wait(cond, mutex);
+                }
+                seen = atomic_load(&js->generation);
+                pthread_mutex_unlock(mutex);
+        }
+        return NULL;
+}
+
+JobSystem *createJobSystem(int numThreads) {
+        if (numThreads < 1)
+                numThreads = 1;
+        JobSystem *js = MemAlloc(sizeof(JobSystem));
+        js->numThreads = numThreads;
+        js->deques = MemAlloc(sizeof(JobDeque) * numThreads);
+        for (int i = 0; i < numThreads; i++) {
+                initDeque(&js->deques[i]);
+        }
+        atomic_init(&js->remaining, 0);
+        atomic_init(&js->searching, 0);
+        atomic_init(&js->generation, 0);
+        atomic_init(&js->quit, false);
+
+        js->mutex = MemAlloc(sizeof(pthread_mutex_t));
+        js->cond = MemAlloc(sizeof(pthread_cond_t));
+        pthread_mutex_init(js->mutex, NULL);
+        pthread_cond_init(js->cond, NULL);
+
+        pthread_t *threads = MemAlloc(sizeof(pthread_t) * numThreads);
+        js->threads = threads;
+        for (int i = 1; i < numThreads; i++) {
+                WorkerArgs *args = MemAlloc(sizeof(WorkerArgs));
+                *args = (WorkerArgs){.js = js, .worker = i};
+                pthread_create(&threads[i - 1], NULL, workerMain, args);
+        }
+        return js;
+}
+
+void freeJobSystem(JobSystem *js) {
+        pthread_mutex_lock(js->mutex);
+        atomic_store(&js->quit, true);
+        pthread_cond_broadcast(js->cond);
+        pthread_mutex_unlock(js->mutex);
+
+        pthread_t *threads = js->threads;
+        for (int i = 1; i < js->numThreads; i++) {
+                pthread_join(threads[i - 1], NULL);
+        }
+        for (int i = 0; i < js->numThreads; i++) {
+                MemFree(js->deques[i].jobs);
+        }
+        pthread_mutex_destroy(js->mutex);
+        pthread_cond_destroy(js->cond);
+        MemFree(js->mutex);
+        MemFree(js->cond);
+        MemFree(js->threads);
+        MemFree(js->deques);
+        MemFree(js);
+}
+
+int JobSystem_numWorkers(JobSystem *js) {
+        return js ? js->numThreads : 1;
+}
+
+void JobSystem_parallelFor(JobSystem *js, int count, int grain, JobRangeFunc fn, void *data) {
+        if (count <= 0)
+                return;
+        if (grain < 1)
+                grain = 1;
+        while ((count + grain - 1) / grain > JOB_DEQUE_CAPACITY) {
+                grain *= 2;
+        }
+
+        if (!js || js->numThreads == 1) {
+                // Same split as the threaded path, just in order
+                for (int begin = 0; begin < count; begin += grain) {
+                        fn(data, begin, begin + grain < count ? begin + grain : count, 0);
+                }
+                return;
+        }
+
+        int numJobs = (count + grain - 1) / grain;
+        js->fn = fn;
+        js->data = data;
+        js->count = count;
+        js->grain = grain;
+        // Every worker gets its own run of consecutive jobs, pushed backwards
+        // so it pops them in order, and stealing (from the other end) only
+        // evens out whoever finishes early. Nobody's in the deques right now,
+        // the last parallelFor waited them all out, and nobody goes in until
+        // remaining says there's something there
+        int n = js->numThreads;
+        for (int w = 0; w < n; w++) {
+                int first = (int)((long)numJobs * w / n);
+                int last = (int)((long)numJobs * (w + 1) / n);
+                for (int job = last - 1; job >= first; job--) {
+                        pushDeque(&js->deques[w], job);
+                }
+        }
+        atomic_store(&js->remaining, numJobs);
+
+        pthread_mutex_lock(js->mutex);
+        atomic_fetch_add(&js->generation, 1);
+        pthread_cond_broadcast(js->cond);
+        pthread_mutex_unlock(js->mutex);
+
+        // Help out until everything, including whatever got stolen, is done
+        // and every worker's back out of the deques
+        while (atomic_load(&js->remaining) > 0 || atomic_load(&js->searching) > 0) {
+                if (!tryRunOne(js, 0))
+                        sched_yield();
+        }
+}
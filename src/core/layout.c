@@ -0,0 +1,205 @@
+#include <core/layout.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct LayoutSpring {
+        int a;
+        int b;
+        float length;
+} LayoutSpring;
+
+typedef struct LayoutSurface {
+        int a;
+        int b;
+} LayoutSurface;
+
+static int compareSprings(const void *l, const void *r) {
+        const LayoutSpring *x = l, *y = r;
+        if (x->a != y->a)
+                return x->a - y->a;
+        return x->b - y->b;
+}
+
+static int compareSurfaces(const void *l, const void *r) {
+        const LayoutSurface *x = l, *y = r;
+        if (x->a != y->a)
+                return x->a - y->a;
+        return x->b - y->b;
+}
+
+// Every point's neighbours through springs and surfaces, point i's being
+// adj[start[i], start[i + 1])
+static void buildAdjacency(SoftBody *sb, int **outStart, int **outAdj) {
+        int n = sb->numPoints;
+        int *start = MemAlloc(sizeof(int) * (n + 1));
+        for (int i = 0; i < sb->numSprings; i++) {
+                start[sb->springA[i] + 1]++;
+                start[sb->springB[i] + 1]++;
+        }
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                start[sb->surfaceA[i] + 1]++;
+                start[sb->surfaceB[i] + 1]++;
+        }
+        for (int i = 0; i < n; i++) {
+                start[i + 1] += start[i];
+        }
+
+        int *adj = MemAlloc(sizeof(int) * (start[n] > 0 ? start[n] : 1));
+        int *fill = MemAlloc(sizeof(int) * n);
+        memcpy(fill, start, sizeof(int) * n);
+        for (int i = 0; i < sb->numSprings; i++) {
+                adj[fill[sb->springA[i]]++] = sb->springB[i];
+                adj[fill[sb->springB[i]]++] = sb->springA[i];
+        }
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                adj[fill[sb->surfaceA[i]]++] = sb->surfaceB[i];
+                adj[fill[sb->surfaceB[i]]++] = sb->surfaceA[i];
+        }
+        MemFree(fill);
+
+        *outStart = start;
+        *outAdj = adj;
+}
+
+// Fills remap with reverse Cuthill-McKee numbering
+static void orderRCM(SoftBody *sb, int *remap) {
+        int n = sb->numPoints;
+        int *start, *adj;
+        buildAdjacency(sb, &start, &adj);
+
+        bool *visited = MemAlloc(sizeof(bool) * n);
+        int *order = MemAlloc(sizeof(int) * n);
+        int head = 0;
+        int tail = 0;
+        while (tail < n) {
+                // Each piece of the graph starts from its lowest degree point,
+                // a cheap stand-in for one on the edge of it
+                int seed = -1;
+                for (int i = 0; i < n; i++) {
+                        if (!visited[i] && (seed == -1 || start[i + 1] - start[i] < start[seed + 1] - start[seed]))
+                                seed = i;
+                }
+                visited[seed] = true;
+                order[tail++] = seed;
+
+                // Breadth first, taking each point's new neighbours lowest degree first
+                while (head < tail) {
+                        int u = order[head++];
+                        int first = tail;
+                        for (int k = start[u]; k < start[u + 1]; k++) {
+                                int v = adj[k];
+                                if (visited[v])
+                                        continue;
+                                visited[v] = true;
+                                int degree = start[v + 1] - start[v];
+                                int j = tail++;
+                                // Insertion sort, there's only ever a few of them
+                                while (j > first && start[order[j - 1] + 1] - start[order[j - 1]] > degree) {
+                                        order[j] = order[j - 1];
+                                        j--;
+                                }
+                                order[j] = v;
+                        }
+                }
+        }
+
+        // The reverse part, which tends to give a smaller profile
+        for (int k = 0; k < n; k++) {
+                remap[order[k]] = n - 1 - k;
+        }
+
+        MemFree(start);
+        MemFree(adj);
+        MemFree(visited);
+        MemFree(order);
+}
+
+// Furthest apart two joined points are, numbered by remap (NULL for as is)
+static int bandwidth(const SoftBody *sb, const int *remap) {
+        int worst = 0;
+        for (int i = 0; i < sb->numSprings; i++) {
+                int a = remap ? remap[sb->springA[i]] : sb->springA[i];
+                int b = remap ? remap[sb->springB[i]] : sb->springB[i];
+                worst = abs(a - b) > worst ? abs(a - b) : worst;
+        }
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                int a = remap ? remap[sb->surfaceA[i]] : sb->surfaceA[i];
+                int b = remap ? remap[sb->surfaceB[i]] : sb->surfaceB[i];
+                worst = abs(a - b) > worst ? abs(a - b) : worst;
+        }
+        return worst;
+}
+
+int bandwidth_SoftBody(const SoftBody *sb) {
+        return bandwidth(sb, NULL);
+}
+
+static void permutePoints(Vector2 *values, Vector2 *tmp, int n, const int *remap) {
+        for (int i = 0; i < n; i++) {
+                tmp[remap[i]] = values[i];
+        }
+        memcpy(values, tmp, sizeof(Vector2) * n);
+}
+
+void optimizeLayout_SoftBody(SoftBody *sb, int *remap) {
+        int n = sb->numPoints;
+        int *newIndex = MemAlloc(sizeof(int) * n);
+        orderRCM(sb, newIndex);
+        // Some builders already number things well, e.g. rectSoftbody's
+        // columns are a tighter band than RCM manages on a truss. Then it's
+        // only the springs and surfaces that need sorting
+        if (bandwidth(sb, newIndex) >= bandwidth(sb, NULL)) {
+                for (int i = 0; i < n; i++) {
+                        newIndex[i] = i;
+                }
+        }
+
+        Vector2 *tmp = MemAlloc(sizeof(Vector2) * n);
+        permutePoints(sb->pointPos, tmp, n, newIndex);
+        permutePoints(sb->pointVel, tmp, n, newIndex);
+        permutePoints(sb->shape, tmp, n, newIndex);
+        MemFree(tmp);
+
+        // A spring pulls both ends the same either way round, so point it
+        // from its lower end to get the sort to group them better
+        LayoutSpring *springs = MemAlloc(sizeof(LayoutSpring) * (sb->numSprings > 0 ? sb->numSprings : 1));
+        for (int i = 0; i < sb->numSprings; i++) {
+                int a = newIndex[sb->springA[i]];
+                int b = newIndex[sb->springB[i]];
+                springs[i] = (LayoutSpring){.a = a < b ? a : b, .b = a < b ? b : a, .length = sb->lengths[i]};
+        }
+        qsort(springs, sb->numSprings, sizeof(LayoutSpring), compareSprings);
+        for (int i = 0; i < sb->numSprings; i++) {
+                sb->springA[i] = springs[i].a;
+                sb->springB[i] = springs[i].b;
+                sb->lengths[i] = springs[i].length;
+        }
+        MemFree(springs);
+
+        // Surfaces have a winding to keep, so they only get sorted
+        LayoutSurface *surfaces = MemAlloc(sizeof(LayoutSurface) * (sb->numSurfaces > 0 ? sb->numSurfaces : 1));
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                surfaces[i] = (LayoutSurface){.a = newIndex[sb->surfaceA[i]], .b = newIndex[sb->surfaceB[i]]};
+        }
+        qsort(surfaces, sb->numSurfaces, sizeof(LayoutSurface), compareSurfaces);
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                sb->surfaceA[i] = surfaces[i].a;
+                sb->surfaceB[i] = surfaces[i].b;
+        }
+        MemFree(surfaces);
+        // The sort renumbered the surfaces
+        buildSurfaceTree_SoftBody(sb);
+
+        if (sb->numClusters > 0)
+                remapPointIndices(sb->clusterPoints, sb->clusters[sb->numClusters - 1].end, newIndex);
+
+        if (remap)
+                memcpy(remap, newIndex, sizeof(int) * n);
+        MemFree(newIndex);
+}
+
+void remapPointIndices(int *indices, int num, const int *remap) {
+        for (int i = 0; i < num; i++) {
+                indices[i] = remap[indices[i]];
+        }
+}
@@ -1,17 +1,22 @@
 #include <assert.h>
 #include <bettermath.h>
+#include <core/core.h>
 #include <core/physics.h>
+#include <core/simd.h>
 #include <stddef.h>
 #include <string.h>
 
-void update_SoftBody(SoftBody *sb, WorldValues worldValues, float dt) {
+void update_SoftBody(SoftBody *sb, SimArena *scratch, WorldValues worldValues, float dt) {
         // Now for the behemoth
 
         // Use arena allocation because I had a suspicious feeling
         // That some sort of memory leak was happening. Also arena alloc is cool.
+        // The arena is owned by the world and outlives the step, so this only
+        // ever hits the heap if this is the biggest body it's seen yet
         int n = sb->numPoints;
 
-        Vector2 *arenaAlloc = MemAlloc(sizeof(Vector2) * n * 9);
+        reset_SimArena(scratch);
+        Vector2 *arenaAlloc = push_SimArena(scratch, n * 9);
 
         Vector2 *k1, *k2, *k3, *k4, *final;
         SBPoints ogpoints, newpoints;
@@ -44,21 +49,20 @@ void update_SoftBody(SoftBody *sb, WorldValues worldValues, float dt) {
         k4 = arenaAlloc + 7 * n;
         calcForces(k4, *sb, newpoints, worldValues);
         final = arenaAlloc + 8 * n;
-        sumForces(n, final, k1, 0.16666f);
-        sumForces(n, final, k2, 0.33333f);
-        sumForces(n, final, k3, 0.33333f);
-        sumForces(n, final, k4, 0.16666f);
+        // Same as sumForces-ing each k in, just in one pass
+        getSimdKernels()->rk4Combine((float *)final, (float *)k1, (float *)k2, (float *)k3, (float *)k4, 2 * n, 0.16666f, 0.33333f);
 
         projectSB(&newpoints, ogpoints, final, dt, sb->invMass);
         apply_SBPoints(sb, newpoints);
 
-        MemFree(arenaAlloc);
-
         SBPos newPos = calcShape(*sb, newpoints);
         sb->shapePosition = newPos.position;
         sb->shapeRotation = newPos.rotation;
 
-        // Update bounding box
+        updateBounds_SoftBody(sb);
+}
+
+void updateBounds_SoftBody(SoftBody *sb) {
         float minx = sb->pointPos[0].x;
         float maxx = minx;
         float miny = sb->pointPos[0].y;
@@ -72,45 +76,290 @@ void update_SoftBody(SoftBody *sb, WorldValues worldValues, float dt) {
         }
         sb->bounds.min = (Vector2){minx, miny};
         sb->bounds.max = (Vector2){maxx, maxy};
+        refitSurfaceTree_SoftBody(sb);
+}
+
+void reserve_SimArena(SimArena *arena, int num) {
+        if (num <= arena->capacity)
+                return;
+        // Contents are kept, but anything pushed before this has moved
+        arena->data = MemRealloc(arena->data, sizeof(Vector2) * num);
+        arena->capacity = num;
+        arena->numAllocs++;
+}
+
+Vector2 *push_SimArena(SimArena *arena, int num) {
+        if (arena->used + num > arena->capacity) {
+                // Grow geometrically so a slowly growing scene doesn't realloc every frame
+                int wanted = arena->used + num;
+                reserve_SimArena(arena, wanted > 2 * arena->capacity ? wanted : 2 * arena->capacity);
+        }
+        Vector2 *block = arena->data + arena->used;
+        arena->used += num;
+        // The force accumulators rely on starting from zero
+        memset(block, 0, sizeof(Vector2) * num);
+        return block;
+}
+
+void reset_SimArena(SimArena *arena) {
+        arena->used = 0;
+}
+
+void free_SimArena(SimArena *arena) {
+        MemFree(arena->data);
+        arena->data = NULL;
+        arena->capacity = 0;
+        arena->used = 0;
 }
 
 void calcForces(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues) {
-        if (sb.type & SoftBodyType_Springs) {
-                calcForce_springs(forces, sb, points, worldValues);
+        ForceBody body = forceBody_SoftBody(&sb);
+        forceKernels[sb.type & 0b111](forces, &body, points, worldValues);
+}
+
+ForceBody forceBody_SoftBody(SoftBody *sb) {
+        return (ForceBody){
+            .firstPoint = 0,
+            .numPoints = sb->numPoints,
+            .shape = sb->shape,
+            .numSprings = sb->numSprings,
+            .springA = sb->springA,
+            .springB = sb->springB,
+            .lengths = sb->lengths,
+            .numSurfaces = sb->numSurfaces,
+            .surfaceA = sb->surfaceA,
+            .surfaceB = sb->surfaceB,
+            .numClusters = sb->numClusters,
+            .clusters = sb->clusters,
+            .clusterPoints = sb->clusterPoints,
+            .mass = sb->mass,
+            .linearDrag = sb->linearDrag,
+            .springStrength = sb->springStrength,
+            .springDamp = sb->springDamp,
+            .shapeSpringStrength = sb->shapeSpringStrength,
+            .nRT = sb->nRT,
+        };
+}
+
+// Every kernel in forceKernels is this with `type` a constant, so all the
+// flag checks fold away. Same math as the calcForce_ functions, except that
+// pressure and drag share one walk over the surfaces (and the edge vector
+// they both need) instead of two
+static inline __attribute__((always_inline)) void calcForces_typed(Vector2 *forces, const ForceBody *body, SBPoints points,
+                                                                   WorldValues worldValues, const int type) {
+        const Vector2 *pos = points.pos;
+        const Vector2 *vel = points.vel;
+
+        if (type & SoftBodyType_Springs) {
+                float strength = body->springStrength;
+                float damp = body->springDamp;
+                for (int i = 0; i < body->numSprings; i++) {
+                        int a_idx = body->springA[i];
+                        int b_idx = body->springB[i];
+                        Vector2 diff = Vector2Subtract(pos[a_idx], pos[b_idx]);
+
+                        float length = Vector2Length(diff);
+                        Vector2 diffNorm = Vector2Scale(diff, 1. / length);
+                        float x = body->lengths[i] - length;
+
+                        float f = strength * x + damp * Vector2DotProduct(Vector2Subtract(vel[b_idx], vel[a_idx]), diffNorm);
+
+                        forces[a_idx] = Vector2Add(forces[a_idx], Vector2Scale(diffNorm, f));
+                        forces[b_idx] = Vector2Add(forces[b_idx], Vector2Scale(diffNorm, -f));
+                }
         }
-        if (sb.type & SoftBodyType_Shape) {
-                calcForce_shape(forces, sb, points, worldValues);
+
+        if (type & SoftBodyType_Shape) {
+                int p0 = body->firstPoint;
+                if (body->numClusters == 0) {
+                        ShapeFrame frame = matchShape(body->shape + p0, (Vector2){0, 0}, pos + p0, NULL, body->numPoints);
+                        pullToShape(forces + p0, body->shape + p0, pos + p0, NULL, body->numPoints, frame, (Vector2){0, 0}, body->shapeSpringStrength);
+                }
+                for (int c = 0; c < body->numClusters; c++) {
+                        ShapeCluster cluster = body->clusters[c];
+                        const int *members = body->clusterPoints + cluster.begin;
+                        int num = cluster.end - cluster.begin;
+                        ShapeFrame frame = matchShape(body->shape, cluster.restCenter, pos, members, num);
+                        pullToShape(forces, body->shape, pos, members, num, frame, cluster.restCenter, body->shapeSpringStrength);
+                }
         }
-        if (sb.type & SoftBodyType_Pressure) {
-                calcForce_pressure(forces, sb, points, worldValues);
+
+        Vector2 gravity = Vector2Scale(worldValues.gravity, body->mass);
+        for (int i = body->firstPoint; i < body->firstPoint + body->numPoints; i++) {
+                forces[i] = Vector2Add(forces[i], gravity);
         }
-        // Now for gravity
-        for (int i = 0; i < points.num; i++) {
-                forces[i] = Vector2Add(forces[i], Vector2Scale(worldValues.gravity, sb.mass));
+
+        // The pressure needs the whole volume before it can push on anything,
+        // so that's one read-only pass first
+        float P = 0.f;
+        if (type & SoftBodyType_Pressure) {
+                float V = 0.f;
+                for (int i = 0; i < body->numSurfaces; i++) {
+                        Vector2 a = pos[body->surfaceA[i]];
+                        Vector2 b = pos[body->surfaceB[i]];
+                        V += a.x * b.y - a.y * b.x;
+                }
+                P = body->nRT / (V * 0.5f);
+        }
+
+        // Kept in double, same as calcForce_drag
+        double dragScale = 0.5 * worldValues.airPressure * body->linearDrag;
+        for (int i = 0; i < body->numSurfaces; i++) {
+                int a = body->surfaceA[i];
+                int b = body->surfaceB[i];
+                Vector2 surface = Vector2Subtract(pos[a], pos[b]);
+                Vector2 surface_outv = (Vector2){-surface.y, surface.x};
+
+                Vector2 f = {0.f, 0.f};
+                if (type & SoftBodyType_Pressure)
+                        f = (Vector2){-surface.y * P, surface.x * P};
+
+                Vector2 velocity = Vector2Scale(Vector2Add(vel[a], vel[b]), 0.5f);
+                float dot = Vector2DotProduct(surface_outv, velocity);
+                if (dot > 0.f) {
+                        float isl = 1.0f / Vector2Length(surface);
+                        float v = sqrtf(Vector2LengthSqr(velocity));
+                        float F_D = dragScale * dot * v * isl;
+                        f = Vector2Add(f, Vector2Scale(surface_outv, -F_D));
+                }
+
+                forces[a] = Vector2Add(forces[a], f);
+                forces[b] = Vector2Add(forces[b], f);
         }
-        calcForce_drag(forces, sb, points, worldValues);
 }
 
+#define FORCE_KERNEL(flags)                                                                                                    \
+        static void calcForces_##flags(Vector2 *forces, const ForceBody *body, SBPoints points, WorldValues worldValues) { \
+                calcForces_typed(forces, body, points, worldValues, flags);                                                    \
+        }
+FORCE_KERNEL(0)
+FORCE_KERNEL(1)
+FORCE_KERNEL(2)
+FORCE_KERNEL(3)
+FORCE_KERNEL(4)
+FORCE_KERNEL(5)
+FORCE_KERNEL(6)
+FORCE_KERNEL(7)
+#undef FORCE_KERNEL
+
+const ForceKernel forceKernels[8] = {
+    calcForces_0,
+    calcForces_1,
+    calcForces_2,
+    calcForces_3,
+    calcForces_4,
+    calcForces_5,
+    calcForces_6,
+    calcForces_7,
+};
+
 SBPos calcShape(SoftBody sb, SBPoints points) { // Recalculate frame center and rotation
-        Vector2 avg_pos = {0, 0};
-        for (int i = 0; i < sb.numPoints; i++) {
-                avg_pos.x += points.pos[i].x;
-                avg_pos.y += points.pos[i].y;
+        // This used to average every point's own angle, which went wrong as
+        // soon as the angles straddled +-pi. The fit below is exact for any rotation
+        ShapeFrame frame = matchShape(sb.shape, (Vector2){0, 0}, points.pos, NULL, sb.numPoints);
+        return (SBPos){
+            .position = frame.center,
+            .rotation = detAtan2(frame.rot.y, frame.rot.x),
+        };
+}
+
+ShapeFrame matchShape(const Vector2 *shape, Vector2 restCenter, const Vector2 *pos, const int *members, int num) {
+        Vector2 center = {0, 0};
+        for (int k = 0; k < num; k++) {
+                int i = members ? members[k] : k;
+                center.x += pos[i].x;
+                center.y += pos[i].y;
         }
-        avg_pos = Vector2Scale(avg_pos, 1.f / sb.numPoints);
-        float avg_rotation = 0;
-        for (int i = 0; i < sb.numPoints; i++) {
-                // TODO: Fix this, as it averages not angles but rotations, but also that might be what we need, idk, put some more analysis/debugging into this line
-                avg_rotation += Vector2Angle(sb.shape[i], Vector2Subtract(points.pos[i], avg_pos));
+        center = Vector2Scale(center, 1.f / num);
+
+        // In 2D the rotation minimizing sum |R q - p|^2 is just the direction
+        // of (sum q.p, sum q x p), with q and p taken about their centroids
+        float dot = 0.f;
+        float cross = 0.f;
+        for (int k = 0; k < num; k++) {
+                int i = members ? members[k] : k;
+                Vector2 q = Vector2Subtract(shape[i], restCenter);
+                Vector2 p = Vector2Subtract(pos[i], center);
+                dot += q.x * p.x + q.y * p.y;
+                cross += q.x * p.y - q.y * p.x;
         }
-        avg_rotation /= sb.numPoints;
+        float len = sqrtf(dot * dot + cross * cross);
+        Vector2 rot = len > 0.f ? (Vector2){dot / len, cross / len} : (Vector2){1.f, 0.f};
 
-        return (SBPos){
-            .position = avg_pos,
-            .rotation = avg_rotation,
+        return (ShapeFrame){.center = center, .rot = rot};
+}
+
+void pullToShape(Vector2 *forces, const Vector2 *shape, const Vector2 *pos, const int *members, int num, ShapeFrame frame, Vector2 restCenter, float k) {
+        float cosA = frame.rot.x;
+        float sinA = frame.rot.y;
+        // goal = R shape + t, folding the rest center into the translation
+        float tx = frame.center.x - (cosA * restCenter.x - sinA * restCenter.y);
+        float ty = frame.center.y - (cosA * restCenter.y + sinA * restCenter.x);
+        if (!members) {
+                getSimdKernels()->shapePull((float *)forces, (const float *)pos, (const float *)shape, 2 * num, cosA, sinA, tx, ty, k);
+                return;
+        }
+        // Same sums as the kernel, just gathered
+        for (int m = 0; m < num; m++) {
+                int i = members[m];
+                Vector2 q = shape[i];
+                float gx = (cosA * q.x - sinA * q.y) + tx;
+                float gy = (cosA * q.y + sinA * q.x) + ty;
+                forces[i].x = forces[i].x + (gx - pos[i].x) * k;
+                forces[i].y = forces[i].y + (gy - pos[i].y) * k;
+        }
+}
+
+void addCluster_SoftBody(SoftBody *sb, const int *members, int num) {
+        assert(num > 0);
+        int begin = sb->numClusters > 0 ? sb->clusters[sb->numClusters - 1].end : 0;
+        sb->clusterPoints = MemRealloc(sb->clusterPoints, sizeof(int) * (begin + num));
+        sb->clusters = MemRealloc(sb->clusters, sizeof(ShapeCluster) * (sb->numClusters + 1));
+
+        Vector2 restCenter = {0, 0};
+        for (int m = 0; m < num; m++) {
+                sb->clusterPoints[begin + m] = members[m];
+                restCenter = Vector2Add(restCenter, sb->shape[members[m]]);
+        }
+        sb->clusters[sb->numClusters++] = (ShapeCluster){
+            .begin = begin,
+            .end = begin + num,
+            .restCenter = Vector2Scale(restCenter, 1.f / num),
         };
 }
 
+void gridClusters_SoftBody(SoftBody *sb, int cellsX, int cellsY, float overlap) {
+        assert(cellsX > 0 && cellsY > 0);
+        Vector2 min = sb->shape[0];
+        Vector2 max = sb->shape[0];
+        for (int i = 1; i < sb->numPoints; i++) {
+                min = Vector2Min(min, sb->shape[i]);
+                max = Vector2Max(max, sb->shape[i]);
+        }
+        float cellW = (max.x - min.x) / cellsX;
+        float cellH = (max.y - min.y) / cellsY;
+
+        int *members = MemAlloc(sizeof(int) * sb->numPoints);
+        for (int cy = 0; cy < cellsY; cy++) {
+                for (int cx = 0; cx < cellsX; cx++) {
+                        float x0 = min.x + (cx - overlap) * cellW;
+                        float x1 = min.x + (cx + 1 + overlap) * cellW;
+                        float y0 = min.y + (cy - overlap) * cellH;
+                        float y1 = min.y + (cy + 1 + overlap) * cellH;
+                        int num = 0;
+                        for (int i = 0; i < sb->numPoints; i++) {
+                                Vector2 q = sb->shape[i];
+                                if (q.x >= x0 && q.x <= x1 && q.y >= y0 && q.y <= y1)
+                                        members[num++] = i;
+                        }
+                        // Anything less than a triangle doesn't have a rotation to match
+                        if (num >= 3)
+                                addCluster_SoftBody(sb, members, num);
+                }
+        }
+        MemFree(members);
+}
+
 void calcForce_springs(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues) {
         for (int i = 0; i < sb.numSprings; i++) {
                 int a_idx = sb.springA[i];
@@ -163,21 +412,17 @@ void calcForce_springs(Vector2 *forces, SoftBody sb, SBPoints points, WorldValue
 }
 
 void calcForce_shape(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues worldValues) {
-
-        SBPos pos = calcShape(sb, points);
-        Matrix shapeMatrix = MatrixIdentity();
-        float sinA = sinf(pos.rotation);
-        float cosA = cosf(pos.rotation);
-        shapeMatrix.m0 = cosA;
-        shapeMatrix.m1 = sinA;
-        shapeMatrix.m4 = -sinA;
-        shapeMatrix.m5 = cosA;
-
-        for (int i = 0; i < sb.numPoints; i++) {
-                // Calculate distance
-                Vector2 shape_pos = Vector2Add(Vector2Transform(sb.shape[i], shapeMatrix), pos.position);
-                Vector2 diff = Vector2Subtract(shape_pos, points.pos[i]);
-                forces[i] = Vector2Add(forces[i], Vector2Scale(diff, sb.shapeSpringStrength));
+        if (sb.numClusters == 0) {
+                ShapeFrame frame = matchShape(sb.shape, (Vector2){0, 0}, points.pos, NULL, sb.numPoints);
+                pullToShape(forces, sb.shape, points.pos, NULL, sb.numPoints, frame, (Vector2){0, 0}, sb.shapeSpringStrength);
+                return;
+        }
+        for (int c = 0; c < sb.numClusters; c++) {
+                ShapeCluster cluster = sb.clusters[c];
+                const int *members = sb.clusterPoints + cluster.begin;
+                int num = cluster.end - cluster.begin;
+                ShapeFrame frame = matchShape(sb.shape, cluster.restCenter, points.pos, members, num);
+                pullToShape(forces, sb.shape, points.pos, members, num, frame, cluster.restCenter, sb.shapeSpringStrength);
         }
 }
 
@@ -246,10 +491,9 @@ void calcForce_drag(Vector2 *forces, SoftBody sb, SBPoints points, WorldValues w
 }
 
 void projectSB(SBPoints *dest, SBPoints src, Vector2 *forces, float dt, float invMass) {
-        for (int i = 0; i < src.num; i++) {
-                Vector2 newVel = dest->vel[i] = Vector2Add(src.vel[i], Vector2Scale(forces[i], dt * invMass));
-                dest->pos[i] = Vector2Add(src.pos[i], Vector2Scale(newVel, dt));
-        }
+        // newVel = vel + forces * dt * invMass
+        // newPos = pos + newVel * dt
+        getSimdKernels()->project((float *)dest->pos, (float *)dest->vel, (float *)src.pos, (float *)src.vel, (float *)forces, 2 * src.num, dt * invMass, dt);
 }
 
 void SBPoint_addForce(SoftBody *sb, int i, Vector2 force, float dt) {
@@ -302,8 +546,8 @@ void free_SBPoints(SBPoints *points) {
 void circleSoftbody(SoftBody *sb, Vector2 center, float radius, int numPoints) {
 
         float anglePer = TAU / (float)numPoints;
-        float sinA = sin(anglePer);
-        float cosA = cos(anglePer);
+        float sinA, cosA;
+        detSinCos(anglePer, &sinA, &cosA);
         // In-house rotation matrix from rows
         Vector2 row1 = {cosA, -sinA};
         Vector2 row2 = {sinA, cosA};
@@ -329,6 +573,7 @@ void circleSoftbody(SoftBody *sb, Vector2 center, float radius, int numPoints) {
         sb->springB[numPoints - 1] = 0;
 
         _center_sb_shape(sb);
+        buildSurfaceTree_SoftBody(sb);
 }
 
 // Recommended to just do shape matching.
@@ -509,6 +754,7 @@ void rectSoftbody(SoftBody *sb, Vector2 center, Vector2 scale, int detailX, int
         }
 
         _center_sb_shape(sb);
+        buildSurfaceTree_SoftBody(sb);
 }
 
 SoftBody createEmptySoftBody(SoftBodyType type, float mass, float linearDrag, float springStrength, float springDamp, float shapeSpringStrength, float nRT) {
@@ -564,14 +810,26 @@ void freeSoftbody(SoftBody *toFree) {
         MemFree(toFree->springA);
         MemFree(toFree->springB);
         MemFree(toFree->lengths);
+        MemFree(toFree->clusters);
+        MemFree(toFree->clusterPoints);
+        MemFree(toFree->surfaceNodes);
+        MemFree(toFree->surfaceOrder);
+        MemFree(toFree->surfacePrev);
+        MemFree(toFree->surfaceNext);
+        toFree->clusters = NULL;
+        toFree->clusterPoints = NULL;
+        toFree->surfaceNodes = NULL;
+        toFree->surfaceOrder = NULL;
+        toFree->surfacePrev = NULL;
+        toFree->surfaceNext = NULL;
+        toFree->numSurfaceNodes = 0;
+        toFree->numClusters = 0;
         toFree->numPoints = 0;
         toFree->numSprings = 0;
 }
 
 void sumForces(int num, Vector2 *forces, Vector2 *other, float multiplier) {
-        for (int i = 0; i < num; i++) {
-                forces[i] = Vector2Add(forces[i], Vector2Scale(other[i], multiplier));
-        }
+        getSimdKernels()->sum((float *)forces, (float *)other, 2 * num, multiplier);
 }
 
 void applyForce(SoftBody *sb, Vector2 force) {
@@ -49,6 +49,17 @@ void freeRenderer(SoftBodyRenderer *rend) {
 void autogenerateRendererFromSurface(SoftBody sb, SoftBodyRenderer *rend) {
         rend->num = sb.numSurfaces;
         // Assumes the surface is properly connected e.t.c.
+        // Follows it point to point rather than trusting the surfaces to be
+        // in order, since optimizeLayout_SoftBody sorts them
+        int *next = malloc(sizeof(int) * sb.numPoints);
+        for (int i = 0; i < sb.numSurfaces; i++) {
+                next[sb.surfaceA[i]] = sb.surfaceB[i];
+        }
         rend->pts = malloc(sizeof(int) * rend->num);
-        memcpy(rend->pts, sb.surfaceA, sizeof(int) * rend->num);
+        int pt = sb.surfaceA[0];
+        for (int i = 0; i < rend->num; i++) {
+                rend->pts[i] = pt;
+                pt = next[pt];
+        }
+        free(next);
 }
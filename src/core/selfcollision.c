@@ -0,0 +1,271 @@
+#include <assert.h>
+#include <core/broadphase.h>
+#include <core/selfcollision.h>
+#include <math.h>
+#include <string.h>
+
+void freeSelfHash(SelfHash *hash) {
+        MemFree(hash->bucketStart);
+        MemFree(hash->entries);
+        MemFree(hash->pointContact);
+        MemFree(hash->overflow);
+        *hash = (SelfHash){0};
+}
+
+static int cellOf(float x, float cellSize) {
+        float c = x / cellSize;
+        int i = (int)c;
+        return i - (c < (float)i);
+}
+
+// Past this many cells out cellOf's int isn't safe any more
+#define SELF_MAX_COORD 1073741824.f
+
+// Where something went this step
+static BB sweptBox(const Vector2 *from, const Vector2 *to, int a, int b) {
+        return (BB){Vector2Min(Vector2Min(from[a], to[a]), Vector2Min(from[b], to[b])),
+                    Vector2Max(Vector2Max(from[a], to[a]), Vector2Max(from[b], to[b]))};
+}
+
+// The cells box touches, or false if it's too far out (or not finite) to
+// have any. It can still be any number of them
+static bool cellRange(BB box, float cell, CellRange *r) {
+        float x0 = box.min.x / cell, y0 = box.min.y / cell;
+        float x1 = box.max.x / cell, y1 = box.max.y / cell;
+        // NaN fails these too
+        if (!(x0 >= -SELF_MAX_COORD && y0 >= -SELF_MAX_COORD && x1 <= SELF_MAX_COORD && y1 <= SELF_MAX_COORD))
+                return false;
+        *r = (CellRange){cellOf(box.min.x, cell), cellOf(box.min.y, cell), cellOf(box.max.x, cell), cellOf(box.max.y, cell)};
+        return true;
+}
+
+static long long numCells(CellRange r) {
+        return (long long)(r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+}
+
+// Checked on the points themselves, sweptBox's fminf/fmaxf drop NaNs
+static bool finitePoint(const Vector2 *from, const Vector2 *to, int p) {
+        return isfinite(from[p].x) && isfinite(from[p].y) && isfinite(to[p].x) && isfinite(to[p].y);
+}
+
+static int bucketOf(const SelfHash *hash, int x, int y) {
+        unsigned int h = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u);
+        return h & (hash->numBuckets - 1);
+}
+
+static float cross(Vector2 a, Vector2 b) {
+        return a.x * b.y - a.y * b.x;
+}
+
+void reserveSelfHash(SelfHash *hash, int numSurfaces, int numPoints) {
+        int numBuckets = 16;
+        while (numBuckets < 2 * numSurfaces) {
+                numBuckets *= 2;
+        }
+        if (numBuckets > hash->numBuckets) {
+                hash->numBuckets = numBuckets;
+                hash->bucketStart = MemRealloc(hash->bucketStart, sizeof(int) * (numBuckets + 1));
+        }
+        // Points never go in more cells than this, the rest go on overflow
+        if (SELF_MAX_CELLS * numSurfaces > hash->maxEntries) {
+                hash->maxEntries = SELF_MAX_CELLS * numSurfaces;
+                hash->entries = MemRealloc(hash->entries, sizeof(SelfEntry) * hash->maxEntries);
+        }
+        if (numPoints > hash->maxPoints) {
+                hash->maxPoints = numPoints;
+                hash->pointContact = MemRealloc(hash->pointContact, sizeof(int) * numPoints);
+                hash->overflow = MemRealloc(hash->overflow, sizeof(int) * numPoints);
+        }
+}
+
+static bool overlaps(BB a, BB b) {
+        return !(a.max.x < b.min.x || a.max.y < b.min.y || a.min.x > b.max.x || a.min.y > b.max.y);
+}
+
+// One surface's search through the grid
+typedef struct SelfCheck {
+        const SoftBody *sb;
+        const Vector2 *from;
+        Contact *contacts;
+        int maxContacts;
+        int num;
+        int surface;
+        int skip[4]; // The points joined to it
+        BB box;      // Where it went this step
+} SelfCheck;
+
+// Whether p went in through the surface this step, and if so its contact
+static void checkPoint(SelfCheck *check, SelfHash *hash, int p) {
+        const SoftBody *sb = check->sb;
+        int s = check->surface;
+        const Vector2 *from = check->from;
+        int a = sb->surfaceA[s];
+        int b = sb->surfaceB[s];
+        float toi, t;
+        if (!sweepPoint(from[p], sb->pointPos[p], from[a], sb->pointPos[a], from[b], sb->pointPos[b], &toi, &t))
+                return;
+        // Still in behind it now. It might have slid off past an end since
+        // going through, but that's still the surface it has to go back out of
+        Vector2 p1 = sb->pointPos[a];
+        Vector2 e = Vector2Subtract(sb->pointPos[b], p1);
+        Vector2 q = Vector2Subtract(sb->pointPos[p], p1);
+        float l2 = Vector2LengthSqr(e);
+        // Too long to square makes this inf and depth NaN
+        if (l2 == 0.f || !isfinite(l2))
+                return;
+        float u = Clamp(Vector2DotProduct(q, e) / l2, 0.f, 1.f);
+        float depth = cross(e, q) / sqrtf(l2);
+        if (!(depth > 0.f))
+                return;
+
+        Contact c = {
+            .point = p,
+            .edge = s,
+            .edge_t = u,
+            .depth = depth,
+            .normal = Vector2Normalize((Vector2){e.y, -e.x}),
+            .nearest = Vector2Add(p1, Vector2Scale(e, u)),
+        };
+        int *mine = &hash->pointContact[p];
+        if (*mine >= 0) {
+                if (depth < check->contacts[*mine].depth)
+                        check->contacts[*mine] = c;
+        } else if (check->num < check->maxContacts) {
+                *mine = check->num;
+                check->contacts[check->num++] = c;
+        }
+}
+
+static void visitEntry(SelfCheck *check, SelfHash *hash, SelfEntry entry) {
+        int p = entry.point;
+        if (p == check->skip[0] || p == check->skip[1] || p == check->skip[2] || p == check->skip[3])
+                return;
+        BB path = sweptBox(check->from, check->sb->pointPos, p, p);
+        if (!overlaps(check->box, path))
+                return;
+        // The point's in every cell the overlap touches. Only take it in the
+        // one with the overlap's min corner
+        float cell = hash->cellSize;
+        if (cellOf(fmaxf(check->box.min.x, path.min.x), cell) != entry.x || cellOf(fmaxf(check->box.min.y, path.min.y), cell) != entry.y)
+                return;
+        checkPoint(check, hash, p);
+}
+
+int findSelfContacts(SelfHash *hash, const SoftBody *sb, const Vector2 *from, Contact *contacts, int maxContacts) {
+        int n = sb->numSurfaces;
+        // A triangle's surfaces are all joined to each other
+        if (n < 4)
+                return 0;
+        reserveSelfHash(hash, n, sb->numPoints);
+        const Vector2 *to = sb->pointPos;
+
+        // Every surface point starts one surface, so going by surfaceA gets
+        // each of them once. Cells a couple of surfaces across. Anything that
+        // isn't finite has blown up, and there's no sensible contact for it
+        float total = 0.f;
+        int numFinite = 0;
+        for (int s = 0; s < n; s++) {
+                float length = Vector2Distance(to[sb->surfaceA[s]], to[sb->surfaceB[s]]);
+                if (isfinite(length)) {
+                        total += length;
+                        numFinite++;
+                }
+        }
+        float cell = numFinite > 0 ? 2.f * total / numFinite : 0.f;
+        if (!(cell > 0.f) || !isfinite(cell))
+                return 0;
+        hash->cellSize = cell;
+
+        // Counting sort of every (point, cell its path this step touches) by
+        // bucket, same as the broadphase's. A path over more than
+        // SELF_MAX_CELLS cells (or too far out for any) goes on overflow
+        // instead, so entries never outgrows what reserveSelfHash made room for
+        int *start = hash->bucketStart;
+        memset(start, 0, sizeof(int) * (hash->numBuckets + 1));
+        int numEntries = 0;
+        hash->numOverflow = 0;
+        for (int s = 0; s < n; s++) {
+                int p = sb->surfaceA[s];
+                if (!finitePoint(from, to, p))
+                        continue;
+                BB box = sweptBox(from, to, p, p);
+                CellRange r;
+                if (!cellRange(box, cell, &r) || numCells(r) > SELF_MAX_CELLS) {
+                        hash->overflow[hash->numOverflow++] = p;
+                        continue;
+                }
+                for (int y = r.y0; y <= r.y1; y++) {
+                        for (int x = r.x0; x <= r.x1; x++) {
+                                start[bucketOf(hash, x, y) + 1]++;
+                                numEntries++;
+                        }
+                }
+        }
+        assert(numEntries <= hash->maxEntries);
+        for (int k = 0; k < hash->numBuckets; k++) {
+                start[k + 1] += start[k];
+        }
+        for (int s = 0; s < n; s++) {
+                int p = sb->surfaceA[s];
+                BB box = sweptBox(from, to, p, p);
+                CellRange r;
+                if (!finitePoint(from, to, p) || !cellRange(box, cell, &r) || numCells(r) > SELF_MAX_CELLS)
+                        continue;
+                for (int y = r.y0; y <= r.y1; y++) {
+                        for (int x = r.x0; x <= r.x1; x++) {
+                                hash->entries[start[bucketOf(hash, x, y)]++] = (SelfEntry){p, x, y};
+                        }
+                }
+        }
+        memmove(start + 1, start, sizeof(int) * hash->numBuckets);
+        start[0] = 0;
+        for (int i = 0; i < sb->numPoints; i++) {
+                hash->pointContact[i] = -1;
+        }
+
+        SelfCheck check = {.sb = sb, .from = from, .contacts = contacts, .maxContacts = maxContacts};
+        for (int s = 0; s < n; s++) {
+                int a = sb->surfaceA[s];
+                int b = sb->surfaceB[s];
+                check.surface = s;
+                check.skip[0] = a;
+                check.skip[1] = b;
+                check.skip[2] = sb->surfacePrev[s] >= 0 ? sb->surfaceA[sb->surfacePrev[s]] : a;
+                check.skip[3] = sb->surfaceNext[s] >= 0 ? sb->surfaceB[sb->surfaceNext[s]] : b;
+                if (!finitePoint(from, to, a) || !finitePoint(from, to, b))
+                        continue;
+                BB box = check.box = sweptBox(from, to, a, b);
+
+                // Overflow isn't in the grid, so everything checks it
+                for (int i = 0; i < hash->numOverflow; i++) {
+                        int p = hash->overflow[i];
+                        if (p == check.skip[0] || p == check.skip[1] || p == check.skip[2] || p == check.skip[3])
+                                continue;
+                        if (overlaps(box, sweptBox(from, to, p, p)))
+                                checkPoint(&check, hash, p);
+                }
+
+                // Something that went a long way this step can cover more
+                // cells than there are entries, then it's quicker to go
+                // through the entries
+                CellRange r;
+                if (!cellRange(box, cell, &r) || numCells(r) > numEntries) {
+                        for (int i = 0; i < numEntries; i++) {
+                                visitEntry(&check, hash, hash->entries[i]);
+                        }
+                        continue;
+                }
+                for (int y = r.y0; y <= r.y1; y++) {
+                        for (int x = r.x0; x <= r.x1; x++) {
+                                int k = bucketOf(hash, x, y);
+                                for (int i = start[k]; i < start[k + 1]; i++) {
+                                        SelfEntry entry = hash->entries[i];
+                                        // Just sharing the bucket
+                                        if (entry.x == x && entry.y == y)
+                                                visitEntry(&check, hash, entry);
+                                }
+                        }
+                }
+        }
+        return check.num;
+}
@@ -0,0 +1,32 @@
+#include <core/simclock.h>
+
+SimClock createSimClock(float stepsPerSecond, int maxSubsteps) {
+        return (SimClock){
+            .fixedDt = 1.f / stepsPerSecond,
+            .accumulator = 0.f,
+            .maxSubsteps = maxSubsteps,
+            .alpha = 0.f,
+            .lastSteps = 0,
+            .droppedTime = false,
+        };
+}
+
+int SimClock_advance(SimClock *clock, float frameTime) {
+        if (frameTime < 0.f)
+                frameTime = 0.f;
+        clock->accumulator += frameTime;
+
+        int steps = (int)(clock->accumulator / clock->fixedDt);
+        clock->droppedTime = steps > clock->maxSubsteps;
+        if (clock->droppedTime) {
+                steps = clock->maxSubsteps;
+                // Keep less than a step's worth so the next frame doesn't immediately cap again
+                clock->accumulator = 0.f;
+        } else {
+                clock->accumulator -= steps * clock->fixedDt;
+        }
+
+        clock->alpha = clock->accumulator / clock->fixedDt;
+        clock->lastSteps = steps;
+        return steps;
+}
@@ -0,0 +1,233 @@
+#include <core/simd.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Scalar reference */
+
+static void project_scalar(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, int count, float velScale, float dt) {
+        for (int i = 0; i < count; i++) {
+                float newVel = dstVel[i] = srcVel[i] + forces[i] * velScale;
+                dstPos[i] = srcPos[i] + newVel * dt;
+        }
+}
+
+static void projectMasses_scalar(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, const float *invMass, int count, float dt) {
+        for (int i = 0; i < count; i++) {
+                float newVel = dstVel[i] = srcVel[i] + forces[i] * (dt * invMass[i]);
+                dstPos[i] = srcPos[i] + newVel * dt;
+        }
+}
+
+static void sum_scalar(float *dst, const float *src, int count, float multiplier) {
+        for (int i = 0; i < count; i++) {
+                dst[i] = dst[i] + src[i] * multiplier;
+        }
+}
+
+static void rk4Combine_scalar(float *dst, const float *k1, const float *k2, const float *k3, const float *k4, int count, float a, float b) {
+        for (int i = 0; i < count; i++) {
+                float d = dst[i];
+                d = d + k1[i] * a;
+                d = d + k2[i] * b;
+                d = d + k3[i] * b;
+                d = d + k4[i] * a;
+                dst[i] = d;
+        }
+}
+
+// GCC vectorizes the x/y pair below into vfmaddsub when FMA's available, even
+// with -ffp-contract=off, which rounds differently to everything else. Keep it
+// scalar so a -march=native build still agrees with the rest
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-vectorize")))
+#endif
+static void shapePull_scalar(float *forces, const float *pos, const float *shape, int count, float cosA, float sinA, float tx, float ty, float k) {
+        for (int i = 0; i < count; i += 2) {
+                float qx = shape[i];
+                float qy = shape[i + 1];
+                float gx = (cosA * qx - sinA * qy) + tx;
+                float gy = (cosA * qy + sinA * qx) + ty;
+                forces[i] = forces[i] + (gx - pos[i]) * k;
+                forces[i + 1] = forces[i + 1] + (gy - pos[i + 1]) * k;
+        }
+}
+
+#ifdef SIMD_X86
+
+/* SSE, 4 floats (2 points) at a time */
+// Loads are all unaligned since the buffers come from all over (MemAlloc, arenas)
+// and on anything remotely recent loadu on aligned data costs the same anyway
+
+__attribute__((target("sse"))) static void project_sse(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, int count, float velScale, float dt) {
+        __m128 vs = _mm_set1_ps(velScale);
+        __m128 vdt = _mm_set1_ps(dt);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+                __m128 v = _mm_add_ps(_mm_loadu_ps(srcVel + i), _mm_mul_ps(_mm_loadu_ps(forces + i), vs));
+                _mm_storeu_ps(dstVel + i, v);
+                _mm_storeu_ps(dstPos + i, _mm_add_ps(_mm_loadu_ps(srcPos + i), _mm_mul_ps(v, vdt)));
+        }
+        project_scalar(dstPos + i, dstVel + i, srcPos + i, srcVel + i, forces + i, count - i, velScale, dt);
+}
+
+__attribute__((target("sse"))) static void projectMasses_sse(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, const float *invMass, int count, float dt) {
+        __m128 vdt = _mm_set1_ps(dt);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+                __m128 s = _mm_mul_ps(vdt, _mm_loadu_ps(invMass + i));
+                __m128 v = _mm_add_ps(_mm_loadu_ps(srcVel + i), _mm_mul_ps(_mm_loadu_ps(forces + i), s));
+                _mm_storeu_ps(dstVel + i, v);
+                _mm_storeu_ps(dstPos + i, _mm_add_ps(_mm_loadu_ps(srcPos + i), _mm_mul_ps(v, vdt)));
+        }
+        projectMasses_scalar(dstPos + i, dstVel + i, srcPos + i, srcVel + i, forces + i, invMass + i, count - i, dt);
+}
+
+__attribute__((target("sse"))) static void sum_sse(float *dst, const float *src, int count, float multiplier) {
+        __m128 m = _mm_set1_ps(multiplier);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), m)));
+        }
+        sum_scalar(dst + i, src + i, count - i, multiplier);
+}
+
+__attribute__((target("sse"))) static void rk4Combine_sse(float *dst, const float *k1, const float *k2, const float *k3, const float *k4, int count, float a, float b) {
+        __m128 va = _mm_set1_ps(a);
+        __m128 vb = _mm_set1_ps(b);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+                __m128 d = _mm_loadu_ps(dst + i);
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(k1 + i), va));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(k2 + i), vb));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(k3 + i), vb));
+                d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(k4 + i), va));
+                _mm_storeu_ps(dst + i, d);
+        }
+        rk4Combine_scalar(dst + i, k1 + i, k2 + i, k3 + i, k4 + i, count - i, a, b);
+}
+
+__attribute__((target("sse"))) static void shapePull_sse(float *forces, const float *pos, const float *shape, int count, float cosA, float sinA, float tx, float ty, float k) {
+        __m128 c = _mm_set1_ps(cosA);
+        __m128 s = _mm_set1_ps(sinA);
+        // Flips the sign of the x lanes, so x gets c*qx - s*qy and y gets c*qy + s*qx.
+        // Multiplying by -1 is exact, so this is still the same as the scalar one
+        __m128 flip = _mm_set_ps(1.f, -1.f, 1.f, -1.f);
+        __m128 t = _mm_set_ps(ty, tx, ty, tx);
+        __m128 vk = _mm_set1_ps(k);
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+                __m128 q = _mm_loadu_ps(shape + i);
+                __m128 swapped = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 3, 0, 1));
+                __m128 g = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c, q), _mm_mul_ps(_mm_mul_ps(s, swapped), flip)), t);
+                __m128 f = _mm_add_ps(_mm_loadu_ps(forces + i), _mm_mul_ps(_mm_sub_ps(g, _mm_loadu_ps(pos + i)), vk));
+                _mm_storeu_ps(forces + i, f);
+        }
+        shapePull_scalar(forces + i, pos + i, shape + i, count - i, cosA, sinA, tx, ty, k);
+}
+
+/* AVX2, 8 floats (4 points) at a time */
+// No FMA on purpose, fusing would change the rounding and break the
+// bit-identical-to-scalar guarantee
+
+__attribute__((target("avx2"))) static void project_avx2(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, int count, float velScale, float dt) {
+        __m256 vs = _mm256_set1_ps(velScale);
+        __m256 vdt = _mm256_set1_ps(dt);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+                __m256 v = _mm256_add_ps(_mm256_loadu_ps(srcVel + i), _mm256_mul_ps(_mm256_loadu_ps(forces + i), vs));
+                _mm256_storeu_ps(dstVel + i, v);
+                _mm256_storeu_ps(dstPos + i, _mm256_add_ps(_mm256_loadu_ps(srcPos + i), _mm256_mul_ps(v, vdt)));
+        }
+        project_sse(dstPos + i, dstVel + i, srcPos + i, srcVel + i, forces + i, count - i, velScale, dt);
+}
+
+__attribute__((target("avx2"))) static void projectMasses_avx2(float *dstPos, float *dstVel, const float *srcPos, const float *srcVel, const float *forces, const float *invMass, int count, float dt) {
+        __m256 vdt = _mm256_set1_ps(dt);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+                __m256 s = _mm256_mul_ps(vdt, _mm256_loadu_ps(invMass + i));
+                __m256 v = _mm256_add_ps(_mm256_loadu_ps(srcVel + i), _mm256_mul_ps(_mm256_loadu_ps(forces + i), s));
+                _mm256_storeu_ps(dstVel + i, v);
+                _mm256_storeu_ps(dstPos + i, _mm256_add_ps(_mm256_loadu_ps(srcPos + i), _mm256_mul_ps(v, vdt)));
+        }
+        projectMasses_sse(dstPos + i, dstVel + i, srcPos + i, srcVel + i, forces + i, invMass + i, count - i, dt);
+}
+
+__attribute__((target("avx2"))) static void sum_avx2(float *dst, const float *src, int count, float multiplier) {
+        __m256 m = _mm256_set1_ps(multiplier);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+                _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(src + i), m)));
+        }
+        sum_sse(dst + i, src + i, count - i, multiplier);
+}
+
+__attribute__((target("avx2"))) static void rk4Combine_avx2(float *dst, const float *k1, const float *k2, const float *k3, const float *k4, int count, float a, float b) {
+        __m256 va = _mm256_set1_ps(a);
+        __m256 vb = _mm256_set1_ps(b);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+                __m256 d = _mm256_loadu_ps(dst + i);
+                d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(k1 + i), va));
+                d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(k2 + i), vb));
+                d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(k3 + i), vb));
+                d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_loadu_ps(k4 + i), va));
+                _mm256_storeu_ps(dst + i, d);
+        }
+        rk4Combine_sse(dst + i, k1 + i, k2 + i, k3 + i, k4 + i, count - i, a, b);
+}
+
+__attribute__((target("avx2"))) static void shapePull_avx2(float *forces, const float *pos, const float *shape, int count, float cosA, float sinA, float tx, float ty, float k) {
+        __m256 c = _mm256_set1_ps(cosA);
+        __m256 s = _mm256_set1_ps(sinA);
+        __m256 flip = _mm256_set_ps(1.f, -1.f, 1.f, -1.f, 1.f, -1.f, 1.f, -1.f);
+        __m256 t = _mm256_set_ps(ty, tx, ty, tx, ty, tx, ty, tx);
+        __m256 vk = _mm256_set1_ps(k);
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+                __m256 q = _mm256_loadu_ps(shape + i);
+                __m256 swapped = _mm256_permute_ps(q, _MM_SHUFFLE(2, 3, 0, 1));
+                __m256 g = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c, q), _mm256_mul_ps(_mm256_mul_ps(s, swapped), flip)), t);
+                __m256 f = _mm256_add_ps(_mm256_loadu_ps(forces + i), _mm256_mul_ps(_mm256_sub_ps(g, _mm256_loadu_ps(pos + i)), vk));
+                _mm256_storeu_ps(forces + i, f);
+        }
+        shapePull_sse(forces + i, pos + i, shape + i, count - i, cosA, sinA, tx, ty, k);
+}
+
+#endif // SIMD_X86
+
+static const SimdKernels kernelTable[] = {
+    [SimdLevel_Scalar] = {SimdLevel_Scalar, project_scalar, projectMasses_scalar, sum_scalar, rk4Combine_scalar, shapePull_scalar},
+#ifdef SIMD_X86
+    [SimdLevel_SSE] = {SimdLevel_SSE, project_sse, projectMasses_sse, sum_sse, rk4Combine_sse, shapePull_sse},
+    [SimdLevel_AVX2] = {SimdLevel_AVX2, project_avx2, projectMasses_avx2, sum_avx2, rk4Combine_avx2, shapePull_avx2},
+#endif
+};
+
+static const SimdKernels *currentKernels = NULL;
+
+SimdLevel detectSimdLevel(void) {
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return SimdLevel_AVX2;
+        if (__builtin_cpu_supports("sse"))
+                return SimdLevel_SSE;
+#endif
+        return SimdLevel_Scalar;
+}
+
+void selectSimdKernels(SimdLevel level) {
+        SimdLevel supported = detectSimdLevel();
+        currentKernels = &kernelTable[level < supported ? level : supported];
+}
+
+const SimdKernels *getSimdKernels(void) {
+        if (!currentKernels)
+                selectSimdKernels(detectSimdLevel());
+        return currentKernels;
+}
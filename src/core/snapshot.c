@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <core/snapshot.h>
+#include <string.h>
+
+SnapshotRing createSnapshotRing(PhysicsWorld *world, int capacity) {
+        assert(capacity > 0);
+        SnapshotRing ring = {
+            .capacity = capacity,
+            .count = 0,
+            .oldest = 0,
+            .numPoints = world->numPoints,
+            .numBodies = world->numBodies,
+            .frames = MemAlloc(sizeof(WorldSnapshot) * capacity),
+        };
+
+        // Every frame is one contiguous piece of the block
+        size_t pointBytes = sizeof(Vector2) * ring.numPoints;
+        size_t bodyBytes = sizeof(BodySnapshot) * ring.numBodies;
+        size_t frameBytes = 4 * pointBytes + bodyBytes;
+        char *memory = MemAlloc(frameBytes * capacity > 0 ? frameBytes * capacity : 1);
+        ring.memory = memory;
+        for (int f = 0; f < capacity; f++) {
+                char *at = memory + frameBytes * f;
+                WorldSnapshot *snap = &ring.frames[f];
+                snap->pos = (Vector2 *)at;
+                snap->vel = (Vector2 *)(at + pointBytes);
+                snap->lastForces = (Vector2 *)(at + 2 * pointBytes);
+                snap->lastDv = (Vector2 *)(at + 3 * pointBytes);
+                snap->bodies = (BodySnapshot *)(at + 4 * pointBytes);
+        }
+        reserve_SnapshotRing(&ring, world->maxPairs > 0 ? world->maxPairs : 1, world->maxContacts > 0 ? world->maxContacts : 1);
+        return ring;
+}
+
+void reserve_SnapshotRing(SnapshotRing *ring, int maxPairs, int maxContacts) {
+        for (int f = 0; f < ring->capacity; f++) {
+                WorldSnapshot *snap = &ring->frames[f];
+                if (maxPairs > ring->maxPairs) {
+                        snap->pairA = MemRealloc(snap->pairA, sizeof(int) * maxPairs);
+                        snap->pairB = MemRealloc(snap->pairB, sizeof(int) * maxPairs);
+                        snap->pairCollisions = MemRealloc(snap->pairCollisions, sizeof(CollisionData) * maxPairs);
+                }
+                if (maxContacts > ring->maxContacts)
+                        snap->contacts = MemRealloc(snap->contacts, sizeof(Contact) * maxContacts);
+        }
+        if (maxPairs > ring->maxPairs)
+                ring->maxPairs = maxPairs;
+        if (maxContacts > ring->maxContacts)
+                ring->maxContacts = maxContacts;
+}
+
+void freeSnapshotRing(SnapshotRing *ring) {
+        for (int f = 0; f < ring->capacity; f++) {
+                MemFree(ring->frames[f].pairA);
+                MemFree(ring->frames[f].pairB);
+                MemFree(ring->frames[f].pairCollisions);
+                MemFree(ring->frames[f].contacts);
+        }
+        MemFree(ring->frames);
+        MemFree(ring->memory);
+        ring->capacity = 0;
+        ring->count = 0;
+}
+
+bool save_SnapshotRing(SnapshotRing *ring, PhysicsWorld *world, int frame) {
+        assert(world->numPoints == ring->numPoints && world->numBodies == ring->numBodies);
+        if (world->numPairs > ring->maxPairs || world->numContacts > ring->maxContacts)
+                return false;
+        int slot;
+        if (ring->count < ring->capacity) {
+                slot = (ring->oldest + ring->count++) % ring->capacity;
+        } else {
+                slot = ring->oldest;
+                ring->oldest = (ring->oldest + 1) % ring->capacity;
+        }
+        WorldSnapshot *snap = &ring->frames[slot];
+        snap->frame = frame;
+
+        for (int b = 0; b < world->numBodies; b++) {
+                SoftBody *sb = world->bodies[b];
+                int start = world->bodyStart[b];
+                memcpy(snap->pos + start, sb->pointPos, sizeof(Vector2) * sb->numPoints);
+                memcpy(snap->vel + start, sb->pointVel, sizeof(Vector2) * sb->numPoints);
+                snap->bodies[b] = (BodySnapshot){
+                    .shapePosition = sb->shapePosition,
+                    .shapeRotation = sb->shapeRotation,
+                    .bounds = sb->bounds,
+                    .asleep = world->bodyAsleep[b],
+                    .stillFrames = world->bodyStillFrames[b],
+                    .island = world->bodyIsland[b],
+                    .step = world->bodyStep[b],
+                };
+        }
+        memcpy(snap->lastForces, world->lastForces, sizeof(Vector2) * ring->numPoints);
+        memcpy(snap->lastDv, world->lastDv, sizeof(Vector2) * ring->numPoints);
+        snap->numPairs = world->numPairs;
+        memcpy(snap->pairA, world->pairA, sizeof(int) * world->numPairs);
+        memcpy(snap->pairB, world->pairB, sizeof(int) * world->numPairs);
+        memcpy(snap->pairCollisions, world->pairCollisions, sizeof(CollisionData) * world->numPairs);
+        snap->numContacts = world->numContacts;
+        memcpy(snap->contacts, world->contacts, sizeof(Contact) * world->numContacts);
+        snap->lastForcesValid = world->lastForcesValid;
+        snap->lastIntegrator = world->lastIntegrator;
+        snap->numIslands = world->numIslands;
+        return true;
+}
+
+bool restore_SnapshotRing(SnapshotRing *ring, PhysicsWorld *world, int frame) {
+        assert(world->numPoints == ring->numPoints && world->numBodies == ring->numBodies);
+        // Newest first, it's nearly always one of the last few
+        int k = ring->count - 1;
+        while (k >= 0 && ring->frames[(ring->oldest + k) % ring->capacity].frame != frame) {
+                k--;
+        }
+        if (k < 0)
+                return false;
+        WorldSnapshot *snap = &ring->frames[(ring->oldest + k) % ring->capacity];
+        ring->count = k + 1;
+
+        for (int b = 0; b < world->numBodies; b++) {
+                SoftBody *sb = world->bodies[b];
+                int start = world->bodyStart[b];
+                memcpy(sb->pointPos, snap->pos + start, sizeof(Vector2) * sb->numPoints);
+                memcpy(sb->pointVel, snap->vel + start, sizeof(Vector2) * sb->numPoints);
+                BodySnapshot body = snap->bodies[b];
+                sb->shapePosition = body.shapePosition;
+                sb->shapeRotation = body.shapeRotation;
+                sb->bounds = body.bounds;
+                refitSurfaceTree_SoftBody(sb);
+                world->bodyAsleep[b] = body.asleep;
+                world->bodyStillFrames[b] = body.stillFrames;
+                world->bodyIsland[b] = body.island;
+                world->bodyStep[b] = body.step;
+        }
+        memcpy(world->lastForces, snap->lastForces, sizeof(Vector2) * ring->numPoints);
+        memcpy(world->lastDv, snap->lastDv, sizeof(Vector2) * ring->numPoints);
+        // The world's pair arrays are at least as big as they were when this
+        // was saved
+        assert(snap->numPairs <= world->maxPairs);
+        world->numPairs = snap->numPairs;
+        memcpy(world->pairA, snap->pairA, sizeof(int) * snap->numPairs);
+        memcpy(world->pairB, snap->pairB, sizeof(int) * snap->numPairs);
+        memcpy(world->pairCollisions, snap->pairCollisions, sizeof(CollisionData) * snap->numPairs);
+        assert(snap->numContacts <= world->maxContacts);
+        world->numContacts = snap->numContacts;
+        memcpy(world->contacts, snap->contacts, sizeof(Contact) * snap->numContacts);
+        world->lastForcesValid = snap->lastForcesValid;
+        world->lastIntegrator = snap->lastIntegrator;
+        world->numIslands = snap->numIslands;
+        // The bounds just jumped back, the tree's boxes need to follow
+        Broadphase_refit(&world->broadphase, world->bodies);
+        return true;
+}
@@ -0,0 +1,135 @@
+#include <core/physics.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Small enough that a leaf's surfaces are about as cheap to check as its
+// children's boxes would be
+#define SURFACE_LEAF_SIZE 4
+
+typedef struct SurfaceKey {
+        float key; // The surface's midpoint along whichever axis is being split
+        int surface;
+} SurfaceKey;
+
+static int compareKeys(const void *l, const void *r) {
+        const SurfaceKey *a = l, *b = r;
+        if (a->key != b->key)
+                return a->key < b->key ? -1 : 1;
+        // Same tree every time for the same body
+        return a->surface - b->surface;
+}
+
+static Vector2 midpoint(const SoftBody *sb, int surf) {
+        Vector2 p1 = sb->pointPos[sb->surfaceA[surf]];
+        Vector2 p2 = sb->pointPos[sb->surfaceB[surf]];
+        return Vector2Scale(Vector2Add(p1, p2), 0.5f);
+}
+
+// Builds keys[first, first + count) into a subtree at node n. Returns the
+// node after the subtree
+static int buildNode(SoftBody *sb, SurfaceKey *keys, int first, int count, int n) {
+        SurfaceNode *node = &sb->surfaceNodes[n];
+        node->first = first;
+        if (count <= SURFACE_LEAF_SIZE) {
+                node->right = -1;
+                node->count = count;
+                for (int i = first; i < first + count; i++) {
+                        sb->surfaceOrder[i] = keys[i].surface;
+                }
+                return n + 1;
+        }
+
+        // Halve it across the longer side of where the midpoints are
+        Vector2 lo = midpoint(sb, keys[first].surface);
+        Vector2 hi = lo;
+        for (int i = first + 1; i < first + count; i++) {
+                Vector2 m = midpoint(sb, keys[i].surface);
+                lo = Vector2Min(lo, m);
+                hi = Vector2Max(hi, m);
+        }
+        bool splitY = hi.y - lo.y > hi.x - lo.x;
+        for (int i = first; i < first + count; i++) {
+                Vector2 m = midpoint(sb, keys[i].surface);
+                keys[i].key = splitY ? m.y : m.x;
+        }
+        qsort(keys + first, count, sizeof(SurfaceKey), compareKeys);
+
+        int half = count / 2;
+        node->count = 0;
+        int right = buildNode(sb, keys, first, half, n + 1);
+        sb->surfaceNodes[n].right = right;
+        return buildNode(sb, keys, first + half, count - half, right);
+}
+
+// Surfaces run point to point round the outside, so a surface's neighbours
+// are the ones that end at its start and start at its end
+static void linkSurfaces(SoftBody *sb) {
+        int n = sb->numSurfaces;
+        int *endingAt = MemAlloc(sizeof(int) * (sb->numPoints > 0 ? sb->numPoints : 1));
+        int *startingAt = MemAlloc(sizeof(int) * (sb->numPoints > 0 ? sb->numPoints : 1));
+        for (int i = 0; i < sb->numPoints; i++) {
+                endingAt[i] = -1;
+                startingAt[i] = -1;
+        }
+        for (int i = 0; i < n; i++) {
+                startingAt[sb->surfaceA[i]] = i;
+                endingAt[sb->surfaceB[i]] = i;
+        }
+        for (int i = 0; i < n; i++) {
+                sb->surfacePrev[i] = endingAt[sb->surfaceA[i]];
+                sb->surfaceNext[i] = startingAt[sb->surfaceB[i]];
+        }
+        MemFree(endingAt);
+        MemFree(startingAt);
+}
+
+void buildSurfaceTree_SoftBody(SoftBody *sb) {
+        MemFree(sb->surfaceNodes);
+        MemFree(sb->surfaceOrder);
+        MemFree(sb->surfacePrev);
+        MemFree(sb->surfaceNext);
+        int n = sb->numSurfaces;
+        // Every split makes two nodes out of one, and leaves have at least
+        // one surface (or it's the only node and it's empty)
+        int maxNodes = n > 0 ? 2 * n - 1 : 1;
+        sb->surfaceNodes = MemAlloc(sizeof(SurfaceNode) * maxNodes);
+        sb->surfaceOrder = MemAlloc(sizeof(int) * (n > 0 ? n : 1));
+        sb->surfacePrev = MemAlloc(sizeof(int) * (n > 0 ? n : 1));
+        sb->surfaceNext = MemAlloc(sizeof(int) * (n > 0 ? n : 1));
+        linkSurfaces(sb);
+
+        SurfaceKey *keys = MemAlloc(sizeof(SurfaceKey) * (n > 0 ? n : 1));
+        for (int i = 0; i < n; i++) {
+                keys[i] = (SurfaceKey){0.f, i};
+        }
+        sb->numSurfaceNodes = buildNode(sb, keys, 0, n, 0);
+        MemFree(keys);
+        refitSurfaceTree_SoftBody(sb);
+}
+
+void refitSurfaceTree_SoftBody(SoftBody *sb) {
+        if (sb->surfaceNodes == NULL) {
+                buildSurfaceTree_SoftBody(sb);
+                return;
+        }
+        // Children come after their parents, so backwards is bottom up
+        for (int n = sb->numSurfaceNodes - 1; n >= 0; n--) {
+                SurfaceNode *node = &sb->surfaceNodes[n];
+                if (node->right >= 0) {
+                        BB a = sb->surfaceNodes[n + 1].box;
+                        BB b = sb->surfaceNodes[node->right].box;
+                        node->box = (BB){Vector2Min(a.min, b.min), Vector2Max(a.max, b.max)};
+                        continue;
+                }
+                // Empty stays inside out, so nothing overlaps it
+                BB box = {{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+                for (int i = node->first; i < node->first + node->count; i++) {
+                        int surf = sb->surfaceOrder[i];
+                        Vector2 p1 = sb->pointPos[sb->surfaceA[surf]];
+                        Vector2 p2 = sb->pointPos[sb->surfaceB[surf]];
+                        box.min = Vector2Min(box.min, Vector2Min(p1, p2));
+                        box.max = Vector2Max(box.max, Vector2Max(p1, p2));
+                }
+                node->box = box;
+        }
+}
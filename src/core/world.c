@@ -0,0 +1,1319 @@
+#include <assert.h>
+#include <core/simd.h>
+#include <core/world.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void freeEdgeColoring(EdgeColoring *c) {
+        MemFree(c->order);
+        MemFree(c->batchStart);
+        MemFree(c->bodyBatch);
+        c->numBatches = 0;
+}
+
+// Appends body `id`'s batches, for its `count` edges starting at `first`
+static void colorEdges(EdgeColoring *c, int id, const int *edgeA, const int *edgeB, int first, int count, int pointStart, int numPoints) {
+        // Greedy, every edge takes the lowest color neither of its ends has
+        // yet. Points in a soft body only have a handful of edges each, so this
+        // never gets anywhere near 64 colors
+        unsigned long long *used = MemAlloc(sizeof(unsigned long long) * numPoints);
+        int *color = MemAlloc(sizeof(int) * (count > 0 ? count : 1));
+        int numInColor[64] = {0};
+        int numColors = 0;
+        for (int e = 0; e < count; e++) {
+                int a = edgeA[first + e] - pointStart;
+                int b = edgeB[first + e] - pointStart;
+                unsigned long long taken = used[a] | used[b];
+                assert(taken != ~0ull);
+                int col = __builtin_ctzll(~taken);
+                color[e] = col;
+                used[a] |= 1ull << col;
+                used[b] |= 1ull << col;
+                numInColor[col]++;
+                if (col + 1 > numColors)
+                        numColors = col + 1;
+        }
+
+        int b0 = c->numBatches;
+        c->numBatches += numColors;
+        c->batchStart = MemRealloc(c->batchStart, sizeof(int) * (c->numBatches + 1));
+        c->order = MemRealloc(c->order, sizeof(int) * (first + count > 0 ? first + count : 1));
+        c->batchStart[b0] = first;
+        int cursor[64];
+        for (int col = 0; col < numColors; col++) {
+                cursor[col] = c->batchStart[b0 + col];
+                c->batchStart[b0 + col + 1] = c->batchStart[b0 + col] + numInColor[col];
+        }
+        // Keeps the original order inside each batch
+        for (int e = 0; e < count; e++) {
+                c->order[cursor[color[e]]++] = first + e;
+        }
+        c->bodyBatch[id + 1] = c->numBatches;
+
+        MemFree(used);
+        MemFree(color);
+}
+
+static void reservePairs(PhysicsWorld *world, int count) {
+        if (count <= world->maxPairs)
+                return;
+        world->maxPairs = count;
+        world->pairA = MemRealloc(world->pairA, sizeof(int) * count);
+        world->pairB = MemRealloc(world->pairB, sizeof(int) * count);
+        world->pairCollisions = MemRealloc(world->pairCollisions, sizeof(CollisionData) * count);
+        world->sparePairA = MemRealloc(world->sparePairA, sizeof(int) * count);
+        world->sparePairB = MemRealloc(world->sparePairB, sizeof(int) * count);
+        world->sparePairCollisions = MemRealloc(world->sparePairCollisions, sizeof(CollisionData) * count);
+        world->manifolds = MemRealloc(world->manifolds, sizeof(ContactManifold) * count);
+        world->manifoldColor = MemRealloc(world->manifoldColor, sizeof(int) * count);
+        world->coloredManifolds = MemRealloc(world->coloredManifolds, sizeof(ContactManifold) * count);
+}
+
+PhysicsWorld createPhysicsWorld(WorldValues values, int maxBodies) {
+        PhysicsWorld world = {
+            .values = values,
+            .numBodies = 0,
+            .maxBodies = maxBodies,
+            .bodies = MemAlloc(sizeof(SoftBody *) * maxBodies),
+            .params = MemAlloc(sizeof(BodyParams) * maxBodies),
+            .forceBodies = MemAlloc(sizeof(ForceBody) * maxBodies),
+            .bodyStart = MemAlloc(sizeof(int) * (maxBodies + 1)),
+            .springStart = MemAlloc(sizeof(int) * (maxBodies + 1)),
+            .surfaceStart = MemAlloc(sizeof(int) * (maxBodies + 1)),
+            .bodyVolume = MemAlloc(sizeof(float) * maxBodies),
+            .bodyFrame = MemAlloc(sizeof(ShapeFrame) * maxBodies),
+            .bodyClusterStart = MemAlloc(sizeof(int) * (maxBodies + 1)),
+            .implicitBodies = MemAlloc(sizeof(ImplicitBody) * maxBodies),
+            .bodyStep = MemAlloc(sizeof(float) * maxBodies),
+            .bodySteps = MemAlloc(sizeof(int) * maxBodies),
+            .bodyRejected = MemAlloc(sizeof(int) * maxBodies),
+            .bodyMaterial = MemAlloc(sizeof(SoftBodyMaterial) * maxBodies),
+            .bodyAsleep = MemAlloc(sizeof(bool) * maxBodies),
+            .bodySelfCollide = MemAlloc(sizeof(bool) * maxBodies),
+            .bodyStillFrames = MemAlloc(sizeof(int) * maxBodies),
+            .bodyIsland = MemAlloc(sizeof(int) * maxBodies),
+            .islandStill = MemAlloc(sizeof(int) * maxBodies),
+            .broadphase = createBroadphase(Broadphase_SweepAndPrune, maxBodies, 0.f),
+            .queryIds = MemAlloc(sizeof(int) * maxBodies),
+            .bodyColors = MemAlloc(sizeof(unsigned long long) * maxBodies),
+            .sweptBodies = MemAlloc(sizeof(SweptBody) * maxBodies),
+            .maxSweepPairs = maxBodies > 0 ? maxBodies : 1,
+            .sweepPairs = MemAlloc(sizeof(BodyPair) * (maxBodies > 0 ? maxBodies : 1)),
+            .chunks = MemAlloc(sizeof(WorldRange) * maxBodies),
+            .chunkCgIterations = MemAlloc(sizeof(int) * maxBodies),
+            .springColors = {.bodyBatch = MemAlloc(sizeof(int) * (maxBodies + 1))},
+            .surfaceColors = {.bodyBatch = MemAlloc(sizeof(int) * (maxBodies + 1))},
+            .scratch = {0},
+            .stepAllocs = 0,
+            .integrator = Integrator_RK4,
+            .substeps = 8,
+            .cgMaxIterations = 30,
+            .cgTolerance = 1e-4f,
+            .adaptiveTolerance = 1e-3f,
+            .adaptiveMaxSteps = 32,
+            .jobs = NULL,
+            .deterministic = true,
+            .chunkPoints = 256,
+            .splitPoints = 2048,
+            .contactIterations = CONTACT_ITERATIONS,
+            .warmStarting = true,
+            .ccdFraction = 0.5f,
+            .allowSleep = true,
+            .sleepEnergy = 1e-4f,
+            .sleepFrames = 60,
+        };
+        world.bodyStart[0] = 0;
+        world.springStart[0] = 0;
+        world.surfaceStart[0] = 0;
+        // Pick the SIMD kernels now, instead of every worker racing to on the first step
+        getSimdKernels();
+        // Same for the material table
+        getMaterialPair(SoftBodyMaterial_DEFAULT, SoftBodyMaterial_DEFAULT);
+        return world;
+}
+
+void freePhysicsWorld(PhysicsWorld *world) {
+        MemFree(world->bodies);
+        MemFree(world->params);
+        MemFree(world->forceBodies);
+        MemFree(world->bodyStart);
+        MemFree(world->springStart);
+        MemFree(world->surfaceStart);
+        MemFree(world->pointBody);
+        MemFree(world->shape);
+        MemFree(world->pointInvMass);
+        MemFree(world->springA);
+        MemFree(world->springB);
+        MemFree(world->springBody);
+        MemFree(world->lengths);
+        MemFree(world->surfaceA);
+        MemFree(world->surfaceB);
+        MemFree(world->surfaceBody);
+        MemFree(world->bodyVolume);
+        MemFree(world->bodyFrame);
+        MemFree(world->bodyClusterStart);
+        MemFree(world->clusters);
+        MemFree(world->clusterPoints);
+        MemFree(world->clusterFrame);
+        MemFree(world->lastForces);
+        MemFree(world->implicitSprings);
+        MemFree(world->implicitBodies);
+        MemFree(world->lastDv);
+        MemFree(world->bodyStep);
+        MemFree(world->bodySteps);
+        MemFree(world->bodyRejected);
+        MemFree(world->prevPos);
+        MemFree(world->renderPos);
+        MemFree(world->bodyMaterial);
+        MemFree(world->bodyAsleep);
+        MemFree(world->bodyStillFrames);
+        MemFree(world->bodyIsland);
+        MemFree(world->islandStill);
+        freeBroadphase(&world->broadphase);
+        MemFree(world->queryIds);
+        MemFree(world->sweepFrom);
+        MemFree(world->sweptBodies);
+        MemFree(world->sweepPairs);
+        MemFree(world->sweepHits);
+        MemFree(world->sweepContacts);
+        MemFree(world->bodySelfCollide);
+        freeSelfHash(&world->selfHash);
+        MemFree(world->pairA);
+        MemFree(world->pairB);
+        MemFree(world->pairCollisions);
+        MemFree(world->sparePairA);
+        MemFree(world->sparePairB);
+        MemFree(world->sparePairCollisions);
+        MemFree(world->contacts);
+        MemFree(world->spareContacts);
+        MemFree(world->manifolds);
+        MemFree(world->manifoldColor);
+        MemFree(world->coloredManifolds);
+        MemFree(world->bodyColors);
+        MemFree(world->chunks);
+        MemFree(world->chunkCgIterations);
+        freeEdgeColoring(&world->springColors);
+        freeEdgeColoring(&world->surfaceColors);
+        free_SimArena(&world->scratch);
+        world->numBodies = 0;
+        world->maxBodies = 0;
+        world->numPoints = 0;
+        world->numSprings = 0;
+        world->numSurfaces = 0;
+        world->numPairs = 0;
+        world->maxPairs = 0;
+        world->numClusters = 0;
+        world->numIslands = 0;
+        world->numAwakeBodies = 0;
+        world->numAwakePoints = 0;
+}
+
+void PhysicsWorld_setBroadphase(PhysicsWorld *world, BroadphaseType type, float cellSize) {
+        assert(world->numBodies == 0);
+        freeBroadphase(&world->broadphase);
+        world->broadphase = createBroadphase(type, world->maxBodies, cellSize);
+}
+
+int PhysicsWorld_addBody(PhysicsWorld *world, SoftBody *sb) {
+        assert(world->numBodies < world->maxBodies);
+        int id = world->numBodies;
+        int start = world->numPoints;
+
+        // All the growing happens here rather than in the middle of a step
+        world->numPoints += sb->numPoints;
+        world->pointBody = MemRealloc(world->pointBody, sizeof(int) * world->numPoints);
+        world->shape = MemRealloc(world->shape, sizeof(Vector2) * world->numPoints);
+        world->pointInvMass = MemRealloc(world->pointInvMass, sizeof(float) * 2 * world->numPoints);
+        world->lastForces = MemRealloc(world->lastForces, sizeof(Vector2) * world->numPoints);
+        world->lastDv = MemRealloc(world->lastDv, sizeof(Vector2) * world->numPoints);
+        // The implicit solve only clears its guess when switching over, so a
+        // body added mid-run starts it from nothing rather than garbage
+        memset(world->lastDv + start, 0, sizeof(Vector2) * sb->numPoints);
+        world->lastForcesValid = false;
+        world->prevPos = MemRealloc(world->prevPos, sizeof(Vector2) * world->numPoints);
+        world->renderPos = MemRealloc(world->renderPos, sizeof(Vector2) * world->numPoints);
+        world->sweepFrom = MemRealloc(world->sweepFrom, sizeof(Vector2) * world->numPoints);
+        if (sb->numPoints > world->maxBodyPoints) {
+                world->maxBodyPoints = sb->numPoints;
+                world->sweepHits = MemRealloc(world->sweepHits, sizeof(PointHit) * 2 * sb->numPoints);
+                world->sweepContacts = MemRealloc(world->sweepContacts, sizeof(Contact) * 2 * sb->numPoints);
+        }
+        reserveSelfHash(&world->selfHash, sb->numSurfaces, sb->numPoints);
+        for (int i = 0; i < sb->numPoints; i++) {
+                world->pointBody[start + i] = id;
+                world->shape[start + i] = sb->shape[i];
+                world->prevPos[start + i] = sb->pointPos[i];
+                world->sweepFrom[start + i] = sb->pointPos[i];
+        }
+
+        if (sb->type & SoftBodyType_Springs) {
+                int s0 = world->numSprings;
+                world->numSprings += sb->numSprings;
+                world->springA = MemRealloc(world->springA, sizeof(int) * world->numSprings);
+                world->springB = MemRealloc(world->springB, sizeof(int) * world->numSprings);
+                world->springBody = MemRealloc(world->springBody, sizeof(int) * world->numSprings);
+                world->lengths = MemRealloc(world->lengths, sizeof(float) * world->numSprings);
+                world->implicitSprings = MemRealloc(world->implicitSprings, sizeof(ImplicitSpring) * world->numSprings);
+                for (int i = 0; i < sb->numSprings; i++) {
+                        world->springA[s0 + i] = start + sb->springA[i];
+                        world->springB[s0 + i] = start + sb->springB[i];
+                        world->springBody[s0 + i] = id;
+                        world->lengths[s0 + i] = sb->lengths[i];
+                }
+        }
+
+        // Surfaces are always needed for drag
+        int f0 = world->numSurfaces;
+        world->numSurfaces += sb->numSurfaces;
+        world->surfaceA = MemRealloc(world->surfaceA, sizeof(int) * world->numSurfaces);
+        world->surfaceB = MemRealloc(world->surfaceB, sizeof(int) * world->numSurfaces);
+        world->surfaceBody = MemRealloc(world->surfaceBody, sizeof(int) * world->numSurfaces);
+        for (int i = 0; i < sb->numSurfaces; i++) {
+                world->surfaceA[f0 + i] = start + sb->surfaceA[i];
+                world->surfaceB[f0 + i] = start + sb->surfaceB[i];
+                world->surfaceBody[f0 + i] = id;
+        }
+
+        colorEdges(&world->springColors, id, world->springA, world->springB, world->springStart[id], world->numSprings - world->springStart[id],
+                   start, sb->numPoints);
+        colorEdges(&world->surfaceColors, id, world->surfaceA, world->surfaceB, f0, sb->numSurfaces, start, sb->numPoints);
+
+        if (sb->numClusters > 0) {
+                int c0 = world->numClusters;
+                int m0 = c0 > 0 ? world->clusters[c0 - 1].end : 0;
+                int numMembers = sb->clusters[sb->numClusters - 1].end;
+                world->numClusters += sb->numClusters;
+                world->clusters = MemRealloc(world->clusters, sizeof(ShapeCluster) * world->numClusters);
+                world->clusterFrame = MemRealloc(world->clusterFrame, sizeof(ShapeFrame) * world->numClusters);
+                world->clusterPoints = MemRealloc(world->clusterPoints, sizeof(int) * (m0 + numMembers));
+                for (int c = 0; c < sb->numClusters; c++) {
+                        ShapeCluster cluster = sb->clusters[c];
+                        cluster.begin += m0;
+                        cluster.end += m0;
+                        world->clusters[c0 + c] = cluster;
+                }
+                for (int m = 0; m < numMembers; m++) {
+                        world->clusterPoints[m0 + m] = start + sb->clusterPoints[m];
+                }
+        }
+        world->bodyClusterStart[id + 1] = world->numClusters;
+
+        // rectSoftbody and friends don't fill in bounds, and queries can
+        // happen before the first step
+        updateBounds_SoftBody(sb);
+        Broadphase_addBody(&world->broadphase, id, sb->bounds);
+        // A few pairs per body to start with, so a scene that isn't piled up
+        // doesn't have to grow them mid step
+        reservePairs(world, 4 * (id + 1));
+        world->bodyMaterial[id] = SoftBodyMaterial_DEFAULT;
+        world->bodyAsleep[id] = false;
+        world->bodySelfCollide[id] = false;
+        world->bodyStillFrames[id] = 0;
+        world->bodyIsland[id] = id;
+        world->bodyStep[id] = 0.f; // The whole step to start with
+        world->bodySteps[id] = 0;
+        world->bodyRejected[id] = 0;
+
+        reserve_SimArena(&world->scratch, world->numPoints * WORLD_SCRATCH_BLOCKS);
+
+        world->bodies[id] = sb;
+        world->bodyStart[id + 1] = world->numPoints;
+        world->springStart[id + 1] = world->numSprings;
+        world->surfaceStart[id + 1] = world->numSurfaces;
+        return world->numBodies++;
+}
+
+WorldRange PhysicsWorld_range(PhysicsWorld *world, int bodyBegin, int bodyEnd) {
+        return (WorldRange){
+            .bodyBegin = bodyBegin,
+            .bodyEnd = bodyEnd,
+            .pointBegin = world->bodyStart[bodyBegin],
+            .pointEnd = world->bodyStart[bodyEnd],
+            .springBegin = world->springStart[bodyBegin],
+            .springEnd = world->springStart[bodyEnd],
+            .surfaceBegin = world->surfaceStart[bodyBegin],
+            .surfaceEnd = world->surfaceStart[bodyEnd],
+            .wide = bodyEnd - bodyBegin == 1 && world->bodyStart[bodyEnd] - world->bodyStart[bodyBegin] >= world->splitPoints,
+        };
+}
+
+void gather_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points) {
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                SoftBody *sb = world->bodies[b];
+                int start = world->bodyStart[b];
+                memcpy(points.pos + start, sb->pointPos, sizeof(Vector2) * sb->numPoints);
+                memcpy(points.vel + start, sb->pointVel, sizeof(Vector2) * sb->numPoints);
+                world->params[b] = (BodyParams){
+                    .type = sb->type,
+                    .mass = sb->mass,
+                    .invMass = sb->invMass,
+                    .linearDrag = sb->linearDrag,
+                    .springStrength = sb->springStrength,
+                    .springDamp = sb->springDamp,
+                    .shapeSpringStrength = sb->shapeSpringStrength,
+                    .nRT = sb->nRT,
+                    .calcForces = forceKernels[sb->type & 0b111],
+                };
+                // Rebuilt every time rather than at PhysicsWorld_addBody,
+                // since adding more bodies moves the packed arrays
+                int s0 = world->springStart[b];
+                int f0 = world->surfaceStart[b];
+                int c0 = world->bodyClusterStart[b];
+                world->forceBodies[b] = (ForceBody){
+                    .firstPoint = start,
+                    .numPoints = sb->numPoints,
+                    .shape = world->shape,
+                    .numSprings = world->springStart[b + 1] - s0,
+                    .springA = world->springA + s0,
+                    .springB = world->springB + s0,
+                    .lengths = world->lengths + s0,
+                    .numSurfaces = world->surfaceStart[b + 1] - f0,
+                    .surfaceA = world->surfaceA + f0,
+                    .surfaceB = world->surfaceB + f0,
+                    .numClusters = world->bodyClusterStart[b + 1] - c0,
+                    .clusters = world->clusters + c0,
+                    .clusterPoints = world->clusterPoints,
+                    .mass = sb->mass,
+                    .linearDrag = sb->linearDrag,
+                    .springStrength = sb->springStrength,
+                    .springDamp = sb->springDamp,
+                    .shapeSpringStrength = sb->shapeSpringStrength,
+                    .nRT = sb->nRT,
+                };
+                for (int i = 2 * start; i < 2 * world->bodyStart[b + 1]; i++) {
+                        world->pointInvMass[i] = sb->invMass;
+                }
+        }
+}
+
+void scatter_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points) {
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                SoftBody *sb = world->bodies[b];
+                int start = world->bodyStart[b];
+                memcpy(sb->pointPos, points.pos + start, sizeof(Vector2) * sb->numPoints);
+                memcpy(sb->pointVel, points.vel + start, sizeof(Vector2) * sb->numPoints);
+        }
+}
+
+// Cuts the awake bodies up into the chunks that each get integrated as one
+// job. Asleep bodies end a chunk, and wide bodies get pulled out into chunks
+// of their own at the end
+static void buildChunks_PhysicsWorld(PhysicsWorld *world) {
+        int target = world->chunkPoints;
+        if (!world->deterministic) {
+                // A few per worker, so stealing has something to even out
+                int parts = JobSystem_numWorkers(world->jobs) * 4;
+                target = (world->numPoints + parts - 1) / parts;
+        }
+        if (target < 1)
+                target = 1;
+
+        world->numChunks = 0;
+        world->numWideChunks = 0;
+        world->numAwakeBodies = 0;
+        world->numAwakePoints = 0;
+        int begin = 0;
+        for (int b = 0; b < world->numBodies; b++) {
+                if (world->bodyAsleep[b]) {
+                        if (begin < b)
+                                world->chunks[world->numChunks++] = PhysicsWorld_range(world, begin, b);
+                        begin = b + 1;
+                        continue;
+                }
+                world->numAwakeBodies++;
+                world->numAwakePoints += world->bodyStart[b + 1] - world->bodyStart[b];
+
+                bool wide = world->bodyStart[b + 1] - world->bodyStart[b] >= world->splitPoints;
+                if (wide) {
+                        // Close off whatever came before it
+                        if (begin < b)
+                                world->chunks[world->numChunks++] = PhysicsWorld_range(world, begin, b);
+                        world->chunks[world->maxBodies - ++world->numWideChunks] = PhysicsWorld_range(world, b, b + 1);
+                        begin = b + 1;
+                } else if (world->bodyStart[b + 1] - world->bodyStart[begin] >= target) {
+                        world->chunks[world->numChunks++] = PhysicsWorld_range(world, begin, b + 1);
+                        begin = b + 1;
+                }
+        }
+        if (begin < world->numBodies)
+                world->chunks[world->numChunks++] = PhysicsWorld_range(world, begin, world->numBodies);
+        // Wide ones were stacked down from the end, so they're backwards. Turn
+        // them round where they are, then move them up behind the rest. The
+        // two can overlap when nearly every chunk is wide, hence memmove
+        WorldRange *wide = world->chunks + world->maxBodies - world->numWideChunks;
+        for (int i = 0, j = world->numWideChunks - 1; i < j; i++, j--) {
+                WorldRange tmp = wide[i];
+                wide[i] = wide[j];
+                wide[j] = tmp;
+        }
+        memmove(world->chunks + world->numChunks, wide, sizeof(WorldRange) * world->numWideChunks);
+        world->numChunks += world->numWideChunks;
+}
+
+static void integrateChunk(PhysicsWorld *world, int c) {
+        float dt = world->stageDt;
+        WorldRange r = world->chunks[c];
+        world->chunkCgIterations[c] = 0;
+        switch (world->integrator) {
+        case Integrator_RK4:
+                integrate_RK4(world, r, dt);
+                break;
+        case Integrator_SymplecticEuler:
+                integrate_SymplecticEuler(world, r, dt);
+                break;
+        case Integrator_Verlet:
+                integrate_Verlet(world, r, dt);
+                break;
+        case Integrator_XPBD:
+                integrate_XPBD(world, r, dt);
+                break;
+        case Integrator_Implicit:
+                world->chunkCgIterations[c] = integrate_Implicit(world, r, dt);
+                break;
+        case Integrator_Adaptive:
+                integrate_Adaptive(world, r, dt);
+                break;
+        }
+
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                SoftBody *sb = world->bodies[b];
+                SBPos newPos = calcShape(*sb, (SBPoints){.num = sb->numPoints, .pos = sb->pointPos, .vel = sb->pointVel});
+                sb->shapePosition = newPos.position;
+                sb->shapeRotation = newPos.rotation;
+                updateBounds_SoftBody(sb);
+        }
+}
+
+static void integrateChunks_job(void *data, int begin, int end, int worker) {
+        for (int c = begin; c < end; c++) {
+                integrateChunk(data, c);
+        }
+}
+
+void update_PhysicsWorld(PhysicsWorld *world, float dt) {
+        int allocsBefore = world->scratch.numAllocs;
+
+        // Everything the jobs share gets set up here, before any of them start
+        reset_SimArena(&world->scratch);
+        world->stage = push_SimArena(&world->scratch, world->numPoints * WORLD_SCRATCH_BLOCKS);
+        bool sweeping = world->ccdFraction > 0.f;
+        for (int b = 0; b < world->numBodies && !sweeping; b++) {
+                sweeping = world->bodySelfCollide[b];
+        }
+        if (sweeping) {
+                for (int b = 0; b < world->numBodies; b++) {
+                        SoftBody *sb = world->bodies[b];
+                        memcpy(world->sweepFrom + world->bodyStart[b], sb->pointPos, sizeof(Vector2) * sb->numPoints);
+                }
+        }
+        world->stageDt = dt;
+        buildChunks_PhysicsWorld(world);
+
+        JobSystem_parallelFor(world->jobs, world->numChunks - world->numWideChunks, 1, integrateChunks_job, world);
+        // Wide bodies go one at a time, each spreading its own loops over the jobs
+        for (int c = world->numChunks - world->numWideChunks; c < world->numChunks; c++) {
+                integrateChunk(world, c);
+        }
+
+        world->lastForcesValid = world->integrator == Integrator_Verlet;
+        world->lastIntegrator = world->integrator;
+        world->cgIterations = 0;
+        world->adaptiveSteps = 0;
+        world->adaptiveRejected = 0;
+        for (int c = 0; c < world->numChunks; c++) {
+                if (world->chunkCgIterations[c] > world->cgIterations)
+                        world->cgIterations = world->chunkCgIterations[c];
+                if (world->integrator != Integrator_Adaptive)
+                        continue;
+                for (int b = world->chunks[c].bodyBegin; b < world->chunks[c].bodyEnd; b++) {
+                        world->adaptiveSteps += world->bodySteps[b];
+                        world->adaptiveRejected += world->bodyRejected[b];
+                }
+        }
+
+        world->stepAllocs = world->scratch.numAllocs - allocsBefore;
+}
+
+static void detectPairs_job(void *data, int begin, int end, int worker) {
+        PhysicsWorld *world = data;
+        for (int p = begin; p < end; p++) {
+                int a = world->pairA[p];
+                int b = world->pairB[p];
+                // Neither moved, so whatever they had last time still stands.
+                // Keeping it keeps the two in the same island
+                if (world->bodyAsleep[a] && world->bodyAsleep[b])
+                        continue;
+                SoftBody *A = world->bodies[a];
+                SoftBody *B = world->bodies[b];
+                CollisionData data = world->pairCollisions[p];
+                const Contact *cached = world->spareContacts + data.cachedContact;
+                world->pairCollisions[p] = recheckCollision(*A, *B, cached, data.numCached, world->contacts + data.firstContact, A->numPoints + B->numPoints);
+                world->pairCollisions[p].firstContact = data.firstContact;
+        }
+}
+
+// Swaps in the broadphase's pairs, finding each one's result from last
+// time by walking the old pairs alongside (both lists are in the same
+// order). Pairs that are both asleep won't get checked, so they keep theirs
+// as it was, contacts and all. The others get pointed at their old contacts
+// to recheck from
+static void takePairs_PhysicsWorld(PhysicsWorld *world) {
+        Broadphase *bp = &world->broadphase;
+        if (bp->numPairs > world->maxPairs)
+                reservePairs(world, bp->maxPairs);
+        int numContacts = 0;
+        for (int p = 0; p < bp->numPairs; p++) {
+                numContacts += world->bodies[bp->pairs[p].a]->numPoints + world->bodies[bp->pairs[p].b]->numPoints;
+        }
+        // The old set still has to be read, so it only grows once it's done with
+        bool grow = numContacts > world->maxContacts;
+        if (grow) {
+                world->maxContacts = numContacts * 2;
+                world->spareContacts = MemRealloc(world->spareContacts, sizeof(Contact) * world->maxContacts);
+        }
+
+        // Last time's contacts become the spares, this time's go in the other set
+        Contact *contacts = world->spareContacts;
+        world->spareContacts = world->contacts;
+        world->contacts = contacts;
+        int old = 0;
+        world->numContacts = 0;
+        for (int p = 0; p < bp->numPairs; p++) {
+                int a = bp->pairs[p].a;
+                int b = bp->pairs[p].b;
+                CollisionData data = {.collided = false};
+                while (old < world->numPairs && (world->pairB[old] < b || (world->pairB[old] == b && world->pairA[old] < a)))
+                        old++;
+                bool had = old < world->numPairs && world->pairA[old] == a && world->pairB[old] == b;
+                CollisionData was = had ? world->pairCollisions[old] : data;
+                // numContacts goes on counting past the room there was
+                int room = world->bodies[a]->numPoints + world->bodies[b]->numPoints;
+                int numWas = was.numContacts < room ? was.numContacts : room;
+                if (world->bodyAsleep[a] && world->bodyAsleep[b]) {
+                        data = was;
+                        memcpy(world->contacts + world->numContacts, world->spareContacts + was.firstContact, sizeof(Contact) * numWas);
+                } else if (world->warmStarting) {
+                        data.cachedContact = was.firstContact;
+                        data.numCached = numWas;
+                }
+                data.firstContact = world->numContacts;
+                world->numContacts += room;
+                world->sparePairA[p] = a;
+                world->sparePairB[p] = b;
+                world->sparePairCollisions[p] = data;
+        }
+
+        int *pairA = world->pairA;
+        int *pairB = world->pairB;
+        CollisionData *pairCollisions = world->pairCollisions;
+        world->pairA = world->sparePairA;
+        world->pairB = world->sparePairB;
+        world->pairCollisions = world->sparePairCollisions;
+        world->sparePairA = pairA;
+        world->sparePairB = pairB;
+        world->sparePairCollisions = pairCollisions;
+        world->numPairs = bp->numPairs;
+
+        if (grow)
+                world->spareContacts = MemRealloc(world->spareContacts, sizeof(Contact) * world->maxContacts);
+}
+
+static void addSweepPair(PhysicsWorld *world, int *num, int a, int b) {
+        if (*num == world->maxSweepPairs) {
+                world->maxSweepPairs *= 2;
+                world->sweepPairs = MemRealloc(world->sweepPairs, sizeof(BodyPair) * world->maxSweepPairs);
+        }
+        world->sweepPairs[(*num)++] = (BodyPair){a, b};
+}
+
+static bool overlapsBB(BB a, BB b) {
+        return !(a.max.x < b.min.x || a.max.y < b.min.y || a.min.x > b.max.x || a.min.y > b.max.y);
+}
+
+// Whether the two moved fast enough against each other to be swept
+static bool needsSweep(PhysicsWorld *world, int a, int b) {
+        SweptBody *A = &world->sweptBodies[a];
+        SweptBody *B = &world->sweptBodies[b];
+        return overlapsBB(A->box, B->box) && A->moved + B->moved > world->ccdFraction * fminf(A->thickness, B->thickness);
+}
+
+// The pairs moving fast enough to be swept, in the broadphase's order, so
+// they come out the same every time. A pair's fast if the two moved more
+// than ccdFraction of the thinner one between them, so one of them at least
+// moved half that much of the thinnest body anywhere. Those are the only
+// ones that need checking against everything
+static int findSweepPairs_PhysicsWorld(PhysicsWorld *world) {
+        float thinnest = INFINITY;
+        for (int b = 0; b < world->numBodies; b++) {
+                SoftBody *sb = world->bodies[b];
+                const Vector2 *from = world->sweepFrom + world->bodyStart[b];
+                SweptBody *swept = &world->sweptBodies[b];
+                swept->box = sb->bounds;
+                swept->moved = 0.f;
+                swept->thickness = fminf(sb->bounds.max.x - sb->bounds.min.x, sb->bounds.max.y - sb->bounds.min.y);
+                for (int i = 0; i < sb->numPoints; i++) {
+                        swept->box.min = Vector2Min(swept->box.min, from[i]);
+                        swept->box.max = Vector2Max(swept->box.max, from[i]);
+                        swept->moved = fmaxf(swept->moved, Vector2DistanceSqr(from[i], sb->pointPos[i]));
+                }
+                swept->moved = sqrtf(swept->moved);
+                thinnest = fminf(thinnest, swept->thickness);
+        }
+        int numFast = 0;
+        for (int b = 0; b < world->numBodies; b++) {
+                SweptBody *swept = &world->sweptBodies[b];
+                swept->fast = swept->moved > 0.5f * world->ccdFraction * thinnest;
+                // Reusing the query scratch for the fast ones' ids
+                if (swept->fast)
+                        world->queryIds[numFast++] = b;
+        }
+
+        int num = 0;
+        for (int b = 0; b < world->numBodies; b++) {
+                if (world->sweptBodies[b].fast) {
+                        for (int a = 0; a < b; a++) {
+                                if (needsSweep(world, a, b))
+                                        addSweepPair(world, &num, a, b);
+                        }
+                } else {
+                        for (int k = 0; k < numFast && world->queryIds[k] < b; k++) {
+                                if (needsSweep(world, world->queryIds[k], b))
+                                        addSweepPair(world, &num, world->queryIds[k], b);
+                        }
+                }
+        }
+        return num;
+}
+
+// Sweeps the fast pairs, one after another on this thread. A pair that hits
+// goes back to when it did and has its contacts solved there, so later
+// pairs with either body in sweep from where it ended up
+static void sweep_PhysicsWorld(PhysicsWorld *world) {
+        world->numSweptPairs = 0;
+        world->numImpacts = 0;
+        if (world->ccdFraction <= 0.f)
+                return;
+        int numPairs = findSweepPairs_PhysicsWorld(world);
+        for (int p = 0; p < numPairs; p++) {
+                int a = world->sweepPairs[p].a;
+                int b = world->sweepPairs[p].b;
+                SoftBody *A = world->bodies[a];
+                SoftBody *B = world->bodies[b];
+                const Vector2 *fromA = world->sweepFrom + world->bodyStart[a];
+                const Vector2 *fromB = world->sweepFrom + world->bodyStart[b];
+                // A body that's already gone back for another pair can have
+                // slowed down enough for this one not to need it any more
+                if (!needsSweep(world, a, b))
+                        continue;
+                world->numSweptPairs++;
+                int numContacts;
+                float depthA = world->ccdFraction * world->sweptBodies[a].thickness;
+                float depthB = world->ccdFraction * world->sweptBodies[b].thickness;
+                float toi = timeOfImpact(*A, fromA, *B, fromB, depthA, depthB, world->sweepHits, world->sweepContacts, 2 * world->maxBodyPoints, &numContacts);
+                if (numContacts == 0)
+                        continue;
+                world->numImpacts++;
+
+                int ids[2] = {a, b};
+                for (int k = 0; k < 2; k++) {
+                        SoftBody *sb = world->bodies[ids[k]];
+                        const Vector2 *from = world->sweepFrom + world->bodyStart[ids[k]];
+                        SweptBody *swept = &world->sweptBodies[ids[k]];
+                        swept->moved = 0.f;
+                        for (int i = 0; i < sb->numPoints; i++) {
+                                sb->pointPos[i] = Vector2Lerp(from[i], sb->pointPos[i], toi);
+                                swept->moved = fmaxf(swept->moved, Vector2Distance(from[i], sb->pointPos[i]));
+                        }
+                        if (world->bodyAsleep[ids[k]])
+                                PhysicsWorld_wakeBody(world, ids[k]);
+                }
+                ContactManifold manifold = {
+                    .A = A,
+                    .B = B,
+                    .contacts = world->sweepContacts,
+                    .numContacts = numContacts,
+                    .material = getMaterialPair(world->bodyMaterial[a], world->bodyMaterial[b]),
+                };
+                solveContacts(&manifold, 1, world->contactIterations);
+                updateBounds_SoftBody(A);
+                updateBounds_SoftBody(B);
+        }
+}
+
+typedef struct ManifoldJob {
+        ContactManifold *manifolds;
+        atomic_bool moved;
+} ManifoldJob;
+
+static void pushOut_job(void *data, int begin, int end, int worker) {
+        ManifoldJob *job = data;
+        bool moved = false;
+        for (int m = begin; m < end; m++) {
+                moved |= pushOutManifold(&job->manifolds[m]);
+        }
+        // Only ever set, so which job gets there first doesn't matter
+        if (moved)
+                atomic_store(&job->moved, true);
+}
+
+static void prepare_job(void *data, int begin, int end, int worker) {
+        ManifoldJob *job = data;
+        for (int m = begin; m < end; m++) {
+                prepareManifold(&job->manifolds[m]);
+        }
+}
+
+static void velocity_job(void *data, int begin, int end, int worker) {
+        ManifoldJob *job = data;
+        for (int m = begin; m < end; m++) {
+                solveManifoldVelocity(&job->manifolds[m]);
+        }
+}
+
+// Manifolds per job. Each is only a few contacts
+#define MANIFOLD_GRAIN 8
+
+// Runs fn over every color, one after the other, then the leftovers on
+// this thread
+static void runContactColors(PhysicsWorld *world, JobRangeFunc fn, ManifoldJob *job) {
+        for (int c = 0; c < world->numContactColors; c++) {
+                job->manifolds = world->coloredManifolds + world->colorStart[c];
+                JobSystem_parallelFor(world->jobs, world->colorStart[c + 1] - world->colorStart[c], MANIFOLD_GRAIN, fn, job);
+        }
+        job->manifolds = world->coloredManifolds;
+        fn(job, world->colorStart[CONTACT_COLORS], world->colorStart[CONTACT_COLORS + 1], 0);
+}
+
+// solveContacts, color by color. Within a color no two manifolds touch the
+// same points, so they can go in any order or all at once
+static void solveColored_PhysicsWorld(PhysicsWorld *world, int numManifolds) {
+        // Counting sort by color, leftovers last
+        int *start = world->colorStart;
+        memset(start, 0, sizeof(world->colorStart));
+        world->numContactColors = 0;
+        for (int m = 0; m < numManifolds; m++) {
+                int c = world->manifoldColor[m];
+                start[c + 1]++;
+                if (c < CONTACT_COLORS && c + 1 > world->numContactColors)
+                        world->numContactColors = c + 1;
+        }
+        for (int c = 0; c <= CONTACT_COLORS; c++) {
+                start[c + 1] += start[c];
+        }
+        int cursor[CONTACT_COLORS + 1];
+        memcpy(cursor, start, sizeof(cursor));
+        for (int m = 0; m < numManifolds; m++) {
+                world->coloredManifolds[cursor[world->manifoldColor[m]]++] = world->manifolds[m];
+        }
+
+        ManifoldJob job;
+        for (int it = 0; it < world->contactIterations; it++) {
+                atomic_init(&job.moved, false);
+                runContactColors(world, pushOut_job, &job);
+                if (!atomic_load(&job.moved))
+                        break;
+        }
+        runContactColors(world, prepare_job, &job);
+        for (int it = 0; it < world->contactIterations; it++) {
+                runContactColors(world, velocity_job, &job);
+        }
+}
+
+// Each self-colliding body against itself, after the pairs so it gets the
+// last word on where its points end up
+static void selfCollide_PhysicsWorld(PhysicsWorld *world) {
+        world->numSelfContacts = 0;
+        for (int b = 0; b < world->numBodies; b++) {
+                if (!world->bodySelfCollide[b] || world->bodyAsleep[b])
+                        continue;
+                SoftBody *sb = world->bodies[b];
+                const Vector2 *from = world->sweepFrom + world->bodyStart[b];
+                int numContacts = findSelfContacts(&world->selfHash, sb, from, world->sweepContacts, 2 * world->maxBodyPoints);
+                if (numContacts == 0)
+                        continue;
+                ContactManifold manifold = {
+                    .A = sb,
+                    .B = sb,
+                    .contacts = world->sweepContacts,
+                    .numContacts = numContacts,
+                    .material = getMaterialPair(world->bodyMaterial[b], world->bodyMaterial[b]),
+                };
+                solveContacts(&manifold, 1, world->contactIterations);
+                world->numSelfContacts += numContacts;
+        }
+}
+
+void collide_PhysicsWorld(PhysicsWorld *world, float dt) {
+        double start = GetTime();
+        sweep_PhysicsWorld(world);
+        world->sweepTime = GetTime() - start;
+
+        start = GetTime();
+        update_Broadphase(&world->broadphase, world->bodies);
+        world->broadphaseTime = GetTime() - start;
+        takePairs_PhysicsWorld(world);
+
+        // checkCollision only reads the bodies, so every pair can go at once
+        start = GetTime();
+        JobSystem_parallelFor(world->jobs, world->numPairs, 16, detectPairs_job, world);
+        world->narrowphaseTime = GetTime() - start;
+
+        // Solving moves points, and a body can be in lots of pairs, so this
+        // part either stays on one thread in pair order or goes color by
+        // color. Same order every time means the same result no matter how
+        // many threads did the detection
+        int numManifolds = 0;
+        world->numSolvedContacts = 0;
+        world->numWarmContacts = 0;
+        world->numContactColors = 0;
+        bool colored = world->contactOrder == ContactOrder_Colored;
+        if (colored)
+                memset(world->bodyColors, 0, sizeof(unsigned long long) * world->numBodies);
+        for (int p = 0; p < world->numPairs; p++) {
+                CollisionData data = world->pairCollisions[p];
+                if (!data.collided)
+                        continue;
+                int a = world->pairA[p];
+                int b = world->pairB[p];
+                if (world->bodyAsleep[a] && world->bodyAsleep[b])
+                        continue;
+                // Something awake ran into it
+                if (world->bodyAsleep[a])
+                        PhysicsWorld_wakeBody(world, a);
+                if (world->bodyAsleep[b])
+                        PhysicsWorld_wakeBody(world, b);
+                if (colored) {
+                        unsigned long long taken = world->bodyColors[a] | world->bodyColors[b];
+                        int c = taken == ~0ull ? CONTACT_COLORS : __builtin_ctzll(~taken);
+                        if (c < CONTACT_COLORS) {
+                                world->bodyColors[a] |= 1ull << c;
+                                world->bodyColors[b] |= 1ull << c;
+                        }
+                        world->manifoldColor[numManifolds] = c;
+                }
+                world->manifolds[numManifolds++] = (ContactManifold){
+                    .A = world->bodies[a],
+                    .B = world->bodies[b],
+                    .contacts = world->contacts + data.firstContact,
+                    .numContacts = data.numContacts,
+                    .material = getMaterialPair(world->bodyMaterial[a], world->bodyMaterial[b]),
+                };
+                world->numSolvedContacts += data.numContacts;
+                world->numWarmContacts += data.numWarm;
+        }
+        start = GetTime();
+        if (colored)
+                solveColored_PhysicsWorld(world, numManifolds);
+        else
+                solveContacts(world->manifolds, numManifolds, world->contactIterations);
+        world->solverTime = GetTime() - start;
+
+        start = GetTime();
+        selfCollide_PhysicsWorld(world);
+        world->selfTime = GetTime() - start;
+}
+
+static int findIsland(int *parent, int b) {
+        while (parent[b] != b) {
+                parent[b] = parent[parent[b]];
+                b = parent[b];
+        }
+        return b;
+}
+
+void PhysicsWorld_wakeBody(PhysicsWorld *world, int id) {
+        int island = world->bodyIsland[id];
+        for (int b = 0; b < world->numBodies; b++) {
+                if (world->bodyIsland[b] != island || !world->bodyAsleep[b])
+                        continue;
+                // It keeps its still frames, so if whatever woke it was only
+                // a nudge the island can nod straight back off
+                world->bodyAsleep[b] = false;
+                // Its Verlet forces are from before it fell asleep
+                world->lastForcesValid = false;
+        }
+}
+
+void updateSleep_PhysicsWorld(PhysicsWorld *world) {
+        int n = world->numBodies;
+        int *island = world->bodyIsland;
+        if (!world->allowSleep) {
+                for (int b = 0; b < n; b++) {
+                        island[b] = b;
+                        world->bodyStillFrames[b] = 0;
+                        if (world->bodyAsleep[b]) {
+                                world->bodyAsleep[b] = false;
+                                world->lastForcesValid = false;
+                        }
+                }
+                world->numIslands = n;
+                return;
+        }
+
+        for (int b = 0; b < n; b++) {
+                island[b] = b;
+                if (world->bodyAsleep[b])
+                        continue;
+                SoftBody *sb = world->bodies[b];
+                float energy = 0.f;
+                for (int i = 0; i < sb->numPoints; i++) {
+                        energy += Vector2LengthSqr(sb->pointVel[i]);
+                }
+                energy *= 0.5f * sb->mass / sb->numPoints;
+                if (energy < world->sleepEnergy)
+                        world->bodyStillFrames[b]++;
+                else
+                        world->bodyStillFrames[b] = 0;
+        }
+
+        // Union find over the contacts. Asleep pairs kept theirs from before
+        for (int p = 0; p < world->numPairs; p++) {
+                if (!world->pairCollisions[p].collided)
+                        continue;
+                int a = findIsland(island, world->pairA[p]);
+                int b = findIsland(island, world->pairB[p]);
+                // Lower id as the root, so islands come out the same whatever
+                // order the pairs were in
+                if (a < b)
+                        island[b] = a;
+                else if (b < a)
+                        island[a] = b;
+        }
+        world->numIslands = 0;
+        for (int b = 0; b < n; b++) {
+                island[b] = findIsland(island, b);
+                if (island[b] == b)
+                        world->numIslands++;
+        }
+        // An island is only as still as its least still body
+        int *islandStill = world->islandStill;
+        for (int b = 0; b < n; b++) {
+                islandStill[b] = INT_MAX;
+        }
+        for (int b = 0; b < n; b++) {
+                if (world->bodyStillFrames[b] < islandStill[island[b]])
+                        islandStill[island[b]] = world->bodyStillFrames[b];
+        }
+
+        for (int b = 0; b < n; b++) {
+                bool still = islandStill[island[b]] >= world->sleepFrames;
+                if (still && !world->bodyAsleep[b]) {
+                        SoftBody *sb = world->bodies[b];
+                        memset(sb->pointVel, 0, sizeof(Vector2) * sb->numPoints);
+                        world->bodyAsleep[b] = true;
+                } else if (!still && world->bodyAsleep[b]) {
+                        world->bodyAsleep[b] = false;
+                        world->lastForcesValid = false;
+                }
+        }
+}
+
+void step_PhysicsWorld(PhysicsWorld *world, float dt) {
+        update_PhysicsWorld(world, dt);
+        collide_PhysicsWorld(world, dt);
+        updateSleep_PhysicsWorld(world);
+}
+
+typedef struct BoxQuery {
+        PhysicsWorld *world;
+        BB box;
+        int count;
+} BoxQuery;
+
+static bool boxQuery(void *data, int id) {
+        BoxQuery *q = data;
+        // The tree only knows the fat boxes
+        if (overlapsBB(q->world->bodies[id]->bounds, q->box))
+                q->world->queryIds[q->count++] = id;
+        return true;
+}
+
+static int compareIds(const void *l, const void *r) {
+        int a = *(const int *)l;
+        int b = *(const int *)r;
+        return (a > b) - (a < b);
+}
+
+int PhysicsWorld_queryBox(PhysicsWorld *world, BB box, int *ids, int maxIds) {
+        BoxQuery q = {world, box, 0};
+        if (world->broadphase.type == Broadphase_AABBTree) {
+                AABBTree_query(&world->broadphase.tree, box, boxQuery, &q);
+                // The tree's order depends on how it got built, this doesn't
+                qsort(world->queryIds, q.count, sizeof(int), compareIds);
+        } else {
+                for (int b = 0; b < world->numBodies; b++) {
+                        boxQuery(&q, b);
+                }
+        }
+        memcpy(ids, world->queryIds, sizeof(int) * (q.count < maxIds ? q.count : maxIds));
+        return q.count;
+}
+
+typedef struct RayQuery {
+        PhysicsWorld *world;
+        RaycastHit best;
+} RayQuery;
+
+static float rayQuery(void *data, int id, Vector2 from, Vector2 to, float maxFraction) {
+        RayQuery *q = data;
+        RaycastHit hit;
+        if (!raycast_SoftBody(q->world->bodies[id], from, to, maxFraction, &hit))
+                return maxFraction;
+        if (q->best.body < 0 || hit.fraction < q->best.fraction || (hit.fraction == q->best.fraction && id < q->best.body)) {
+                q->best = hit;
+                q->best.body = id;
+        }
+        return q->best.fraction;
+}
+
+bool PhysicsWorld_raycast(PhysicsWorld *world, Vector2 from, Vector2 to, RaycastHit *hit) {
+        RayQuery q = {world, {.body = -1, .fraction = 1.f}};
+        if (world->broadphase.type == Broadphase_AABBTree) {
+                AABBTree_raycast(&world->broadphase.tree, from, to, 1.f, rayQuery, &q);
+        } else {
+                BB ray = {Vector2Min(from, to), Vector2Max(from, to)};
+                for (int b = 0; b < world->numBodies; b++) {
+                        if (overlapsBB(world->bodies[b]->bounds, ray))
+                                rayQuery(&q, b, from, to, q.best.fraction);
+                }
+        }
+        if (q.best.body < 0)
+                return false;
+        *hit = q.best;
+        return true;
+}
+
+unsigned long long hash_PhysicsWorld(PhysicsWorld *world) {
+        // FNV-1a, a 32 bit word at a time. -0 and 0 hash differently, which
+        // is the point: they'd only differ if the runs did
+        unsigned long long h = 14695981039346656037ull;
+        for (int b = 0; b < world->numBodies; b++) {
+                SoftBody *sb = world->bodies[b];
+                const unsigned int *words[2] = {(const unsigned int *)sb->pointPos, (const unsigned int *)sb->pointVel};
+                for (int k = 0; k < 2; k++) {
+                        for (int i = 0; i < 2 * sb->numPoints; i++) {
+                                h = (h ^ words[k][i]) * 1099511628211ull;
+                        }
+                }
+        }
+        return h;
+}
+
+void PhysicsWorld_storePrevious(PhysicsWorld *world) {
+        for (int b = 0; b < world->numBodies; b++) {
+                SoftBody *sb = world->bodies[b];
+                memcpy(world->prevPos + world->bodyStart[b], sb->pointPos, sizeof(Vector2) * sb->numPoints);
+        }
+}
+
+SoftBody PhysicsWorld_interpolate(PhysicsWorld *world, int id, float alpha) {
+        SoftBody sb = *world->bodies[id];
+        Vector2 *prev = world->prevPos + world->bodyStart[id];
+        Vector2 *out = world->renderPos + world->bodyStart[id];
+        for (int i = 0; i < sb.numPoints; i++) {
+                out[i] = Vector2Lerp(prev[i], sb.pointPos[i], alpha);
+        }
+        sb.pointPos = out;
+        return sb;
+}
+
+void projectSB_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints *dest, SBPoints src, Vector2 *forces, float dt) {
+        int p = r.pointBegin;
+        getSimdKernels()->projectMasses((float *)(dest->pos + p), (float *)(dest->vel + p), (float *)(src.pos + p), (float *)(src.vel + p),
+                                        (float *)(forces + p), world->pointInvMass + 2 * p, 2 * (r.pointEnd - p), dt);
+}
+
+/* Batched forces */
+// Most bodies just run the same force kernel update_SoftBody would, straight
+// on the packed arrays. These passes are for wide bodies; they mirror the
+// kernels' math, but add onto each point in batch order rather than edge
+// order. That order's fixed, so a wide body comes out the same for any thread
+// count, just not bit for bit the same as the unsplit kernels would give it.
+
+// One batch of a wide body's edges, spread over the job system
+typedef struct EdgeBatchJob {
+        PhysicsWorld *world;
+        Vector2 *forces;
+        SBPoints points;
+        const int *edges;
+} EdgeBatchJob;
+
+// Edges per job inside a batch
+#define EDGE_BATCH_GRAIN 256
+
+// Runs fn over body's batches one after the other. Only called from the
+// thread that owns the job system, never from inside a job
+static void runColored(PhysicsWorld *world, EdgeColoring *c, int body, JobRangeFunc fn, EdgeBatchJob *job) {
+        for (int b = c->bodyBatch[body]; b < c->bodyBatch[body + 1]; b++) {
+                job->edges = c->order + c->batchStart[b];
+                JobSystem_parallelFor(world->jobs, c->batchStart[b + 1] - c->batchStart[b], EDGE_BATCH_GRAIN, fn, job);
+        }
+}
+
+static inline void addSpringForce(Vector2 *forces, PhysicsWorld *world, SBPoints points, int i) {
+        int a_idx = world->springA[i];
+        int b_idx = world->springB[i];
+        BodyParams *p = &world->params[world->springBody[i]];
+        Vector2 diff = Vector2Subtract(points.pos[a_idx], points.pos[b_idx]);
+
+        float length = Vector2Length(diff);
+        Vector2 diffNorm = Vector2Scale(diff, 1. / length);
+        float x = world->lengths[i] - length;
+
+        float springForce = p->springStrength * x;
+        float dampForce = p->springDamp * Vector2DotProduct(Vector2Subtract(points.vel[b_idx], points.vel[a_idx]), diffNorm);
+
+        float f = springForce + dampForce;
+
+        forces[a_idx] = Vector2Add(forces[a_idx], Vector2Scale(diffNorm, f));
+        forces[b_idx] = Vector2Add(forces[b_idx], Vector2Scale(diffNorm, -f));
+}
+
+static void springBatch_job(void *data, int begin, int end, int worker) {
+        EdgeBatchJob *job = data;
+        for (int k = begin; k < end; k++) {
+                addSpringForce(job->forces, job->world, job->points, job->edges[k]);
+        }
+}
+
+void calcForce_springs_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        if (r.wide) {
+                EdgeBatchJob job = {.world = world, .forces = forces, .points = points};
+                runColored(world, &world->springColors, r.bodyBegin, springBatch_job, &job);
+                return;
+        }
+        for (int i = r.springBegin; i < r.springEnd; i++) {
+                addSpringForce(forces, world, points, i);
+        }
+}
+
+void calcShapes_PhysicsWorld(PhysicsWorld *world, WorldRange r, SBPoints points) {
+        // Same as calcForce_shape's matching, body by body
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                if (!(world->params[b].type & SoftBodyType_Shape))
+                        continue;
+                int start = world->bodyStart[b];
+                int num = world->bodyStart[b + 1] - start;
+                if (world->bodyClusterStart[b] == world->bodyClusterStart[b + 1]) {
+                        world->bodyFrame[b] = matchShape(world->shape + start, (Vector2){0, 0}, points.pos + start, NULL, num);
+                        continue;
+                }
+                for (int c = world->bodyClusterStart[b]; c < world->bodyClusterStart[b + 1]; c++) {
+                        ShapeCluster cluster = world->clusters[c];
+                        world->clusterFrame[c] = matchShape(world->shape, cluster.restCenter, points.pos, world->clusterPoints + cluster.begin,
+                                                            cluster.end - cluster.begin);
+                }
+        }
+}
+
+void calcForce_shape_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        calcShapes_PhysicsWorld(world, r, points);
+
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                BodyParams *p = &world->params[b];
+                if (!(p->type & SoftBodyType_Shape))
+                        continue;
+                int start = world->bodyStart[b];
+                int num = world->bodyStart[b + 1] - start;
+                if (world->bodyClusterStart[b] == world->bodyClusterStart[b + 1]) {
+                        pullToShape(forces + start, world->shape + start, points.pos + start, NULL, num, world->bodyFrame[b], (Vector2){0, 0},
+                                    p->shapeSpringStrength);
+                        continue;
+                }
+                for (int c = world->bodyClusterStart[b]; c < world->bodyClusterStart[b + 1]; c++) {
+                        ShapeCluster cluster = world->clusters[c];
+                        pullToShape(forces, world->shape, points.pos, world->clusterPoints + cluster.begin, cluster.end - cluster.begin,
+                                    world->clusterFrame[c], cluster.restCenter, p->shapeSpringStrength);
+                }
+        }
+}
+
+static inline void addSurfaceForce(Vector2 *forces, PhysicsWorld *world, SBPoints points, int i) {
+        int a = world->surfaceA[i];
+        int b = world->surfaceB[i];
+        float P = world->bodyVolume[world->surfaceBody[i]];
+        Vector2 surface = Vector2Subtract(points.pos[a], points.pos[b]);
+        Vector2 surface_outv = (Vector2){-surface.y, surface.x};
+
+        Vector2 f = {-surface.y * P, surface.x * P};
+
+        Vector2 velocity = Vector2Scale(Vector2Add(points.vel[a], points.vel[b]), 0.5f);
+        float dot = Vector2DotProduct(surface_outv, velocity);
+        if (dot > 0.f) {
+                float isl = 1.0f / Vector2Length(surface);
+                float v = sqrtf(Vector2LengthSqr(velocity));
+                float F_D = 0.5 * world->values.airPressure * world->params[world->surfaceBody[i]].linearDrag * dot * v * isl;
+                f = Vector2Add(f, Vector2Scale(surface_outv, -F_D));
+        }
+
+        forces[a] = Vector2Add(forces[a], f);
+        forces[b] = Vector2Add(forces[b], f);
+}
+
+static void surfaceBatch_job(void *data, int begin, int end, int worker) {
+        EdgeBatchJob *job = data;
+        for (int k = begin; k < end; k++) {
+                addSurfaceForce(job->forces, job->world, job->points, job->edges[k]);
+        }
+}
+
+void calcForce_surfaces_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                world->bodyVolume[b] = 0.f;
+        }
+        for (int i = r.surfaceBegin; i < r.surfaceEnd; i++) {
+                Vector2 a = points.pos[world->surfaceA[i]];
+                Vector2 b = points.pos[world->surfaceB[i]];
+                world->bodyVolume[world->surfaceBody[i]] += a.x * b.y - a.y * b.x;
+        }
+        // Reuse the volume slot for the pressure, nobody needs V after this.
+        // No pressure is just 0, which adds nothing
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                bool pressure = world->params[b].type & SoftBodyType_Pressure;
+                world->bodyVolume[b] = pressure ? world->params[b].nRT / (world->bodyVolume[b] * 0.5f) : 0.f;
+        }
+
+        // The volume's one sum per body, cheap enough to keep on this thread
+        if (r.wide) {
+                EdgeBatchJob job = {.world = world, .forces = forces, .points = points};
+                runColored(world, &world->surfaceColors, r.bodyBegin, surfaceBatch_job, &job);
+                return;
+        }
+        for (int i = r.surfaceBegin; i < r.surfaceEnd; i++) {
+                addSurfaceForce(forces, world, points, i);
+        }
+}
+
+void calcForce_gravity_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        for (int i = r.pointBegin; i < r.pointEnd; i++) {
+                forces[i] = Vector2Add(forces[i], Vector2Scale(world->values.gravity, world->params[world->pointBody[i]].mass));
+        }
+}
+
+void calcForces_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        if (r.wide) {
+                // Same order as the kernels
+                calcForce_springs_PhysicsWorld(forces, world, r, points);
+                calcForce_shape_PhysicsWorld(forces, world, r, points);
+                calcForce_gravity_PhysicsWorld(forces, world, r, points);
+                calcForce_surfaces_PhysicsWorld(forces, world, r, points);
+                return;
+        }
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                world->params[b].calcForces(forces, &world->forceBodies[b], points, world->values);
+        }
+}
+
+void calcForce_external_PhysicsWorld(Vector2 *forces, PhysicsWorld *world, WorldRange r, SBPoints points) {
+        if (r.wide) {
+                calcForce_gravity_PhysicsWorld(forces, world, r, points);
+                calcForce_surfaces_PhysicsWorld(forces, world, r, points);
+                return;
+        }
+        // Masking the flags down picks the kernel without springs or shape
+        for (int b = r.bodyBegin; b < r.bodyEnd; b++) {
+                forceKernels[world->params[b].type & SoftBodyType_Pressure](forces, &world->forceBodies[b], points, world->values);
+        }
+}
@@ -1,18 +1,28 @@
 // Made by Teo Fontana (c) 2024
 
+#include <bench.h>
 #include <core/collision.h>
 #include <core/core.h>
 #include <core/physics.h>
 #include <core/render.h>
+#include <core/simclock.h>
+#include <core/world.h>
 #include <debug.h>
 #include <mycam.h>
 #include <raylib.h>
+#include <assert.h>
 #include <raymath.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Currently just some testing builds, no real game yet */
 
-int main() {
+int main(int argc, char **argv) {
+        if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+                runBenchmarks();
+                return 0;
+        }
+
         const int screenWidth = 800;
         const int screenHeight = 600;
         InitWindow(screenWidth, screenHeight, "Test Platformer");
@@ -46,6 +56,17 @@ int main() {
         circleSoftbody(&body2, (Vector2){3.f, 2.f}, 2.f, 15);
         // // rectSoftbody(&body2, (Vector2){5.0, -1.5}, (Vector2){5.0, 3.0}, 5, 3, true);
 
+        PhysicsWorld world = createPhysicsWorld(worldValues, 16);
+        // Two bodies don't need it, but it keeps the threaded path exercised
+        JobSystem *jobs = createJobSystem(4);
+        world.jobs = jobs;
+        world.contactOrder = ContactOrder_Colored;
+        int body1Id = PhysicsWorld_addBody(&world, &body1);
+        int body2Id = PhysicsWorld_addBody(&world, &body2);
+
+        // Physics always runs at 120Hz, however fast we're drawing
+        SimClock clock = createSimClock(120.f, 8);
+
         applyImpulse(&body1, (Vector2){1.f, 0.f});
         applyImpulse(&body2, (Vector2){-1.f, 0.f});
 
@@ -75,41 +96,47 @@ int main() {
                     : IsKeyDown(KEY_ONE)   ? .1f
                                            : 0.0f;
 
-                if (testspeedmultiplier != 0.0f) {
-                        update_SoftBody(&body1, worldValues, dt * testspeedmultiplier);
-                        update_SoftBody(&body2, worldValues, dt * testspeedmultiplier);
-                } else if (IsKeyPressed(KEY_SPACE)) {
-                        update_SoftBody(&body1, worldValues, dt);
-                        update_SoftBody(&body2, worldValues, dt);
-                } else
-                        goto skipCollision;
-
-                CollisionData data = checkCollision(body1, body2);
-                if (data.collided) {
-                        handleCollision(body1, body2, data, SoftBodyMaterial_DEFAULT, SoftBodyMaterial_DEFAULT, dt);
+                int steps;
+                if (testspeedmultiplier != 0.0f)
+                        steps = SimClock_advance(&clock, dt * testspeedmultiplier);
+                else if (IsKeyPressed(KEY_SPACE))
+                        steps = 1;
+                else
+                        steps = 0;
+
+                for (int step = 0; step < steps; step++) {
+                        PhysicsWorld_storePrevious(&world);
+                        step_PhysicsWorld(&world, clock.fixedDt);
+                        // All the bodies were added up front, so stepping shouldn't allocate
+                        assert(world.stepAllocs == 0);
                 }
-        skipCollision:
+                // Paused or single-stepping, just show where things actually are
+                float alpha = testspeedmultiplier != 0.0f ? clock.alpha : 1.f;
+
                 // camera.center = body1.shapePosition;
                 updateCamera(&camera);
 
                 BeginMode2D(camera.raylib_cam);
                 /* Draw Stuff Here */
-                renderSoftbody(body1, rend1);
-                renderSoftbody(body2, rend2);
+                renderSoftbody(PhysicsWorld_interpolate(&world, body1Id, alpha), rend1);
+                renderSoftbody(PhysicsWorld_interpolate(&world, body2Id, alpha), rend2);
                 // DrawSoftbody_debug(body1);
                 // DrawSoftbody_debug(body2);
 
-                if (data.collided) {
+                // The only pair there can be is body1 against body2
+                CollisionData data = world.numPairs > 0 ? world.pairCollisions[0] : (CollisionData){.collided = false};
+                for (int c = 0; c < data.numContacts; c++) {
+                        Contact contact = world.contacts[data.firstContact + c];
                         SoftBody *a, *b;
-                        if (data.invert) {
+                        if (contact.invert) {
                                 a = &body2;
                                 b = &body1;
                         } else {
                                 a = &body1;
                                 b = &body2;
                         }
-                        DrawCircleV(a->pointPos[data.point], 0.2f, RED);
-                        DrawLineEx(b->pointPos[b->surfaceA[data.edge]], b->pointPos[b->surfaceB[data.edge]], 0.1f, RED);
+                        DrawCircleV(a->pointPos[contact.point], 0.2f, RED);
+                        DrawLineEx(b->pointPos[b->surfaceA[contact.edge]], b->pointPos[b->surfaceB[contact.edge]], 0.1f, RED);
                 }
 
                 EndMode2D();
@@ -124,9 +151,17 @@ int main() {
 
                 // DrawText(TextFormat("%f", body1.bounds.max.x), 20, 20, 20, BLACK);
                 DrawText(TextFormat("Simulation Speed %0.1fx", testspeedmultiplier), 20, 40, 20, BLACK);
+                DrawText(TextFormat("Awake %i/%i bodies, %i points", world.numAwakeBodies, world.numBodies, world.numAwakePoints), 20, 60, 20, BLACK);
+                DrawText(TextFormat("State %016llx", hash_PhysicsWorld(&world)), 20, 80, 20, BLACK);
+                DrawText(TextFormat("Broadphase %i pairs, %.3f ms", world.numPairs, world.broadphaseTime * 1000.0), 20, 100, 20, BLACK);
+                DrawText(TextFormat("Solver %i contacts (%i warm), %.3f ms", world.numSolvedContacts, world.numWarmContacts, world.solverTime * 1000.0), 20, 120, 20, BLACK);
+                DrawText(TextFormat("Swept %i pairs, %i hit, %.3f ms", world.numSweptPairs, world.numImpacts, world.sweepTime * 1000.0), 20, 140, 20, BLACK);
+                DrawText(TextFormat("Self %i contacts, %.3f ms", world.numSelfContacts, world.selfTime * 1000.0), 20, 160, 20, BLACK);
                 EndDrawing();
         }
 
+        freePhysicsWorld(&world);
+        freeJobSystem(jobs);
         freeSoftbody(&body1);
         freeRenderer(&rend1);
         freeSoftbody(&body2);